@@ -1,47 +1,96 @@
-#ifndef __pg_recvlogical_h__
-#define __pg_recvlogical_h__
-
-typedef unsigned char (*pg_recvlogical_on_changes_callback_f)(const void* context, const char* changes, unsigned int size);
-
-struct pg_recvlogical_connection_settings_t
-{
-    const char* _dbname;
-	const char* _host;
-	const char* _port;
-	const char* _username;
-	const char* _password;
-    unsigned int _id;
-};
-
-struct pg_recvlogical_replication_settings_t
-{
-	const char* _startpos;
-	const char* _endpos;
-	const char* _option;
-	const char* _plugin;
-	unsigned    _status_interval;/* 10 * 1000;	10 sec = default */
-	const char* _slot;
-} ;
-
-struct pg_recvlogical_init_settings_t
-{
-    struct pg_recvlogical_connection_settings_t _connection;
-    struct pg_recvlogical_replication_settings_t _repication;
-    char _verbose;
-};
-
-#ifdef __cplusplus
-extern "C"{
-#endif 
-
-int pg_recvlogical_init(const struct pg_recvlogical_init_settings_t* pg_recvlogical_settings, const char* exec_path);
-
-void pg_recvlogical_stream_logical_start(const void* context, pg_recvlogical_on_changes_callback_f on_changes);
-
-void pg_recvlogical_stream_logical_stop();
-
-#ifdef __cplusplus
-}
-#endif
-
+#ifndef __pg_recvlogical_h__
+#define __pg_recvlogical_h__
+
+typedef unsigned char (*pg_recvlogical_on_changes_callback_f)(const void* context, const char* changes, unsigned int size);
+
+/* called while no data is pending on the stream, at least every interval_ms */
+typedef void (*pg_recvlogical_on_idle_callback_f)(const void* context);
+
+struct pg_recvlogical_connection_settings_t
+{
+    const char* _dbname;
+	const char* _host;
+	const char* _port;
+	const char* _username;
+	const char* _password;
+    unsigned int _id;
+};
+
+struct pg_recvlogical_replication_settings_t
+{
+	const char* _startpos;
+	const char* _endpos;
+	const char* _option;/* output plugin options, "name=value,name" */
+	const char* _plugin;
+	unsigned    _status_interval;/* 10 * 1000;	10 sec = default */
+	unsigned    _fsync_interval;/* confirm the flush position every n sec, 0 = 10 sec default */
+	const char* _slot;
+} ;
+
+struct pg_recvlogical_init_settings_t
+{
+    struct pg_recvlogical_connection_settings_t _connection;
+    struct pg_recvlogical_replication_settings_t _repication;
+    char _verbose;
+};
+
+#ifdef __cplusplus
+extern "C"{
+#endif 
+
+int pg_recvlogical_init(const struct pg_recvlogical_init_settings_t* pg_recvlogical_settings, const char* exec_path);
+
+void pg_recvlogical_stream_logical_start(const void* context, pg_recvlogical_on_changes_callback_f on_changes);
+
+/* after pg_recvlogical_init: creates the slot with output_plugin and exports its snapshot,
+   which stays valid until the stream starts on the same connection; streaming then begins
+   at consistent_lsn. Returns 0 on failure, the slot may already exist. */
+int pg_recvlogical_create_slot(const char* output_plugin, char* snapshot, unsigned int size, unsigned long long* consistent_lsn);
+
+/* drops the slot on the connection of pg_recvlogical_init, returns 0 on failure */
+int pg_recvlogical_drop_slot(void);
+
+void pg_recvlogical_stream_logical_stop();
+
+void pg_recvlogical_set_on_idle(pg_recvlogical_on_idle_callback_f on_idle, unsigned int interval_ms);
+
+/* from the stream thread only: LSN of the message being consumed and the server's WAL end */
+void pg_recvlogical_get_position(unsigned long long* lsn, unsigned long long* wal_end);
+
+/* from the stream thread only: server clock sendTime of the last message, us since the Unix epoch */
+long long pg_recvlogical_get_send_time(void);
+
+/* from the stream thread only: everything up to lsn is applied; from the first call on the
+   flush position reported to the server follows this instead of what was received */
+void pg_recvlogical_confirm_applied(unsigned long long lsn);
+
+/* Raw change archive: every message passed to pg_recvlogical_archive_write() is appended to
+   rotating segment files through the directory or tar WalWriteMethod, as a record of
+   PG_RECVLOGICAL_ARCHIVE_HEADER_SIZE bytes, all big endian,
+     uint32 size, uint64 lsn, uint64 wal_end, int64 send_time (us since the Unix epoch)
+   followed by the message. Single threaded, from the stream thread only. */
+#define PG_RECVLOGICAL_ARCHIVE_HEADER_SIZE 28
+
+/* path is the directory, or the tar file without its .tar/.tar.gz suffix; compression is
+   "none", "gzip", "lz4" or "zstd" at level, 0 for the library's default. gzip compresses
+   the whole tar file, lz4 and zstd every segment as a frame of its own (.lz4/.zst, also
+   inside the tar). long_window is zstd's log2 long distance matching window, 0 for off;
+   segment_mb 0 never rotates. Returns 0 on failure. */
+int pg_recvlogical_archive_open(const char* path, int tar, const char* compression, int level,
+    int long_window, unsigned int segment_mb);
+
+/* returns 0 when the record could not be written */
+int pg_recvlogical_archive_write(unsigned long long lsn, unsigned long long wal_end, long long send_time,
+    const char* data, unsigned int size);
+
+/* hands buffered records to the segment and syncs it; returns 0 when either failed */
+int pg_recvlogical_archive_flush(void);
+
+/* closes the open segment and, for tar, finishes the file */
+void pg_recvlogical_archive_close(void);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif
\ No newline at end of file
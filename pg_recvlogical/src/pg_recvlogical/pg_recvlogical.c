@@ -26,6 +26,7 @@
 #include "getopt_long.h"
 #include "libpq-fe.h"
 #include "libpq/pqsignal.h"
+#include "port/pg_bswap.h"
 #include "pqexpbuffer.h"
 #include "receivelog.h"
 #include "streamutil.h"
@@ -53,6 +54,22 @@ static TimestampTz output_last_fsync = -1;
 static bool output_needs_fsync = false;
 static XLogRecPtr output_written_lsn = InvalidXLogRecPtr;
 static XLogRecPtr output_fsync_lsn = InvalidXLogRecPtr;
+static pg_recvlogical_on_idle_callback_f on_idle = NULL;
+static int	idle_interval = 0;
+static XLogRecPtr record_lsn = InvalidXLogRecPtr;	/* dataStart of the message being consumed */
+static XLogRecPtr server_wal_end = InvalidXLogRecPtr;	/* walEnd of the last XLogData or keepalive */
+static TimestampTz server_send_time = 0;	/* sendTime of the last XLogData or keepalive */
+static bool track_applied = false;
+static XLogRecPtr applied_lsn = InvalidXLogRecPtr;	/* confirmed by the consumer */
+
+/* Raw change archive, see pg_recvlogical_archive_open() */
+#define ARCHIVE_BUFFER_SIZE (1024 * 1024)
+static WalWriteMethod *archive_method = NULL;
+static bool archive_tar = false;
+static Walfile archive_file = NULL;
+static size_t archive_segment_size = 0;
+static size_t archive_segment_written = 0;
+static PQExpBuffer archive_buffer = NULL;
 
 static bool flushAndSendFeedback(PGconn *conn, TimestampTz *now);
 static void prepareToTerminate(PGconn *conn, XLogRecPtr endpos,
@@ -123,7 +140,8 @@ OutputFsync(TimestampTz now)
 {
 	output_last_fsync = now;
 
-	output_fsync_lsn = output_written_lsn;
+	/* once the consumer confirms what it applied, only that is reported flushed */
+	output_fsync_lsn = track_applied ? applied_lsn : output_written_lsn;
 
 	if (fsync_interval <= 0)
 		return true;
@@ -267,6 +285,10 @@ static void log_streaming(const void* context, pg_recvlogical_on_changes_callbac
 			struct timeval timeout;
 			struct timeval *timeoutptr = NULL;
 
+			/* Nothing pending, let the caller flush what it has buffered */
+			if (on_idle)
+				on_idle(context);
+
 			if (PQsocket(conn) < 0)
 			{
 				debug("invalid socket: %s", PQerrorMessage(conn));
@@ -310,6 +332,16 @@ static void log_streaming(const void* context, pg_recvlogical_on_changes_callbac
 				timeoutptr = &timeout;
 			}
 
+			/* Wake up in time for the next idle callback */
+			if (on_idle && idle_interval > 0 &&
+				(timeoutptr == NULL ||
+				 timeout.tv_sec * 1000 + timeout.tv_usec / 1000 > idle_interval))
+			{
+				timeout.tv_sec = idle_interval / 1000;
+				timeout.tv_usec = (idle_interval % 1000) * 1000;
+				timeoutptr = &timeout;
+			}
+
 			r = select(PQsocket(conn) + 1, &input_mask, NULL, NULL, timeoutptr);
 			if (r == 0 || (r < 0 && errno == EINTR))
 			{
@@ -364,10 +396,12 @@ static void log_streaming(const void* context, pg_recvlogical_on_changes_callbac
 			pos = 1;			/* skip msgtype 'k' */
 			walEnd = fe_recvint64(&copybuf[pos]);
 			output_written_lsn = Max(walEnd, output_written_lsn);
+			server_wal_end = Max(walEnd, server_wal_end);
 
 			pos += 8;			/* read walEnd */
 
-			pos += 8;			/* skip sendTime */
+			server_send_time = fe_recvint64(&copybuf[pos]);
+			pos += 8;			/* read sendTime */
 
 			if (r < pos + 1)
 			{
@@ -428,6 +462,8 @@ static void log_streaming(const void* context, pg_recvlogical_on_changes_callbac
 
 		/* Extract WAL location for this block */
 		cur_record_lsn = fe_recvint64(&copybuf[1]);
+		server_wal_end = Max(fe_recvint64(&copybuf[1 + 8]), server_wal_end);
+		server_send_time = fe_recvint64(&copybuf[1 + 8 + 8]);
 
 		if (endpos != InvalidXLogRecPtr && cur_record_lsn > endpos)
 		{
@@ -453,6 +489,7 @@ static void log_streaming(const void* context, pg_recvlogical_on_changes_callbac
 		if(on_changes)
 		{
 			debug(" on_changes initiated: %s\n", copybuf + hdr_len);
+			record_lsn = cur_record_lsn;
 			on_changes(context, copybuf + hdr_len, bytes_left);
 		}
 
@@ -539,11 +576,281 @@ void pg_recvlogical_stream_logical_start(const void* context, pg_recvlogical_on_
 	}
 }
 
+int pg_recvlogical_create_slot(const char* output_plugin, char* snapshot, unsigned int size, unsigned long long* consistent_lsn)
+{
+	char	   *exported = NULL;
+	XLogRecPtr	consistent = InvalidXLogRecPtr;
+
+	if (!conn)
+		conn = GetConnection();
+
+	if (!conn)
+		return 0;
+
+	debug("creating replication slot \"%s\" with an exported snapshot", replication_slot);
+
+	if (!CreateReplicationSlot(conn, replication_slot, output_plugin, false, false, false, false, &exported, &consistent))
+		return 0;
+
+	if (exported == NULL || strlen(exported) >= size)
+	{
+		debug("replication slot \"%s\" exported no usable snapshot", replication_slot);
+		pg_free(exported);
+		return 0;
+	}
+
+	strlcpy(snapshot, exported, size);
+	pg_free(exported);
+
+	if (consistent_lsn)
+		*consistent_lsn = consistent;
+
+	debug("replication slot \"%s\" consistent at %X/%X, snapshot %s", replication_slot,
+		  (uint32) (consistent >> 32), (uint32) consistent, snapshot);
+
+	return 1;
+}
+
+int pg_recvlogical_drop_slot(void)
+{
+	if (!conn)
+		conn = GetConnection();
+
+	if (!conn)
+		return 0;
+
+	debug("dropping replication slot \"%s\"", replication_slot);
+
+	return DropReplicationSlot(conn, replication_slot) ? 1 : 0;
+}
+
 void pg_recvlogical_stream_logical_stop()
 {
 	time_to_abort = true;
 }
 
+void pg_recvlogical_set_on_idle(pg_recvlogical_on_idle_callback_f callback, unsigned int interval_ms)
+{
+	on_idle = callback;
+	idle_interval = interval_ms;
+}
+
+void pg_recvlogical_get_position(unsigned long long* lsn, unsigned long long* wal_end)
+{
+	if (lsn)
+		*lsn = record_lsn;
+
+	if (wal_end)
+		*wal_end = server_wal_end;
+}
+
+long long pg_recvlogical_get_send_time(void)
+{
+	if (server_send_time == 0)
+		return 0;
+
+	/* TimestampTz counts from 2000-01-01 */
+	return server_send_time + ((long long) (POSTGRES_EPOCH_JDATE - UNIX_EPOCH_JDATE) * SECS_PER_DAY * USECS_PER_SEC);
+}
+
+void pg_recvlogical_confirm_applied(unsigned long long lsn)
+{
+	track_applied = true;
+	applied_lsn = Max(applied_lsn, (XLogRecPtr) lsn);
+}
+
+int pg_recvlogical_archive_open(const char* path, int tar, const char* compression, int level,
+	int long_window, unsigned int segment_mb)
+{
+	WalCompression spec;
+
+	if (archive_method)
+		return 1;
+
+	memset(&spec, 0, sizeof(spec));
+	spec.level = level;
+	spec.long_window = long_window;
+
+	if (compression == NULL || strcmp(compression, "none") == 0)
+		spec.method = COMPRESSION_NONE;
+	else if (strcmp(compression, "gzip") == 0)
+		spec.method = COMPRESSION_GZIP;
+	else if (strcmp(compression, "lz4") == 0)
+		spec.method = COMPRESSION_LZ4;
+	else if (strcmp(compression, "zstd") == 0)
+		spec.method = COMPRESSION_ZSTD;
+	else
+	{
+		debug("unknown archive compression \"%s\"", compression);
+		return 0;
+	}
+
+	if (!WalCompressionSupported(spec.method))
+	{
+		debug("this build does not support %s compression", compression);
+		return 0;
+	}
+
+	if (!tar)
+	{
+		char	   *directory = pg_strdup(path);
+		int			ret = pg_mkdir_p(directory, pg_dir_create_mode);
+
+		pg_free(directory);
+
+		if (ret != 0 && errno != EEXIST)
+		{
+			debug("could not create archive directory \"%s\": %m", path);
+			return 0;
+		}
+	}
+
+	/*
+	 * walmethods allows one method per program, the archive is its only user.
+	 * With sync, pg_recvlogical_archive_flush() fsyncs the segment and ends its
+	 * compressed frame, so what the consumer confirms after it is on disk.
+	 * A segment is named after its first LSN, so a restart that resends from
+	 * the confirmed position re-creates it; truncate drops the old contents.
+	 */
+	archive_method = tar ? CreateWalTarMethod(path, &spec, true)
+						 : CreateWalDirectoryMethod(path, &spec, true, true);
+	archive_tar = tar;
+	archive_segment_size = (size_t) segment_mb * 1024 * 1024;
+	archive_segment_written = 0;
+	archive_buffer = createPQExpBuffer();
+
+	debug("archiving changes to %s%s, compression %s level %d", path, tar ? " (tar)" : "",
+		  compression ? compression : "none", level);
+
+	return 1;
+}
+
+static bool
+archive_flush_buffer(void)
+{
+	ssize_t		len = archive_buffer->len;
+	bool		ok;
+
+	if (archive_file == NULL || len == 0)
+		return true;
+
+	ok = archive_method->write(archive_file, archive_buffer->data, len) == len;
+
+	if (!ok)
+		debug("could not write archive segment: %s", archive_method->getlasterror());
+
+	resetPQExpBuffer(archive_buffer);
+
+	return ok;
+}
+
+static bool
+archive_close_segment(void)
+{
+	bool		ok = archive_flush_buffer();
+
+	if (archive_file == NULL)
+		return ok;
+
+	if (archive_method->close(archive_file, CLOSE_NORMAL) != 0)
+	{
+		debug("could not close archive segment: %s", archive_method->getlasterror());
+		ok = false;
+	}
+
+	archive_file = NULL;
+	archive_segment_written = 0;
+
+	return ok;
+}
+
+/*
+ * Segments are named after the LSN of their first record, so they sort in stream order;
+ * a directory segment keeps a .partial suffix until it is closed.
+ */
+int pg_recvlogical_archive_write(unsigned long long lsn, unsigned long long wal_end, long long send_time,
+								 const char* data, unsigned int size)
+{
+	char		header[PG_RECVLOGICAL_ARCHIVE_HEADER_SIZE];
+	uint32		len = pg_hton32(size);
+
+	if (!archive_method)
+		return 0;
+
+	if (archive_file && archive_segment_size > 0 && archive_segment_written >= archive_segment_size &&
+		!archive_close_segment())
+		return 0;
+
+	if (archive_file == NULL)
+	{
+		char		name[MAXPGPATH];
+
+		snprintf(name, sizeof(name), "%08X%08X.chg", (uint32) (lsn >> 32), (uint32) lsn);
+
+		archive_file = archive_method->open_for_write(name, archive_tar ? NULL : ".partial", 0);
+
+		if (archive_file == NULL)
+		{
+			debug("could not open archive segment \"%s\": %s", name, archive_method->getlasterror());
+			return 0;
+		}
+	}
+
+	memcpy(header, &len, 4);
+	fe_sendint64(lsn, header + 4);
+	fe_sendint64(wal_end, header + 12);
+	fe_sendint64(send_time, header + 20);
+
+	appendBinaryPQExpBuffer(archive_buffer, header, sizeof(header));
+	appendBinaryPQExpBuffer(archive_buffer, data, size);
+
+	archive_segment_written += sizeof(header) + size;
+
+	if (archive_buffer->len >= ARCHIVE_BUFFER_SIZE)
+		return archive_flush_buffer() ? 1 : 0;
+
+	return 1;
+}
+
+int pg_recvlogical_archive_flush(void)
+{
+	if (!archive_method)
+		return 1;
+
+	if (!archive_flush_buffer())
+		return 0;
+
+	if (archive_file != NULL && archive_method->sync(archive_file) != 0)
+	{
+		debug("could not sync archive segment: %s", archive_method->getlasterror());
+		return 0;
+	}
+
+	return 1;
+}
+
+void pg_recvlogical_archive_close(void)
+{
+	if (!archive_method)
+		return;
+
+	archive_close_segment();
+
+	if (!archive_method->finish())
+		debug("could not finish archive: %s", archive_method->getlasterror());
+
+	if (archive_tar)
+		FreeWalTarMethod();
+	else
+		FreeWalDirectoryMethod();
+
+	pg_free(archive_method);
+	destroyPQExpBuffer(archive_buffer);
+
+	archive_method = NULL;
+	archive_buffer = NULL;
+}
+
 /*
  * Unfortunately we can't do sensible signal handling on windows...
  */
@@ -655,13 +962,27 @@ pg_recvlogical_init(const struct pg_recvlogical_init_settings_t* pg_recvlogical_
 	alloc_if_exist_params(&plugin, pg_recvlogical_settings->_repication._plugin);
 	alloc_if_exist_params(&replication_slot, pg_recvlogical_settings->_repication._slot);
 
-	//parseSetOptions();
+	/* plugin options, "name=value,name" */
+	if (pg_recvlogical_settings->_repication._option != NULL)
+	{
+		char	   *option_list = pg_strdup(pg_recvlogical_settings->_repication._option);
+		char	   *option;
+
+		pg_free(options);
+		options = NULL;
+		noptions = 0;
+
+		for (option = strtok(option_list, ","); option != NULL; option = strtok(NULL, ","))
+			parseSetOptions(option);
+	}
 	//XloGPositionFromString();
 
 	debug("psql connection: %s:%s:%s:%s:%s\n", (dbhost == NULL? "no user": dbhost), (dbport == NULL? "no user": dbport), (dbname == NULL? "no user": dbname), (dbuser == NULL? "no user": dbuser), password);
 	debug("psql replication [%s, %s]\n", (plugin? plugin: "no plugin"), (replication_slot? replication_slot: "no slot"));
 
 	standby_message_timeout = pg_recvlogical_settings->_repication._status_interval * 1000;
+	if (pg_recvlogical_settings->_repication._fsync_interval > 0)
+		fsync_interval = pg_recvlogical_settings->_repication._fsync_interval * 1000;
 	verbose = 1;
 	/*
 	 * Required arguments
@@ -674,7 +995,8 @@ pg_recvlogical_init(const struct pg_recvlogical_init_settings_t* pg_recvlogical_
 		exit(1);
 	}
 
-#ifndef WIN32
+	/* in the server the background worker owns its signals */
+#if !defined(WIN32) && !defined(EXTENTION_BUILD)
 	pqsignal(SIGINT, sigint_handler);
 	pqsignal(SIGHUP, sighup_handler);
 #endif
@@ -492,7 +492,8 @@ RunIdentifySystem(PGconn *conn, char **sysid, TimeLineID *starttli,
 bool
 CreateReplicationSlot(PGconn *conn, const char *slot_name, const char *plugin,
 					  bool is_temporary, bool is_physical, bool reserve_wal,
-					  bool slot_exists_ok)
+					  bool slot_exists_ok, char **snapshot,
+					  XLogRecPtr *consistent_point)
 {
 	PQExpBuffer query;
 	PGresult   *res;
@@ -516,7 +517,10 @@ CreateReplicationSlot(PGconn *conn, const char *slot_name, const char *plugin,
 	else
 	{
 		appendPQExpBuffer(query, " LOGICAL \"%s\"", plugin);
-		if (PQserverVersion(conn) >= 100000)
+		if (snapshot != NULL)
+			/* valid until the next command on this connection */
+			appendPQExpBufferStr(query, " EXPORT_SNAPSHOT");
+		else if (PQserverVersion(conn) >= 100000)
 			/* pg_recvlogical doesn't use an exported snapshot, so suppress */
 			appendPQExpBufferStr(query, " NOEXPORT_SNAPSHOT");
 	}
@@ -556,6 +560,27 @@ CreateReplicationSlot(PGconn *conn, const char *slot_name, const char *plugin,
 		return false;
 	}
 
+	if (consistent_point != NULL)
+	{
+		uint32		hi,
+					lo;
+
+		if (sscanf(PQgetvalue(res, 0, 1), "%X/%X", &hi, &lo) != 2)
+		{
+			debug("could not parse consistent point \"%s\" of slot \"%s\"",
+				  PQgetvalue(res, 0, 1), slot_name);
+
+			destroyPQExpBuffer(query);
+			PQclear(res);
+			return false;
+		}
+
+		*consistent_point = ((uint64) hi) << 32 | lo;
+	}
+
+	if (snapshot != NULL)
+		*snapshot = PQgetisnull(res, 0, 2) ? NULL : pg_strdup(PQgetvalue(res, 0, 2));
+
 	destroyPQExpBuffer(query);
 	PQclear(res);
 	return true;
@@ -20,6 +20,12 @@
 #ifdef HAVE_LIBZ
 #include <zlib.h>
 #endif
+#ifdef HAVE_LIBLZ4
+#include <lz4frame.h>
+#endif
+#ifdef HAVE_LIBZSTD
+#include <zstd.h>
+#endif
 
 #include "common/file_perm.h"
 #include "common/file_utils.h"
@@ -30,6 +36,250 @@
 /* Size of zlib buffer for .tar.gz */
 #define ZLIB_OUT_SIZE 4096
 
+/* Largest input of one LZ4 frame update, the output buffer is sized for it */
+#define LZ4_IN_SIZE 65536
+
+/*-------------------------------------------------------------------------
+ * Frame compression - lz4 and zstd compress every file as a frame of its
+ * own, handing the output to a callback of the method writing the file
+ *-------------------------------------------------------------------------
+ */
+typedef bool (*FrameOutput) (void *arg, const void *data, size_t len);
+
+typedef struct FrameCompressor
+{
+	WalCompressionMethod method;
+#ifdef HAVE_LIBLZ4
+	LZ4F_cctx  *lz4;
+#endif
+#ifdef HAVE_LIBZSTD
+	ZSTD_CCtx  *zstd;
+#endif
+	char	   *out;
+	size_t		outsize;
+	FrameOutput output;
+	void	   *arg;
+} FrameCompressor;
+
+bool
+WalCompressionSupported(WalCompressionMethod method)
+{
+	switch (method)
+	{
+		case COMPRESSION_NONE:
+			return true;
+		case COMPRESSION_GZIP:
+#ifdef HAVE_LIBZ
+			return true;
+#else
+			return false;
+#endif
+		case COMPRESSION_LZ4:
+#ifdef HAVE_LIBLZ4
+			return true;
+#else
+			return false;
+#endif
+		case COMPRESSION_ZSTD:
+#ifdef HAVE_LIBZSTD
+			return true;
+#else
+			return false;
+#endif
+	}
+
+	return false;
+}
+
+static const char *
+frame_suffix(WalCompressionMethod method)
+{
+	switch (method)
+	{
+		case COMPRESSION_LZ4:
+			return ".lz4";
+		case COMPRESSION_ZSTD:
+			return ".zst";
+		default:
+			return "";
+	}
+}
+
+static void
+frame_free(FrameCompressor *fc)
+{
+#ifdef HAVE_LIBLZ4
+	if (fc->lz4)
+		LZ4F_freeCompressionContext(fc->lz4);
+#endif
+#ifdef HAVE_LIBZSTD
+	if (fc->zstd)
+		ZSTD_freeCCtx(fc->zstd);
+#endif
+	if (fc->out)
+		pg_free(fc->out);
+	pg_free(fc);
+}
+
+/*
+ * Starts a frame, NULL if the method isn't built in or the library failed.
+ */
+static FrameCompressor *
+frame_begin(const WalCompression *compression, FrameOutput output, void *arg)
+{
+	FrameCompressor *fc = pg_malloc0(sizeof(FrameCompressor));
+
+	fc->method = compression->method;
+	fc->output = output;
+	fc->arg = arg;
+
+#ifdef HAVE_LIBLZ4
+	if (fc->method == COMPRESSION_LZ4)
+	{
+		LZ4F_preferences_t prefs;
+		size_t		r;
+
+		memset(&prefs, 0, sizeof(prefs));
+		prefs.compressionLevel = compression->level;
+
+		if (LZ4F_isError(LZ4F_createCompressionContext(&fc->lz4, LZ4F_VERSION)))
+		{
+			fc->lz4 = NULL;
+			frame_free(fc);
+			return NULL;
+		}
+
+		fc->outsize = Max(LZ4F_compressBound(LZ4_IN_SIZE, &prefs), LZ4F_HEADER_SIZE_MAX);
+		fc->out = pg_malloc(fc->outsize);
+
+		r = LZ4F_compressBegin(fc->lz4, fc->out, fc->outsize, &prefs);
+		if (LZ4F_isError(r) || !output(arg, fc->out, r))
+		{
+			frame_free(fc);
+			return NULL;
+		}
+
+		return fc;
+	}
+#endif
+#ifdef HAVE_LIBZSTD
+	if (fc->method == COMPRESSION_ZSTD)
+	{
+		fc->zstd = ZSTD_createCCtx();
+		if (fc->zstd == NULL ||
+			ZSTD_isError(ZSTD_CCtx_setParameter(fc->zstd, ZSTD_c_compressionLevel, compression->level)) ||
+			(compression->long_window > 0 &&
+			 (ZSTD_isError(ZSTD_CCtx_setParameter(fc->zstd, ZSTD_c_enableLongDistanceMatching, 1)) ||
+			  ZSTD_isError(ZSTD_CCtx_setParameter(fc->zstd, ZSTD_c_windowLog, compression->long_window)))))
+		{
+			frame_free(fc);
+			return NULL;
+		}
+
+		fc->outsize = ZSTD_CStreamOutSize();
+		fc->out = pg_malloc(fc->outsize);
+
+		return fc;
+	}
+#endif
+
+	frame_free(fc);
+	return NULL;
+}
+
+#ifdef HAVE_LIBZSTD
+static bool
+frame_zstd(FrameCompressor *fc, const void *buf, size_t count, ZSTD_EndDirective mode)
+{
+	ZSTD_inBuffer in = {buf, count, 0};
+	size_t		left;
+
+	do
+	{
+		ZSTD_outBuffer out = {fc->out, fc->outsize, 0};
+
+		left = ZSTD_compressStream2(fc->zstd, &out, &in, mode);
+		if (ZSTD_isError(left))
+			return false;
+
+		if (out.pos > 0 && !fc->output(fc->arg, fc->out, out.pos))
+			return false;
+	} while (in.pos < in.size || (mode != ZSTD_e_continue && left > 0));
+
+	return true;
+}
+#endif
+
+static bool
+frame_write(FrameCompressor *fc, const void *buf, size_t count)
+{
+#ifdef HAVE_LIBLZ4
+	if (fc->method == COMPRESSION_LZ4)
+	{
+		const char *data = buf;
+
+		while (count > 0)
+		{
+			size_t		chunk = Min(count, LZ4_IN_SIZE);
+			size_t		r = LZ4F_compressUpdate(fc->lz4, fc->out, fc->outsize, data, chunk, NULL);
+
+			if (LZ4F_isError(r) || (r > 0 && !fc->output(fc->arg, fc->out, r)))
+				return false;
+
+			data += chunk;
+			count -= chunk;
+		}
+
+		return true;
+	}
+#endif
+#ifdef HAVE_LIBZSTD
+	if (fc->method == COMPRESSION_ZSTD)
+		return frame_zstd(fc, buf, count, ZSTD_e_continue);
+#endif
+
+	return false;
+}
+
+/* Everything written so far becomes decodable, the frame goes on */
+static bool
+frame_flush(FrameCompressor *fc)
+{
+#ifdef HAVE_LIBLZ4
+	if (fc->method == COMPRESSION_LZ4)
+	{
+		size_t		r = LZ4F_flush(fc->lz4, fc->out, fc->outsize, NULL);
+
+		return !LZ4F_isError(r) && (r == 0 || fc->output(fc->arg, fc->out, r));
+	}
+#endif
+#ifdef HAVE_LIBZSTD
+	if (fc->method == COMPRESSION_ZSTD)
+		return frame_zstd(fc, NULL, 0, ZSTD_e_flush);
+#endif
+
+	return false;
+}
+
+static bool
+frame_end(FrameCompressor *fc)
+{
+#ifdef HAVE_LIBLZ4
+	if (fc->method == COMPRESSION_LZ4)
+	{
+		size_t		r = LZ4F_compressEnd(fc->lz4, fc->out, fc->outsize, NULL);
+
+		return !LZ4F_isError(r) && (r == 0 || fc->output(fc->arg, fc->out, r));
+	}
+#endif
+#ifdef HAVE_LIBZSTD
+	if (fc->method == COMPRESSION_ZSTD)
+		return frame_zstd(fc, NULL, 0, ZSTD_e_end);
+#endif
+
+	return false;
+}
+
 /*-------------------------------------------------------------------------
  * WalDirectoryMethod - write wal to a directory looking like pg_wal
  *-------------------------------------------------------------------------
@@ -41,8 +291,10 @@
 typedef struct DirectoryMethodData
 {
 	char	   *basedir;
-	int			compression;
+	int			compression;	/* gzip level, 0 for no gzip */
+	WalCompression frame_compression;	/* lz4 or zstd */
 	bool		sync;
+	bool		truncate;		/* files are re-created empty */
 } DirectoryMethodData;
 static DirectoryMethodData *dir_data = NULL;
 
@@ -59,8 +311,32 @@ typedef struct DirectoryMethodFile
 #ifdef HAVE_LIBZ
 	gzFile		gzfp;
 #endif
+	FrameCompressor *frame;
 } DirectoryMethodFile;
 
+static const char *
+dir_suffix(void)
+{
+	return dir_data->compression > 0 ? ".gz" : frame_suffix(dir_data->frame_compression.method);
+}
+
+static bool
+dir_write_frame(void *arg, const void *data, size_t len)
+{
+	DirectoryMethodFile *df = (DirectoryMethodFile *) arg;
+
+	errno = 0;
+	if (write(df->fd, data, len) != len)
+	{
+		/* if write didn't set errno, assume problem is no disk space */
+		if (errno == 0)
+			errno = ENOSPC;
+		return false;
+	}
+
+	return true;
+}
+
 static const char *
 dir_getlasterror(void)
 {
@@ -80,7 +356,7 @@ dir_open_for_write(const char *pathname, const char *temp_suffix, size_t pad_to_
 
 	snprintf(tmppath, sizeof(tmppath), "%s/%s%s%s",
 			 dir_data->basedir, pathname,
-			 dir_data->compression > 0 ? ".gz" : "",
+			 dir_suffix(),
 			 temp_suffix ? temp_suffix : "");
 
 	/*
@@ -89,7 +365,13 @@ dir_open_for_write(const char *pathname, const char *temp_suffix, size_t pad_to_
 	 * does not do any system calls to fsync() to make changes permanent on
 	 * disk.
 	 */
-	fd = open(tmppath, O_WRONLY | O_CREAT | PG_BINARY, pg_file_create_mode);
+	/*
+	 * With truncate, a file that is created again under the same name, as an
+	 * archive segment is after a restart, does not keep the old tail behind
+	 * the new data. Without it, a padded WAL segment is reopened in place.
+	 */
+	fd = open(tmppath, O_WRONLY | O_CREAT | (dir_data->truncate ? O_TRUNC : 0) | PG_BINARY,
+			  pg_file_create_mode);
 	if (fd < 0)
 		return NULL;
 
@@ -113,7 +395,8 @@ dir_open_for_write(const char *pathname, const char *temp_suffix, size_t pad_to_
 #endif
 
 	/* Do pre-padding on non-compressed files */
-	if (pad_to_size && dir_data->compression == 0)
+	if (pad_to_size && dir_data->compression == 0 &&
+		dir_data->frame_compression.method == COMPRESSION_NONE)
 	{
 		PGAlignedXLogBlock zerobuf;
 		int			bytes;
@@ -179,6 +462,22 @@ dir_open_for_write(const char *pathname, const char *temp_suffix, size_t pad_to_
 	if (temp_suffix)
 		f->temp_suffix = pg_strdup(temp_suffix);
 
+	if (dir_data->frame_compression.method != COMPRESSION_NONE)
+	{
+		f->frame = frame_begin(&dir_data->frame_compression, dir_write_frame, f);
+		if (f->frame == NULL)
+		{
+			close(fd);
+			pg_free(f->pathname);
+			pg_free(f->fullpath);
+			if (f->temp_suffix)
+				pg_free(f->temp_suffix);
+			pg_free(f);
+			errno = EINVAL;
+			return NULL;
+		}
+	}
+
 	return f;
 }
 
@@ -190,6 +489,9 @@ dir_write(Walfile f, const void *buf, size_t count)
 
 	Assert(f != NULL);
 
+	if (df->frame)
+		r = frame_write(df->frame, buf, count) ? (ssize_t) count : -1;
+	else
 #ifdef HAVE_LIBZ
 	if (dir_data->compression > 0)
 		r = (ssize_t) gzwrite(df->gzfp, buf, count);
@@ -220,6 +522,22 @@ dir_close(Walfile f, WalCloseMethod method)
 
 	Assert(f != NULL);
 
+	if (df->frame)
+	{
+		bool		ended = frame_end(df->frame);
+
+		frame_free(df->frame);
+		df->frame = NULL;
+
+		r = close(df->fd);
+		if (!ended)
+		{
+			/* leave the file under its temporary name */
+			errno = EIO;
+			r = -1;
+		}
+	}
+	else
 #ifdef HAVE_LIBZ
 	if (dir_data->compression > 0)
 		r = gzclose(df->gzfp);
@@ -238,11 +556,11 @@ dir_close(Walfile f, WalCloseMethod method)
 			 */
 			snprintf(tmppath, sizeof(tmppath), "%s/%s%s%s",
 					 dir_data->basedir, df->pathname,
-					 dir_data->compression > 0 ? ".gz" : "",
+					 dir_suffix(),
 					 df->temp_suffix);
 			snprintf(tmppath2, sizeof(tmppath2), "%s/%s%s",
 					 dir_data->basedir, df->pathname,
-					 dir_data->compression > 0 ? ".gz" : "");
+					 dir_suffix());
 			r = durable_rename(tmppath, tmppath2);
 		}
 		else if (method == CLOSE_UNLINK)
@@ -250,7 +568,7 @@ dir_close(Walfile f, WalCloseMethod method)
 			/* Unlink the file once it's closed */
 			snprintf(tmppath, sizeof(tmppath), "%s/%s%s%s",
 					 dir_data->basedir, df->pathname,
-					 dir_data->compression > 0 ? ".gz" : "",
+					 dir_suffix(),
 					 df->temp_suffix ? df->temp_suffix : "");
 			r = unlink(tmppath);
 		}
@@ -287,6 +605,10 @@ dir_sync(Walfile f)
 	if (!dir_data->sync)
 		return 0;
 
+	if (((DirectoryMethodFile *) f)->frame &&
+		!frame_flush(((DirectoryMethodFile *) f)->frame))
+		return -1;
+
 #ifdef HAVE_LIBZ
 	if (dir_data->compression > 0)
 	{
@@ -346,7 +668,8 @@ dir_finish(void)
 
 
 WalWriteMethod *
-CreateWalDirectoryMethod(const char *basedir, int compression, bool sync)
+CreateWalDirectoryMethod(const char *basedir, const WalCompression *compression, bool sync,
+						 bool truncate)
 {
 	WalWriteMethod *method;
 
@@ -362,9 +685,13 @@ CreateWalDirectoryMethod(const char *basedir, int compression, bool sync)
 	method->getlasterror = dir_getlasterror;
 
 	dir_data = pg_malloc0(sizeof(DirectoryMethodData));
-	dir_data->compression = compression;
+	if (compression->method == COMPRESSION_GZIP)
+		dir_data->compression = compression->level > 0 ? compression->level : 6;
+	else if (compression->method != COMPRESSION_NONE)
+		dir_data->frame_compression = *compression;
 	dir_data->basedir = pg_strdup(basedir);
 	dir_data->sync = sync;
+	dir_data->truncate = truncate;
 
 	return method;
 }
@@ -389,13 +716,15 @@ typedef struct TarMethodFile
 	char		header[512];
 	char	   *pathname;
 	size_t		pad_to_size;
+	FrameCompressor *frame;		/* lz4 or zstd member */
 } TarMethodFile;
 
 typedef struct TarMethodData
 {
 	char	   *tarfilename;
 	int			fd;
-	int			compression;
+	int			compression;	/* gzip level of the whole tarfile */
+	WalCompression frame_compression;	/* lz4 or zstd, per member */
 	bool		sync;
 	TarMethodFile *currentfile;
 	char		lasterror[1024];
@@ -476,6 +805,24 @@ tar_write_compressed_data(void *buf, size_t count, bool flush)
 }
 #endif
 
+/* A compressed member is written to the uncompressed tarfile as it comes */
+static bool
+tar_write_frame(void *arg, const void *data, size_t len)
+{
+	errno = 0;
+	if (write(tar_data->fd, data, len) != len)
+	{
+		/* if write didn't set errno, assume problem is no disk space */
+		if (errno == 0)
+			errno = ENOSPC;
+		return false;
+	}
+
+	((TarMethodFile *) arg)->currpos += len;
+
+	return true;
+}
+
 static ssize_t
 tar_write(Walfile f, const void *buf, size_t count)
 {
@@ -484,6 +831,17 @@ tar_write(Walfile f, const void *buf, size_t count)
 	Assert(f != NULL);
 	tar_clear_error();
 
+	if (((TarMethodFile *) f)->frame)
+	{
+		if (!frame_write(((TarMethodFile *) f)->frame, buf, count))
+		{
+			if (errno == 0)
+				tar_set_error("could not compress data");
+			return -1;
+		}
+		return count;
+	}
+
 	/* Tarfile will always be positioned at the end */
 	if (!tar_data->compression)
 	{
@@ -583,8 +941,9 @@ tar_open_for_write(const char *pathname, const char *temp_suffix, size_t pad_to_
 
 	tar_data->currentfile = pg_malloc0(sizeof(TarMethodFile));
 
-	snprintf(tmppath, sizeof(tmppath), "%s%s",
-			 pathname, temp_suffix ? temp_suffix : "");
+	snprintf(tmppath, sizeof(tmppath), "%s%s%s",
+			 pathname, frame_suffix(tar_data->frame_compression.method),
+			 temp_suffix ? temp_suffix : "");
 
 	/* Create a header with size set to 0 - we will fill out the size on close */
 	if (tarCreateHeader(tar_data->currentfile->header, tmppath, NULL, 0, S_IRUSR | S_IWUSR, 0, 0, time(NULL)) != TAR_OK)
@@ -651,7 +1010,19 @@ tar_open_for_write(const char *pathname, const char *temp_suffix, size_t pad_to_
 	}
 #endif
 
-	tar_data->currentfile->pathname = pg_strdup(pathname);
+	tar_data->currentfile->pathname = psprintf("%s%s", pathname,
+											   frame_suffix(tar_data->frame_compression.method));
+
+	if (tar_data->frame_compression.method != COMPRESSION_NONE)
+	{
+		tar_data->currentfile->frame = frame_begin(&tar_data->frame_compression,
+												   tar_write_frame, tar_data->currentfile);
+		if (tar_data->currentfile->frame == NULL)
+		{
+			tar_set_error("could not initialize compression library");
+			return NULL;
+		}
+	}
 
 	/*
 	 * Uncompressed files are padded on creation, but for compression we can't
@@ -660,7 +1031,7 @@ tar_open_for_write(const char *pathname, const char *temp_suffix, size_t pad_to_
 	if (pad_to_size)
 	{
 		tar_data->currentfile->pad_to_size = pad_to_size;
-		if (!tar_data->compression)
+		if (!tar_data->compression && tar_data->currentfile->frame == NULL)
 		{
 			/* Uncompressed, so pad now */
 			tar_write_padding_data(tar_data->currentfile, pad_to_size);
@@ -703,13 +1074,20 @@ tar_sync(Walfile f)
 	if (!tar_data->sync)
 		return 0;
 
+	if (((TarMethodFile *) f)->frame && !frame_flush(((TarMethodFile *) f)->frame))
+		return -1;
+
+#ifdef HAVE_LIBZ
+
 	/*
-	 * Always sync the whole tarfile, because that's all we can do. This makes
-	 * no sense on compressed files, so just ignore those.
+	 * A gzip tarfile ends its current gzip member, so everything written so
+	 * far can be decompressed; the next write starts another member.
 	 */
-	if (tar_data->compression)
-		return 0;
+	if (tar_data->compression && !tar_write_compressed_data(NULL, 0, true))
+		return -1;
+#endif
 
+	/* Always sync the whole tarfile, because that's all we can do */
 	return fsync(tar_data->fd);
 }
 
@@ -723,6 +1101,12 @@ tar_close(Walfile f, WalCloseMethod method)
 	Assert(f != NULL);
 	tar_clear_error();
 
+	if (tf->frame && method == CLOSE_UNLINK)
+	{
+		frame_free(tf->frame);
+		tf->frame = NULL;
+	}
+
 	if (method == CLOSE_UNLINK)
 	{
 		if (tar_data->compression)
@@ -753,7 +1137,7 @@ tar_close(Walfile f, WalCloseMethod method)
 	 */
 	if (tf->pad_to_size)
 	{
-		if (tar_data->compression)
+		if (tar_data->compression || tf->frame)
 		{
 			/*
 			 * A compressed tarfile is padded on close since we cannot know
@@ -777,6 +1161,21 @@ tar_close(Walfile f, WalCloseMethod method)
 		}
 	}
 
+	/* End the member's frame, the tar padding isn't part of it */
+	if (tf->frame)
+	{
+		bool		ended = frame_end(tf->frame);
+
+		frame_free(tf->frame);
+		tf->frame = NULL;
+
+		if (!ended)
+		{
+			tar_set_error("could not compress data");
+			return -1;
+		}
+	}
+
 	/*
 	 * Get the size of the file, and pad the current data up to the nearest
 	 * 512 byte boundary.
@@ -979,10 +1378,10 @@ tar_finish(void)
 }
 
 WalWriteMethod *
-CreateWalTarMethod(const char *tarbase, int compression, bool sync)
+CreateWalTarMethod(const char *tarbase, const WalCompression *compression, bool sync)
 {
 	WalWriteMethod *method;
-	const char *suffix = (compression != 0) ? ".tar.gz" : ".tar";
+	const char *suffix = (compression->method == COMPRESSION_GZIP) ? ".tar.gz" : ".tar";
 
 	method = pg_malloc0(sizeof(WalWriteMethod));
 	method->open_for_write = tar_open_for_write;
@@ -999,10 +1398,13 @@ CreateWalTarMethod(const char *tarbase, int compression, bool sync)
 	tar_data->tarfilename = pg_malloc0(strlen(tarbase) + strlen(suffix) + 1);
 	sprintf(tar_data->tarfilename, "%s%s", tarbase, suffix);
 	tar_data->fd = -1;
-	tar_data->compression = compression;
+	if (compression->method == COMPRESSION_GZIP)
+		tar_data->compression = compression->level > 0 ? compression->level : 6;
+	else if (compression->method != COMPRESSION_NONE)
+		tar_data->frame_compression = *compression;
 	tar_data->sync = sync;
 #ifdef HAVE_LIBZ
-	if (compression)
+	if (tar_data->compression)
 		tar_data->zlibOut = (char *) pg_malloc(ZLIB_OUT_SIZE + 1);
 #endif
 
@@ -12,6 +12,27 @@
 
 typedef void *Walfile;
 
+typedef enum
+{
+	COMPRESSION_NONE,
+	COMPRESSION_GZIP,
+	COMPRESSION_LZ4,
+	COMPRESSION_ZSTD
+} WalCompressionMethod;
+
+/*
+ * gzip compresses the whole output, a directory file or the entire tarfile;
+ * lz4 and zstd compress each file as a frame of its own, in a tarfile as a
+ * compressed member. level 0 is the library's default.
+ */
+typedef struct WalCompression
+{
+	WalCompressionMethod method;
+	int			level;
+	int			long_window;	/* zstd: log2 of the long distance matching
+								 * window, 0 for off */
+} WalCompression;
+
 typedef enum
 {
 	CLOSE_NORMAL,
@@ -86,8 +107,13 @@ struct WalWriteMethod
  *						   not all those required for pg_receivewal)
  */
 WalWriteMethod *CreateWalDirectoryMethod(const char *basedir,
-										 int compression, bool sync);
-WalWriteMethod *CreateWalTarMethod(const char *tarbase, int compression, bool sync);
+										 const WalCompression *compression, bool sync,
+										 bool truncate);
+WalWriteMethod *CreateWalTarMethod(const char *tarbase,
+								   const WalCompression *compression, bool sync);
+
+/* Whether the method was built in */
+bool		WalCompressionSupported(WalCompressionMethod method);
 
 /* Cleanup routines for previously-created methods */
 void		FreeWalDirectoryMethod(void);
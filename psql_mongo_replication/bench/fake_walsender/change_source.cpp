@@ -0,0 +1,212 @@
+#include "change_source.hpp"
+#include "psql_mongo_replication/archive_replay.hpp"
+#include <algorithm>
+
+namespace psql_mongo_replication
+{
+namespace bench
+{
+
+namespace
+{
+    // roughly what a WAL record adds to its payload
+    const unsigned long long record_overhead = 24;
+
+    const char alphabet[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+}
+
+synthetic_source::synthetic_source(const options_t& options):
+      _options(options)
+    , _random(options.seed)
+    , _lsn(options.start_lsn)
+{
+    std::vector<unsigned> weights;
+    unsigned widest = 0;
+
+    for(const table_mix& mix: _options.tables)
+    {
+        table_state table;
+
+        table.mix = mix;
+        table.relation = "public." + mix.name;
+
+        _tables.push_back(table);
+        weights.push_back(mix.weight);
+        widest = std::max(widest, mix.value_bytes);
+    }
+
+    _pick_table = std::discrete_distribution<size_t>(weights.begin(), weights.end());
+    _pick_action = std::discrete_distribution<int>({double(_options.insert_weight), double(_options.update_weight), double(_options.delete_weight)});
+
+    _values.resize(widest + 4096);
+
+    for(char& c: _values)
+        c = alphabet[_random() % (sizeof(alphabet) - 1)];
+
+    _subscribers = ",\"subsribers\":[";
+
+    for(size_t i = 0; i < _options.subscribers.size(); ++i)
+        _subscribers += (i? ",": "") + std::to_string(_options.subscribers[i]);
+
+    _subscribers += "]";
+}
+
+void synthetic_source::append_row(std::string& out, table_state& table, unsigned long long id)
+{
+    out += "{\"id\":";
+    out += std::to_string(id);
+
+    for(unsigned column = 1; column <= table.mix.columns; ++column)
+    {
+        const size_t offset = _random() % (_values.size() - table.mix.value_bytes + 1);
+
+        out += ",\"c";
+        out += std::to_string(column);
+        out += "\":\"";
+        out.append(_values, offset, table.mix.value_bytes);
+        out += '"';
+    }
+
+    out += '}';
+}
+
+bool synthetic_source::next(stream_message& message)
+{
+    std::string& out = message.data;
+    const bool transactions = _options.transaction_size > 0;
+
+    out.clear();
+
+    if(transactions && !_open)
+    {
+        if(_options.changes && _changes >= _options.changes)
+            return false;
+
+        ++_xid;
+        _open = true;
+        _in_transaction = _options.changes? unsigned(std::min<unsigned long long>(_options.transaction_size, _options.changes - _changes)): _options.transaction_size;
+
+        out = "{\"a\":3,\"x\":" + std::to_string(_xid) + "}";
+    }
+    else if(transactions && _in_transaction == 0)
+    {
+        _open = false;
+
+        out = "{\"a\":4,\"x\":" + std::to_string(_xid) + "}";
+    }
+    else
+    {
+        if(!transactions && _options.changes && _changes >= _options.changes)
+            return false;
+
+        table_state& table = _tables[_pick_table(_random)];
+        int action = _pick_action(_random);
+
+        // nothing to update or delete yet
+        if(table.first_live == table.next_id)
+            action = 0;
+
+        out += "{\"a\":";
+        out += std::to_string(action);
+        out += ",\"x\":";
+        out += std::to_string(_xid);
+        out += ",\"r\":\"";
+        out += table.relation;
+        out += '"';
+
+        if(action == 0)
+        {
+            out += ",\"d\":";
+            append_row(out, table, table.next_id++);
+        }
+        else if(action == 1)
+        {
+            const unsigned long long id = table.first_live + _random() % (table.next_id - table.first_live);
+
+            out += ",\"d\":";
+            append_row(out, table, id);
+            out += ",\"c\":{\"id\":" + std::to_string(id) + "}";
+        }
+        else
+            out += ",\"c\":{\"id\":" + std::to_string(table.first_live++) + "}";
+
+        out += _subscribers;
+        out += '}';
+
+        if(_in_transaction)
+            --_in_transaction;
+
+        ++_changes;
+    }
+
+    message.lsn = _lsn;
+    message.wal_end = _lsn;
+
+    _lsn += out.size() + record_overhead;
+
+    return true;
+}
+
+unsigned long long synthetic_source::start_lsn() const
+{
+    return _options.start_lsn;
+}
+
+recorded_source::recorded_source(unsigned laps):
+    _laps(std::max(laps, 1u))
+{
+}
+
+bool recorded_source::load(const std::string& path)
+{
+    archive_replay archive(path);
+
+    const bool ok = archive.run(
+        [this](const char* message, unsigned size, unsigned long long lsn, unsigned long long wal_end, long long)
+        {
+            stream_message recorded;
+
+            recorded.data.assign(message, size);
+            recorded.lsn = lsn;
+            recorded.wal_end = wal_end;
+
+            _messages.push_back(std::move(recorded));
+
+            return true;
+        },
+        [](unsigned long long) {});
+
+    if(!_messages.empty())
+        _span = _messages.back().lsn - _messages.front().lsn + 1;
+
+    return ok;
+}
+
+bool recorded_source::next(stream_message& message)
+{
+    if(_position == _messages.size())
+    {
+        if(_lap + 1 >= _laps || _messages.empty())
+            return false;
+
+        ++_lap;
+        _position = 0;
+    }
+
+    const stream_message& recorded = _messages[_position++];
+    const unsigned long long shift = _lap * _span;
+
+    message.data.assign(recorded.data);
+    message.lsn = recorded.lsn + shift;
+    message.wal_end = std::max(recorded.wal_end, recorded.lsn) + shift;
+
+    return true;
+}
+
+unsigned long long recorded_source::start_lsn() const
+{
+    return _messages.empty()? 0: _messages.front().lsn;
+}
+
+}
+}
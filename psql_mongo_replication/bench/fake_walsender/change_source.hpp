@@ -0,0 +1,114 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <random>
+#include <cstdint>
+
+namespace psql_mongo_replication
+{
+namespace bench
+{
+    // One message of the stream and the WAL positions sent with it.
+    struct stream_message
+    {
+        std::string data;
+        unsigned long long lsn = 0;
+        unsigned long long wal_end = 0;
+    };
+
+    // What the fake walsender streams. Called from one streaming connection at a time.
+    class change_source
+    {
+        public:
+        virtual ~change_source() = default;
+
+        // false once the stream is exhausted
+        virtual bool next(stream_message& message) = 0;
+
+        // the position IDENTIFY_SYSTEM and a created slot report
+        virtual unsigned long long start_lsn() const = 0;
+    };
+
+    // A table of the synthetic mix: rows keyed by "id" with `columns` text columns of
+    // `value_bytes` each, picked with probability weight / sum of the weights.
+    struct table_mix
+    {
+        std::string name;
+        unsigned weight = 1;
+        unsigned columns = 8;
+        unsigned value_bytes = 16;
+    };
+
+    // decoder_json transactions over a table mix: BEGIN, transaction_size changes, COMMIT.
+    // Inserts add keys, updates hit a live key and deletes the oldest one, so the stream
+    // applies cleanly to an empty database. The same seed gives the same stream.
+    class synthetic_source: public change_source
+    {
+        public:
+        struct options_t
+        {
+            std::vector<table_mix> tables;
+            unsigned insert_weight = 60;
+            unsigned update_weight = 30;
+            unsigned delete_weight = 10;
+            unsigned transaction_size = 10;
+            unsigned long long changes = 1000000;     // 0 never ends
+            std::vector<int> subscribers = {0};
+            unsigned long long start_lsn = 0x1000000;
+            unsigned long long seed = 1;
+        };
+
+        private:
+        struct table_state
+        {
+            table_mix mix;
+            std::string relation;                     // "public.<name>"
+            unsigned long long first_live = 1;
+            unsigned long long next_id = 1;
+        };
+
+        options_t _options;
+        std::vector<table_state> _tables;
+        std::discrete_distribution<size_t> _pick_table;
+        std::discrete_distribution<int> _pick_action;
+        std::mt19937_64 _random;
+        std::string _values;                          // random text the column values are cut from
+        std::string _subscribers;                     // ,"subsribers":[...]
+        unsigned long long _lsn;
+        unsigned long long _changes = 0;
+        unsigned _in_transaction = 0;                 // changes left in the open transaction
+        unsigned _xid = 1000;
+        bool _open = false;
+
+        void append_row(std::string& out, table_state& table, unsigned long long id);
+
+        public:
+        explicit synthetic_source(const options_t& options);
+
+        bool next(stream_message& message) override;
+        unsigned long long start_lsn() const override;
+    };
+
+    // The messages of an archive written with the archive_path option, read into memory up
+    // front so the disk stays out of the measurement. Each of `laps` passes shifts the
+    // positions past the previous one, the client never sees an LSN twice.
+    class recorded_source: public change_source
+    {
+        private:
+        std::vector<stream_message> _messages;
+        size_t _position = 0;
+        unsigned _laps;
+        unsigned _lap = 0;
+        unsigned long long _span = 0;
+
+        public:
+        recorded_source(unsigned laps);
+
+        bool load(const std::string& path);
+
+        bool next(stream_message& message) override;
+        unsigned long long start_lsn() const override;
+    };
+}
+}
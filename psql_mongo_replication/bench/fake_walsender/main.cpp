@@ -0,0 +1,229 @@
+#include "walsender.hpp"
+#include "change_source.hpp"
+#include "psql_mongo_replication/options.hpp"
+#include <memory>
+#include <sstream>
+#include <iostream>
+#include <csignal>
+#include <getopt.h>
+
+using namespace psql_mongo_replication;
+
+namespace
+{
+    bench::walsender* server = nullptr;
+
+    void on_signal(int)
+    {
+        if(server)
+            server->stop();
+    }
+
+    void usage()
+    {
+        std::cout <<
+            "fake_walsender streams decoder_json changes to a replicator as a walsender would.\n"
+            "Point the replicator at it with PGHOST/PGPORT.\n\n"
+            "  --host <address>          listen address (127.0.0.1)\n"
+            "  --port <n>                port (5433)\n"
+            "  --socket-dir <dir>        also listen on <dir>/.s.PGSQL.<port>\n"
+            "  --server-version <v>      reported server_version (12.0)\n"
+            "  --rate <n>                messages per second, 0 as fast as the client reads (0)\n"
+            "  --keepalive-ms <n>        keepalive interval (1000)\n"
+            "  --once                    exit when the client applied the whole stream\n\n"
+            "recorded stream:\n"
+            "  --replay <archive>        an archive written with the archive_path option\n"
+            "  --loop <n>                stream it n times (1)\n\n"
+            "synthetic stream:\n"
+            "  --changes <n>             changes in all, 0 never ends (1000000)\n"
+            "  --transaction-size <n>    changes between BEGIN and COMMIT, 0 sends none (10)\n"
+            "  --table <name[:weight[:columns[:value_bytes]]]>\n"
+            "                            a table of the mix, repeatable (events:1:8:16)\n"
+            "  --mix <insert:update:delete>  action weights (60:30:10)\n"
+            "  --subscribers <id,...>    subscriber ids of every change (0)\n"
+            "  --seed <n>                the same seed streams the same changes (1)\n";
+    }
+
+    // "a:b:c" -> numbers, false when one isn't
+    bool parse_numbers(const std::string& text, char separator, std::vector<unsigned long long>& numbers)
+    {
+        std::istringstream in(text);
+        std::string field;
+        unsigned long long number = 0;
+
+        while(std::getline(in, field, separator))
+        {
+            if(!options::parse_unsigned(field, number))
+                return false;
+
+            numbers.push_back(number);
+        }
+
+        return !numbers.empty();
+    }
+
+    bool parse_table(const std::string& text, bench::table_mix& table)
+    {
+        const size_t colon = text.find(':');
+        std::vector<unsigned long long> numbers;
+
+        table.name = text.substr(0, colon);
+
+        if(table.name.empty())
+            return false;
+
+        if(colon == std::string::npos)
+            return true;
+
+        if(!parse_numbers(text.substr(colon + 1), ':', numbers) || numbers.size() > 3)
+            return false;
+
+        table.weight = numbers[0];
+
+        if(numbers.size() > 1)
+            table.columns = numbers[1];
+
+        if(numbers.size() > 2)
+            table.value_bytes = numbers[2];
+
+        return true;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    enum
+    {
+        OPTION_HOST = 1000,
+        OPTION_PORT,
+        OPTION_SOCKET_DIR,
+        OPTION_SERVER_VERSION,
+        OPTION_RATE,
+        OPTION_KEEPALIVE_MS,
+        OPTION_ONCE,
+        OPTION_REPLAY,
+        OPTION_LOOP,
+        OPTION_CHANGES,
+        OPTION_TRANSACTION_SIZE,
+        OPTION_TABLE,
+        OPTION_MIX,
+        OPTION_SUBSCRIBERS,
+        OPTION_SEED,
+        OPTION_HELP,
+    };
+
+    static const option long_options[] =
+    {
+        {"host", required_argument, nullptr, OPTION_HOST},
+        {"port", required_argument, nullptr, OPTION_PORT},
+        {"socket-dir", required_argument, nullptr, OPTION_SOCKET_DIR},
+        {"server-version", required_argument, nullptr, OPTION_SERVER_VERSION},
+        {"rate", required_argument, nullptr, OPTION_RATE},
+        {"keepalive-ms", required_argument, nullptr, OPTION_KEEPALIVE_MS},
+        {"once", no_argument, nullptr, OPTION_ONCE},
+        {"replay", required_argument, nullptr, OPTION_REPLAY},
+        {"loop", required_argument, nullptr, OPTION_LOOP},
+        {"changes", required_argument, nullptr, OPTION_CHANGES},
+        {"transaction-size", required_argument, nullptr, OPTION_TRANSACTION_SIZE},
+        {"table", required_argument, nullptr, OPTION_TABLE},
+        {"mix", required_argument, nullptr, OPTION_MIX},
+        {"subscribers", required_argument, nullptr, OPTION_SUBSCRIBERS},
+        {"seed", required_argument, nullptr, OPTION_SEED},
+        {"help", no_argument, nullptr, OPTION_HELP},
+        {nullptr, 0, nullptr, 0}
+    };
+
+    bench::walsender::options_t server_options;
+    bench::synthetic_source::options_t synthetic;
+    std::string replay;
+    unsigned long long loops = 1;
+
+    for(int option; (option = getopt_long(argc, argv, "", long_options, nullptr)) != -1; )
+    {
+        const std::string value = optarg? optarg: "";
+        std::vector<unsigned long long> numbers;
+        unsigned long long number = 0;
+        bench::table_mix table;
+        bool valid = true;
+
+        switch(option)
+        {
+            case OPTION_HOST: server_options.host = value; break;
+            case OPTION_PORT: valid = options::parse_unsigned(value, number) && number > 0 && number < 65536; server_options.port = number; break;
+            case OPTION_SOCKET_DIR: server_options.socket_directory = value; break;
+            case OPTION_SERVER_VERSION: server_options.server_version = value; break;
+            case OPTION_RATE: valid = options::parse_unsigned(value, number); server_options.rate = number; break;
+            case OPTION_KEEPALIVE_MS: valid = options::parse_unsigned(value, number) && number > 0; server_options.keepalive_ms = number; break;
+            case OPTION_ONCE: server_options.once = true; break;
+            case OPTION_REPLAY: replay = value; break;
+            case OPTION_LOOP: valid = options::parse_unsigned(value, loops) && loops > 0; break;
+            case OPTION_CHANGES: valid = options::parse_unsigned(value, synthetic.changes); break;
+            case OPTION_TRANSACTION_SIZE: valid = options::parse_unsigned(value, number); synthetic.transaction_size = number; break;
+            case OPTION_TABLE: valid = parse_table(value, table); synthetic.tables.push_back(table); break;
+            case OPTION_SEED: valid = options::parse_unsigned(value, synthetic.seed); break;
+            case OPTION_MIX:
+                valid = parse_numbers(value, ':', numbers) && numbers.size() == 3 && numbers[0] + numbers[1] + numbers[2] > 0;
+
+                if(valid)
+                {
+                    synthetic.insert_weight = numbers[0];
+                    synthetic.update_weight = numbers[1];
+                    synthetic.delete_weight = numbers[2];
+                }
+                break;
+            case OPTION_SUBSCRIBERS:
+                valid = parse_numbers(value, ',', numbers);
+                synthetic.subscribers.assign(numbers.begin(), numbers.end());
+                break;
+            case OPTION_HELP: usage(); return 0;
+            default: usage(); return 1;
+        }
+
+        if(!valid)
+        {
+            std::cout << "fake_walsender: invalid value \"" << value << "\" of --" << long_options[option - OPTION_HOST].name << std::endl;
+            return 1;
+        }
+    }
+
+    if(synthetic.tables.empty())
+        synthetic.tables.push_back({"events", 1, 8, 16});
+
+    unsigned long long weights = 0;
+
+    for(const bench::table_mix& table: synthetic.tables)
+        weights += table.weight;
+
+    if(weights == 0)
+    {
+        std::cout << "fake_walsender: every table has weight 0" << std::endl;
+        return 1;
+    }
+
+    std::unique_ptr<bench::change_source> source;
+
+    if(!replay.empty())
+    {
+        std::unique_ptr<bench::recorded_source> recorded(new bench::recorded_source(loops));
+
+        if(!recorded->load(replay))
+            return 1;
+
+        source = std::move(recorded);
+    }
+    else
+        source.reset(new bench::synthetic_source(synthetic));
+
+    bench::walsender walsender(server_options, *source);
+
+    server = &walsender;
+
+    std::signal(SIGINT, on_signal);
+    std::signal(SIGTERM, on_signal);
+
+    const bool ok = walsender.run();
+
+    server = nullptr;
+
+    return ok? 0: 1;
+}
@@ -0,0 +1,779 @@
+#include "walsender.hpp"
+#include <map>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <cctype>
+#include <unistd.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/un.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+namespace psql_mongo_replication
+{
+namespace bench
+{
+
+namespace
+{
+    const uint32_t protocol_3 = 196608;
+    const uint32_t ssl_request = 80877103;
+    const uint32_t gssenc_request = 80877104;
+
+    // TimestampTz counts from 2000-01-01
+    const long long postgres_epoch_us = 946684800LL * 1000000;
+
+    // queued output the stream stops filling at until the client reads
+    const size_t high_water = 1 << 20;
+
+    // while the client's last confirmation is pending it is asked this often
+    const std::chrono::milliseconds confirm_poll(20);
+
+    long long now_timestamp()
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count() - postgres_epoch_us;
+    }
+
+    void put_be(std::string& out, uint64_t value, size_t bytes)
+    {
+        for(size_t i = bytes; i-- > 0; )
+            out.push_back(char((value >> (8 * i)) & 0xff));
+    }
+
+    uint64_t get_be(const char* in, size_t bytes)
+    {
+        uint64_t value = 0;
+
+        for(size_t i = 0; i < bytes; ++i)
+            value = (value << 8) | uint8_t(in[i]);
+
+        return value;
+    }
+
+    std::string format_lsn(unsigned long long lsn)
+    {
+        char text[32];
+
+        snprintf(text, sizeof(text), "%X/%X", unsigned(lsn >> 32), unsigned(lsn));
+
+        return text;
+    }
+
+    // whitespace separated, double quotes dropped
+    std::vector<std::string> split(const std::string& text)
+    {
+        std::vector<std::string> words;
+        std::istringstream in(text);
+        std::string word;
+
+        while(in >> word)
+        {
+            word.erase(std::remove(word.begin(), word.end(), '"'), word.end());
+            words.push_back(word);
+        }
+
+        return words;
+    }
+
+    std::string upper(std::string word)
+    {
+        for(char& c: word)
+            c = std::toupper((unsigned char)c);
+
+        return word;
+    }
+}
+
+// Buffered, non-blocking frontend/backend protocol messages of one client.
+class walsender::connection
+{
+    private:
+    int _fd;
+    std::string _in;
+    size_t _in_pos = 0;
+    std::string _out;
+    size_t _out_pos = 0;
+    bool _closed = false;
+
+    void read_some()
+    {
+        char buffer[64 * 1024];
+        const ssize_t n = ::recv(_fd, buffer, sizeof(buffer), 0);
+
+        if(n > 0)
+            _in.append(buffer, n);
+        else if(n == 0 || (errno != EAGAIN && errno != EINTR))
+            _closed = true;
+    }
+
+    void write_some()
+    {
+        const ssize_t n = ::send(_fd, _out.data() + _out_pos, _out.size() - _out_pos, MSG_NOSIGNAL);
+
+        if(n < 0)
+        {
+            if(errno != EAGAIN && errno != EINTR)
+                _closed = true;
+            return;
+        }
+
+        _out_pos += n;
+
+        if(_out_pos == _out.size())
+        {
+            _out.clear();
+            _out_pos = 0;
+        }
+        else if(_out_pos > high_water)
+        {
+            _out.erase(0, _out_pos);
+            _out_pos = 0;
+        }
+    }
+
+    bool take(size_t header, char* type, std::string& body)
+    {
+        if(_in.size() - _in_pos < header + 4)
+            return false;
+
+        const size_t length = get_be(&_in[_in_pos + header], 4);
+
+        if(length < 4)
+        {
+            _closed = true;
+            return false;
+        }
+
+        if(_in.size() - _in_pos < header + length)
+            return false;
+
+        if(type)
+            *type = _in[_in_pos];
+
+        body.assign(_in, _in_pos + header + 4, length - 4);
+        _in_pos += header + length;
+
+        if(_in_pos == _in.size())
+        {
+            _in.clear();
+            _in_pos = 0;
+        }
+
+        return true;
+    }
+
+    public:
+    std::string database;
+
+    explicit connection(int fd):
+        _fd(fd)
+    {
+    }
+
+    ~connection()
+    {
+        ::close(_fd);
+    }
+
+    bool closed() const
+    {
+        return _closed;
+    }
+
+    size_t pending_output() const
+    {
+        return _out.size() - _out_pos;
+    }
+
+    // Waits up to timeout_ms for the socket, sends what is queued and reads what arrived.
+    void pump(int timeout_ms)
+    {
+        pollfd socket = {_fd, POLLIN, 0};
+
+        if(pending_output())
+            socket.events |= POLLOUT;
+
+        const int ready = ::poll(&socket, 1, timeout_ms);
+
+        if(ready < 0 && errno != EINTR)
+            _closed = true;
+
+        if(ready <= 0)
+            return;
+
+        if(socket.revents & (POLLERR | POLLNVAL))
+        {
+            _closed = true;
+            return;
+        }
+
+        if(socket.revents & POLLOUT)
+            write_some();
+
+        if(socket.revents & (POLLIN | POLLHUP))
+            read_some();
+    }
+
+    bool flush()
+    {
+        while(pending_output() && !_closed)
+            pump(1000);
+
+        return !_closed;
+    }
+
+    // A complete message received so far.
+    bool message(char& type, std::string& body)
+    {
+        return take(1, &type, body);
+    }
+
+    // Waits for the next message; false when the client left or stop was set.
+    bool wait_message(char& type, std::string& body, const std::atomic<bool>& stop)
+    {
+        while(!message(type, body))
+        {
+            if(_closed || stop)
+                return false;
+
+            pump(200);
+        }
+
+        return true;
+    }
+
+    // The startup packet has no type byte.
+    bool wait_startup(std::string& body, const std::atomic<bool>& stop)
+    {
+        while(!take(0, nullptr, body))
+        {
+            if(_closed || stop)
+                return false;
+
+            pump(200);
+        }
+
+        return true;
+    }
+
+    void put_raw(const char* data, size_t size)
+    {
+        _out.append(data, size);
+    }
+
+    void put(char type, const std::string& body)
+    {
+        _out.push_back(type);
+        put_be(_out, body.size() + 4, 4);
+        _out += body;
+    }
+
+    // CopyData of a 'w' or 'k' header and its payload.
+    void put_copy_data(const std::string& header, const std::string& data)
+    {
+        _out.push_back('d');
+        put_be(_out, 4 + header.size() + data.size(), 4);
+        _out += header;
+        _out += data;
+    }
+
+    void parameter(const std::string& name, const std::string& value)
+    {
+        put('S', name + '\0' + value + '\0');
+    }
+
+    // One row of text columns, nullptr for NULL.
+    void result(const std::vector<std::string>& columns, const std::vector<const char*>& row, const std::string& tag)
+    {
+        std::string body;
+
+        put_be(body, columns.size(), 2);
+
+        for(const std::string& column: columns)
+        {
+            body += column;
+            body.push_back('\0');
+            put_be(body, 0, 4);         // table
+            put_be(body, 0, 2);         // attribute
+            put_be(body, 25, 4);        // text
+            put_be(body, uint16_t(-1), 2);
+            put_be(body, uint32_t(-1), 4);
+            put_be(body, 0, 2);         // text format
+        }
+
+        put('T', body);
+
+        body.clear();
+        put_be(body, row.size(), 2);
+
+        for(const char* value: row)
+        {
+            if(value == nullptr)
+            {
+                put_be(body, uint32_t(-1), 4);
+                continue;
+            }
+
+            put_be(body, strlen(value), 4);
+            body += value;
+        }
+
+        put('D', body);
+        complete(tag);
+    }
+
+    void complete(const std::string& tag)
+    {
+        put('C', tag + '\0');
+    }
+
+    void error(const char* sqlstate, const std::string& message)
+    {
+        put('E', std::string("SERROR\0VERROR\0C", 15) + sqlstate + '\0' + 'M' + message + '\0' + '\0');
+    }
+
+    void ready()
+    {
+        put('Z', "I");
+    }
+};
+
+walsender::walsender(const options_t& options, change_source& source):
+      _options(options)
+    , _source(source)
+{
+}
+
+void walsender::stop()
+{
+    _stop = true;
+}
+
+bool walsender::run()
+{
+    std::vector<int> listeners;
+    std::string socket_path;
+
+    addrinfo hints = {};
+    addrinfo* addresses = nullptr;
+
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+
+    const int resolved = getaddrinfo(_options.host.c_str(), std::to_string(_options.port).c_str(), &hints, &addresses);
+
+    if(resolved != 0)
+        std::cout << "fake_walsender: can't resolve " << _options.host << ": " << gai_strerror(resolved) << std::endl;
+
+    for(addrinfo* address = resolved == 0? addresses: nullptr; address; address = address->ai_next)
+    {
+        const int fd = ::socket(address->ai_family, address->ai_socktype | SOCK_CLOEXEC, address->ai_protocol);
+        const int on = 1;
+
+        if(fd == -1)
+            continue;
+
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+        if(::bind(fd, address->ai_addr, address->ai_addrlen) != 0 || ::listen(fd, 16) != 0)
+        {
+            std::cout << "fake_walsender: can't listen on " << _options.host << ":" << _options.port << ": " << strerror(errno) << std::endl;
+            ::close(fd);
+            continue;
+        }
+
+        listeners.push_back(fd);
+    }
+
+    if(addresses)
+        freeaddrinfo(addresses);
+
+    if(!_options.socket_directory.empty())
+    {
+        sockaddr_un address = {};
+
+        socket_path = _options.socket_directory + "/.s.PGSQL." + std::to_string(_options.port);
+
+        address.sun_family = AF_UNIX;
+        strncpy(address.sun_path, socket_path.c_str(), sizeof(address.sun_path) - 1);
+
+        ::unlink(socket_path.c_str());
+
+        const int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+        if(fd != -1 && ::bind(fd, (const sockaddr*)&address, sizeof(address)) == 0 && ::listen(fd, 16) == 0)
+            listeners.push_back(fd);
+        else
+        {
+            std::cout << "fake_walsender: can't listen on " << socket_path << ": " << strerror(errno) << std::endl;
+
+            if(fd != -1)
+                ::close(fd);
+
+            socket_path.clear();
+        }
+    }
+
+    if(listeners.empty())
+        return false;
+
+    std::cout << "fake_walsender: listening on " << _options.host << ":" << _options.port
+              << (socket_path.empty()? "": " and " + socket_path) << std::endl;
+
+    std::vector<std::thread> clients;
+
+    while(!_stop)
+    {
+        std::vector<pollfd> sockets;
+
+        for(int fd: listeners)
+            sockets.push_back({fd, POLLIN, 0});
+
+        if(::poll(sockets.data(), sockets.size(), 200) <= 0)
+            continue;
+
+        for(const pollfd& socket: sockets)
+        {
+            if(!(socket.revents & POLLIN))
+                continue;
+
+            const int fd = ::accept4(socket.fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            const int on = 1;
+
+            if(fd == -1)
+                continue;
+
+            // keepalives and the end of a burst go out at once, fails quietly on unix sockets
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+            clients.emplace_back(&walsender::serve, this, fd);
+        }
+    }
+
+    for(std::thread& client: clients)
+        client.join();
+
+    for(int fd: listeners)
+        ::close(fd);
+
+    if(!socket_path.empty())
+        ::unlink(socket_path.c_str());
+
+    return true;
+}
+
+void walsender::serve(int fd)
+{
+    connection client(fd);
+    std::string body;
+    uint32_t code = 0;
+
+    // encryption is declined, the client goes on in the clear
+    while(client.wait_startup(body, _stop) && body.size() >= 4)
+    {
+        code = get_be(body.data(), 4);
+
+        if(code != ssl_request && code != gssenc_request)
+            break;
+
+        client.put_raw("N", 1);
+        client.flush();
+    }
+
+    if(code != protocol_3)
+    {
+        if(code != 0)
+        {
+            client.error("0A000", "unsupported frontend protocol");
+            client.flush();
+        }
+
+        return;
+    }
+
+    std::map<std::string, std::string> parameters;
+
+    for(size_t pos = 4; pos < body.size() && body[pos] != '\0'; )
+    {
+        const std::string name(body.c_str() + pos);
+
+        pos += name.size() + 1;
+
+        if(pos >= body.size())
+            break;
+
+        parameters[name] = body.c_str() + pos;
+        pos += parameters[name].size() + 1;
+    }
+
+    client.database = parameters.count("database")? parameters["database"]: parameters["user"];
+
+    std::string ok;
+
+    put_be(ok, 0, 4);
+    client.put('R', ok);
+    client.parameter("server_version", _options.server_version);
+    client.parameter("server_encoding", "UTF8");
+    client.parameter("client_encoding", "UTF8");
+    client.parameter("DateStyle", "ISO, MDY");
+    client.parameter("integer_datetimes", "on");
+    client.parameter("standard_conforming_strings", "on");
+    client.parameter("TimeZone", "UTC");
+    client.parameter("application_name", parameters["application_name"]);
+
+    std::string key;
+
+    put_be(key, ::getpid(), 4);
+    put_be(key, fd, 4);
+    client.put('K', key);
+    client.ready();
+
+    std::cout << "fake_walsender: " << parameters["user"] << "@" << client.database << " connected"
+              << (parameters.count("replication")? " for replication": "") << std::endl;
+
+    char type = 0;
+
+    while(client.flush() && client.wait_message(type, body, _stop))
+    {
+        if(type == 'X')
+            break;
+
+        if(type != 'Q')
+            continue;
+
+        // the query text ends with its terminator
+        if(!body.empty() && body.back() == '\0')
+            body.pop_back();
+
+        if(!query(client, body))
+            break;
+    }
+
+    client.flush();
+}
+
+bool walsender::query(connection& client, const std::string& text)
+{
+    std::string command = text;
+
+    while(!command.empty() && (std::isspace((unsigned char)command.back()) || command.back() == ';'))
+        command.pop_back();
+
+    const std::vector<std::string> words = split(command);
+    const std::string verb = words.empty()? std::string(): upper(words[0]);
+    const std::string position = format_lsn(_source.start_lsn());
+
+    if(words.empty())
+        client.put('I', "");
+    else if(verb == "IDENTIFY_SYSTEM")
+        client.result({"systemid", "timeline", "xlogpos", "dbname"},
+            {"7000000000000000001", "1", position.c_str(), client.database.c_str()}, "IDENTIFY_SYSTEM");
+    else if(verb == "SHOW" && words.size() > 1)
+    {
+        static const std::map<std::string, std::string> settings =
+        {
+            {"wal_segment_size", "16MB"},
+            {"data_directory_mode", "0700"},
+            {"integer_datetimes", "on"},
+        };
+
+        const std::string name = words[1];
+        const auto setting = settings.find(name);
+
+        if(name == "server_version")
+            client.result({name}, {_options.server_version.c_str()}, "SHOW");
+        else if(setting != settings.end())
+            client.result({name}, {setting->second.c_str()}, "SHOW");
+        else
+            client.error("42704", "unrecognized configuration parameter \"" + name + "\"");
+    }
+    // GetConnection() secures the search path first
+    else if(verb == "SELECT" && command.find("set_config") != std::string::npos)
+        client.result({"set_config"}, {""}, "SELECT 1");
+    else if(verb == "CREATE_REPLICATION_SLOT" && words.size() > 1)
+    {
+        const auto logical = std::find(words.begin(), words.end(), "LOGICAL");
+        const std::string plugin = logical != words.end() && logical + 1 != words.end()? *(logical + 1): "";
+
+        // no snapshot, an initial sync can't run against the fake
+        client.result({"slot_name", "consistent_point", "snapshot_name", "output_plugin"},
+            {words[1].c_str(), position.c_str(), nullptr, plugin.c_str()}, "CREATE_REPLICATION_SLOT");
+    }
+    else if(verb == "DROP_REPLICATION_SLOT")
+        client.complete("DROP_REPLICATION_SLOT");
+    else if(verb == "START_REPLICATION")
+    {
+        const auto logical = std::find(words.begin(), words.end(), "LOGICAL");
+        unsigned hi = 0, lo = 0;
+
+        if(logical != words.end() && logical + 1 != words.end())
+            sscanf((logical + 1)->c_str(), "%X/%X", &hi, &lo);
+
+        std::unique_lock<std::mutex> streaming(_streaming, std::try_to_lock);
+
+        if(!streaming.owns_lock())
+            client.error("55006", "the fake walsender streams to one client at a time");
+        else if(!stream(client, ((unsigned long long)hi << 32) | lo))
+            return false;
+    }
+    else
+        client.error("0A000", "fake_walsender does not support \"" + command + "\"");
+
+    client.ready();
+
+    return true;
+}
+
+bool walsender::stream(connection& client, unsigned long long start)
+{
+    using clock = std::chrono::steady_clock;
+
+    // CopyBothResponse: text format, no columns
+    client.put('W', std::string(3, '\0'));
+
+    std::cout << "fake_walsender: streaming, the client asked for " << format_lsn(start) << std::endl;
+
+    const clock::time_point started = clock::now();
+    const std::chrono::milliseconds keepalive(_options.keepalive_ms);
+
+    stream_message message;
+    std::string header;
+    std::string body;
+    char type = 0;
+
+    unsigned long long sent = 0;
+    unsigned long long bytes = 0;
+    unsigned long long last_lsn = 0;
+    unsigned long long wal_end = std::max(start, _source.start_lsn());
+    unsigned long long flushed = 0;
+    bool exhausted = false;
+    bool confirmed = false;
+    clock::time_point last_keepalive = started;
+
+    const auto seconds_since = [&started](clock::time_point now)
+    {
+        return std::chrono::duration<double>(now - started).count();
+    };
+
+    while(!_stop && !client.closed())
+    {
+        while(client.message(type, body))
+        {
+            // standby status update: write, flush and apply position, send time, reply request
+            if(type == 'd' && body.size() >= 1 + 8 * 4 + 1 && body[0] == 'r')
+                flushed = std::max<unsigned long long>(flushed, get_be(&body[9], 8));
+            else if(type == 'c')
+            {
+                client.put('c', "");
+                client.complete("START_STREAMING");
+
+                std::cout << "fake_walsender: the client ended the stream after " << sent << " message(s)" << std::endl;
+
+                return true;
+            }
+            else if(type == 'X')
+                return false;
+        }
+
+        clock::time_point now = clock::now();
+        const std::chrono::milliseconds interval = exhausted && !confirmed? confirm_poll: keepalive;
+        int wait_ms = std::max<int>(0, std::chrono::duration_cast<std::chrono::milliseconds>(last_keepalive + interval - now).count());
+        bool busy = false;
+
+        if(!exhausted)
+        {
+            // messages the rate allows by now
+            unsigned long long allowed = sent + 1024;
+
+            if(_options.rate > 0)
+            {
+                const double elapsed = seconds_since(now);
+
+                allowed = (unsigned long long)(elapsed * _options.rate) + 1;
+
+                if(allowed <= sent)
+                    wait_ms = std::min(wait_ms, std::max(1, int((sent / _options.rate - elapsed) * 1000)));
+            }
+
+            while(sent < allowed && client.pending_output() < high_water)
+            {
+                if(!_source.next(message))
+                {
+                    const double seconds = seconds_since(clock::now());
+
+                    exhausted = true;
+
+                    std::cout << "fake_walsender: sent " << sent << " message(s), " << bytes << " bytes in " << seconds << " s, "
+                              << sent / seconds << " messages/s, " << bytes / seconds / (1024 * 1024) << " MB/s" << std::endl;
+                    break;
+                }
+
+                header.clear();
+                header.push_back('w');
+                put_be(header, message.lsn, 8);
+                put_be(header, message.wal_end, 8);
+                put_be(header, now_timestamp(), 8);
+
+                client.put_copy_data(header, message.data);
+
+                ++sent;
+                bytes += message.data.size();
+                last_lsn = message.lsn;
+                wal_end = std::max(wal_end, message.wal_end);
+            }
+
+            busy = !exhausted && sent < allowed && client.pending_output() < high_water;
+        }
+
+        // the flush position the client confirms follows what it applied
+        if(exhausted && !confirmed && flushed >= last_lsn)
+        {
+            const double seconds = seconds_since(clock::now());
+
+            confirmed = true;
+
+            std::cout << "fake_walsender: applied up to " << format_lsn(last_lsn) << " after " << seconds << " s, "
+                      << sent / seconds << " messages/s end to end" << std::endl;
+
+            if(_options.once)
+            {
+                client.put('c', "");
+                client.complete("START_STREAMING");
+                _stop = true;
+
+                return true;
+            }
+        }
+
+        if(now - last_keepalive >= interval)
+        {
+            header.clear();
+            header.push_back('k');
+            put_be(header, wal_end, 8);
+            put_be(header, now_timestamp(), 8);
+            header.push_back(exhausted && !confirmed? 1: 0);
+
+            client.put_copy_data(header, std::string());
+
+            last_keepalive = now;
+        }
+
+        client.pump(busy? 0: wait_ms);
+    }
+
+    return false;
+}
+
+}
+}
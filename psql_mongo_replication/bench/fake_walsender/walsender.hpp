@@ -0,0 +1,53 @@
+#pragma once
+
+#include <string>
+#include <mutex>
+#include <atomic>
+#include "change_source.hpp"
+
+namespace psql_mongo_replication
+{
+namespace bench
+{
+    // A test-only server speaking as much of the frontend/backend protocol as
+    // GetConnection() and log_streaming() use: trust authentication, IDENTIFY_SYSTEM, SHOW,
+    // CREATE/DROP_REPLICATION_SLOT (without a snapshot) and START_REPLICATION, which
+    // streams the change source as 'w' frames with 'k' keepalives in between. Flush
+    // positions the client reports time the end-to-end apply.
+    class walsender
+    {
+        public:
+        struct options_t
+        {
+            std::string host = "127.0.0.1";
+            unsigned port = 5433;
+            std::string socket_directory;           // also listens on <dir>/.s.PGSQL.<port>
+            std::string server_version = "12.0";
+            double rate = 0;                        // messages per second, 0 as fast as the client reads
+            unsigned keepalive_ms = 1000;
+            bool once = false;                      // exits when the first stream was confirmed
+        };
+
+        private:
+        class connection;
+
+        options_t _options;
+        change_source& _source;
+        std::mutex _streaming;                      // one START_REPLICATION at a time
+        std::atomic<bool> _stop{false};
+
+        void serve(int fd);
+        bool query(connection& client, const std::string& text);
+        bool stream(connection& client, unsigned long long start);
+
+        public:
+        walsender(const options_t& options, change_source& source);
+
+        // Accepts clients until stop(); false when it could not listen.
+        bool run();
+
+        // async signal safe
+        void stop();
+    };
+}
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <iostream>
+#include <functional>
+
+namespace psql_mongo_replication
+{
+namespace bench
+{
+    // decoder_json messages as the slot sends them, one per line, with the positions the
+    // stream would report. Rows are the inserts, updates and deletes; BEGIN/COMMIT cost is
+    // spread over the rows of their transaction.
+    struct corpus
+    {
+        std::string name;
+        std::vector<std::string> messages;
+        std::vector<bool> changes;                  // false for BEGIN/COMMIT
+        size_t rows = 0;
+        size_t bytes = 0;
+
+        bool load(const std::string& path);
+    };
+
+    // Heap allocations of the whole process so far: malloc, calloc and growing reallocs,
+    // which covers operator new, libbson and rapidjson's pools.
+    unsigned long long allocations();
+
+    // Throws away what setting up a benchmark prints: options, connects and reports.
+    class quiet_output
+    {
+        private:
+        class null_buffer: public std::streambuf
+        {
+            protected:
+            int overflow(int c) override;
+            std::streamsize xsputn(const char* s, std::streamsize n) override;
+        };
+
+        null_buffer _null;
+        std::streambuf* _saved;
+
+        public:
+        quiet_output();
+        ~quiet_output();
+    };
+
+    // Runs every pass once untimed, then repeats it until min_time and reports the rate
+    // per unit of work: rows for the corpus stages, calls for the others.
+    class runner
+    {
+        public:
+        struct options_t
+        {
+            std::chrono::milliseconds min_time{1000};
+            std::string filter;                     // substring of "<benchmark>/<corpus>"
+        };
+
+        private:
+        struct result
+        {
+            std::string name;
+            std::string unit;
+            double units = 0;
+            double seconds = 0;
+            double allocations = 0;
+            std::string skipped;                    // why it didn't run
+        };
+
+        options_t _options;
+        std::vector<result> _results;
+
+        public:
+        explicit runner(const options_t& options);
+
+        bool selected(const std::string& name) const;
+
+        // pass does `units` of work each time it is called
+        void run(const std::string& name, const std::string& unit, size_t units, const std::function<void()>& pass);
+
+        // a benchmark that could not run, with the reason
+        void skip(const std::string& name, const std::string& reason);
+
+        void report(std::ostream& out) const;
+    };
+
+    void micro_benchmarks(runner& runner, const std::vector<corpus>& corpora);
+
+    // host:port of a mongod to apply to, empty runs against the null sink only
+    void end_to_end_benchmarks(runner& runner, const std::vector<corpus>& corpora, const std::string& mongo);
+}
+}
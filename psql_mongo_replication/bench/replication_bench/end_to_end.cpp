@@ -0,0 +1,127 @@
+#include "bench.hpp"
+#include "psql_mongo_replication/psql_mongo_replication.hpp"
+#include "pg_recvlogical/pg_recvlogical.h"
+#include <thread>
+
+namespace psql_mongo_replication
+{
+namespace bench
+{
+
+namespace
+{
+    // roughly what a WAL record adds to its payload
+    const unsigned long long record_overhead = 24;
+
+    const std::chrono::seconds apply_timeout{60};
+
+    const char* const database = "psql_mongo_replication_bench";
+
+    // The whole replicator on the calling thread, fed through the local decoding entry
+    // points so no server is needed: receive() for every message, then idle() as a quiet
+    // stream would until the sink applied the last one.
+    class replicator
+    {
+        private:
+        psql_to_mongo _replication;
+        unsigned long long _lsn = 0x1000000;        // grows from pass to pass
+
+        public:
+        bool stalled = false;
+
+        replicator(const std::string& sink, const std::string& host, const std::string& port)
+        {
+            quiet_output quiet;
+            const char* slot = nullptr;
+            const char* plugin_options = nullptr;
+            const pg_recvlogical_connection_settings_t connection = {database, host.c_str(), port.c_str(), nullptr, nullptr, 0};
+
+            _replication.set_replication_option("sink", sink);
+            _replication.set_replication_option("metrics_interval", "0");
+            _replication.connect_to_mongo_db(connection);
+
+            // passes insert the same keys again
+            if(sink == "mongo")
+                _replication.set_subscriber_option(0, "apply_mode", "upsert");
+
+            _replication.start_local(slot, plugin_options);
+        }
+
+        // false when the last change wasn't applied within apply_timeout
+        bool pass(const corpus& corpus)
+        {
+            const long long send_time = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+            unsigned long long last = 0;
+
+            for(const std::string& message: corpus.messages)
+            {
+                last = _lsn;
+                _replication.receive(message.data(), unsigned(message.size()), _lsn, _lsn, send_time);
+                _lsn += message.size() + record_overhead;
+            }
+
+            const auto deadline = std::chrono::steady_clock::now() + apply_timeout;
+
+            _replication.idle(last);
+
+            while(_replication.applied_lsn() < last)
+            {
+                if(std::chrono::steady_clock::now() > deadline)
+                {
+                    stalled = true;
+                    return false;
+                }
+
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                _replication.idle(last);
+            }
+
+            return true;
+        }
+    };
+
+    void apply(runner& runner, const corpus& corpus, const std::string& sink, const std::string& host, const std::string& port)
+    {
+        const std::string name = "end_to_end/" + sink + "/" + corpus.name;
+
+        if(!runner.selected(name))
+            return;
+
+        replicator replicator(sink, host, port);
+
+        {
+            quiet_output quiet;
+
+            if(!replicator.pass(corpus))
+            {
+                runner.skip(name, "nothing applied within " + std::to_string(apply_timeout.count()) + " s");
+                return;
+            }
+        }
+
+        runner.run(name, "row", corpus.rows, [&]() { replicator.pass(corpus); });
+
+        if(replicator.stalled)
+            std::cout << name << ": a pass stalled for " << apply_timeout.count() << " s, its rate is meaningless" << std::endl;
+    }
+}
+
+void end_to_end_benchmarks(runner& runner, const std::vector<corpus>& corpora, const std::string& mongo)
+{
+    const size_t colon = mongo.rfind(':');
+    const std::string host = mongo.substr(0, colon);
+    const std::string port = colon == std::string::npos? "27017": mongo.substr(colon + 1);
+
+    for(const corpus& corpus: corpora)
+    {
+        apply(runner, corpus, "null", "", "");
+
+        if(mongo.empty())
+            runner.skip("end_to_end/mongo/" + corpus.name, "no --mongo");
+        else
+            apply(runner, corpus, "mongo", host, port);
+    }
+}
+
+}
+}
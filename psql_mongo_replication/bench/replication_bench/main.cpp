@@ -0,0 +1,111 @@
+#include "bench.hpp"
+#include "psql_mongo_replication/options.hpp"
+#include <sstream>
+#include <getopt.h>
+
+using namespace psql_mongo_replication;
+
+namespace
+{
+    void usage()
+    {
+        std::cout <<
+            "psql_mongo_replication_bench times the stages a change goes through and the whole\n"
+            "replicator, per corpus row: rows per second, ns and heap allocations per row.\n\n"
+            "  --corpus-dir <dir>        where the corpora are (" BENCH_CORPUS_DIR ")\n"
+            "  --corpus <name,...>       corpora to run, <dir>/<name>.jsonl (narrow,wide,toast)\n"
+            "  --filter <text>           only benchmarks whose <benchmark>/<corpus> contains it\n"
+            "  --min-time-ms <n>         time each benchmark for at least n ms (1000)\n"
+            "  --mongo <host[:port]>     also apply end to end to this mongod, database\n"
+            "                            psql_mongo_replication_bench, with apply_mode upsert\n\n"
+            "benchmarks:\n"
+            "  parse/<corpus>            rapidjson parse of every message\n"
+            "  to_bson/<corpus>          \"d\" and \"c\" of parsed changes to bson\n"
+            "  decode/<corpus>           what on_changes does to a message before routing it\n"
+            "  route/<n>                 subscriber lookup among n subscribers, per call\n"
+            "  keepalive/<n>             idle() with n subscribers: windows due and feedback, per call\n"
+            "  end_to_end/null/<corpus>  receive() to the null sink until applied\n"
+            "  end_to_end/mongo/<corpus> receive() to mongod until applied\n";
+    }
+}
+
+int main(int argc, char **argv)
+{
+    enum
+    {
+        OPTION_CORPUS_DIR = 1000,
+        OPTION_CORPUS,
+        OPTION_FILTER,
+        OPTION_MIN_TIME_MS,
+        OPTION_MONGO,
+        OPTION_HELP,
+    };
+
+    static const option long_options[] =
+    {
+        {"corpus-dir", required_argument, nullptr, OPTION_CORPUS_DIR},
+        {"corpus", required_argument, nullptr, OPTION_CORPUS},
+        {"filter", required_argument, nullptr, OPTION_FILTER},
+        {"min-time-ms", required_argument, nullptr, OPTION_MIN_TIME_MS},
+        {"mongo", required_argument, nullptr, OPTION_MONGO},
+        {"help", no_argument, nullptr, OPTION_HELP},
+        {nullptr, 0, nullptr, 0}
+    };
+
+    bench::runner::options_t runner_options;
+    std::string corpus_dir = BENCH_CORPUS_DIR;
+    std::string corpus_names = "narrow,wide,toast";
+    std::string mongo;
+
+    for(int option; (option = getopt_long(argc, argv, "", long_options, nullptr)) != -1; )
+    {
+        const std::string value = optarg? optarg: "";
+        unsigned long long number = 0;
+        bool valid = true;
+
+        switch(option)
+        {
+            case OPTION_CORPUS_DIR: corpus_dir = value; break;
+            case OPTION_CORPUS: corpus_names = value; break;
+            case OPTION_FILTER: runner_options.filter = value; break;
+            case OPTION_MIN_TIME_MS: valid = options::parse_unsigned(value, number); runner_options.min_time = std::chrono::milliseconds(number); break;
+            case OPTION_MONGO: valid = !value.empty(); mongo = value; break;
+            case OPTION_HELP: usage(); return 0;
+            default: usage(); return 1;
+        }
+
+        if(!valid)
+        {
+            std::cout << "psql_mongo_replication_bench: invalid value \"" << value << "\" of --" << long_options[option - OPTION_CORPUS_DIR].name << std::endl;
+            return 1;
+        }
+    }
+
+    std::vector<bench::corpus> corpora;
+    std::istringstream names(corpus_names);
+
+    for(std::string name; std::getline(names, name, ','); )
+    {
+        bench::corpus corpus;
+
+        corpus.name = name;
+
+        if(!corpus.load(corpus_dir + "/" + name + ".jsonl"))
+            return 1;
+
+        std::cout << name << ": " << corpus.messages.size() << " messages, " << corpus.rows << " rows, " << (corpus.rows? corpus.bytes / corpus.rows: 0) << " bytes per row" << std::endl;
+
+        corpora.push_back(std::move(corpus));
+    }
+
+    bench::runner runner(runner_options);
+
+    bench::micro_benchmarks(runner, corpora);
+    bench::end_to_end_benchmarks(runner, corpora, mongo);
+
+    std::cout << std::endl;
+
+    runner.report(std::cout);
+
+    return 0;
+}
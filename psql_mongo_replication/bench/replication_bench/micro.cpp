@@ -0,0 +1,178 @@
+#include "bench.hpp"
+#include "psql_mongo_replication/psql_mongo_replication.hpp"
+#include "psql_mongo_replication/change_decoder.hpp"
+#include "psql_mongo_replication/json_to_bson.hpp"
+#include "pg_recvlogical/pg_recvlogical.h"
+#include <bson.h>
+#include <memory>
+
+namespace psql_mongo_replication
+{
+namespace bench
+{
+
+namespace
+{
+    // psql_to_mongo with the stages below its host API reachable
+    class psql_to_mongo_probe: public psql_to_mongo
+    {
+        public:
+        using psql_to_mongo::get_db_instance;
+    };
+
+    const unsigned lookups_per_pass = 1000;
+    const unsigned keepalives_per_pass = 1000;
+
+    // quiet, as nothing is reported between passes
+    void connect_null_sinks(psql_to_mongo& replication, unsigned count)
+    {
+        quiet_output quiet;
+
+        replication.set_replication_option("sink", "null");
+        replication.set_replication_option("metrics_interval", "0");
+
+        for(unsigned id = 0; id < count; ++id)
+        {
+            const pg_recvlogical_connection_settings_t connection = {"psql_mongo_replication_bench", "", "", nullptr, nullptr, id};
+
+            replication.connect_to_mongo_db(connection);
+        }
+    }
+
+    // rapidjson alone, with the decoder's reused pool
+    void parse(runner& runner, const corpus& corpus)
+    {
+        const size_t buffer_size = 64 * 1024;
+        std::unique_ptr<char[]> buffer(new char[buffer_size]);
+        rapidjson::MemoryPoolAllocator<> allocator(buffer.get(), buffer_size);
+        rapidjson::Document document(&allocator);
+
+        runner.run("parse/" + corpus.name, "row", corpus.rows, [&]()
+        {
+            for(const std::string& message: corpus.messages)
+            {
+                document.Parse(message.data(), message.size());
+                allocator.Clear();
+            }
+        });
+    }
+
+    // "d" and "c" of documents parsed up front, into a reused document as the decoder does
+    void to_bson(runner& runner, const corpus& corpus)
+    {
+        std::vector<std::unique_ptr<rapidjson::Document>> documents;
+
+        for(size_t i = 0; i < corpus.messages.size(); ++i)
+        {
+            if(!corpus.changes[i])
+                continue;
+
+            documents.emplace_back(new rapidjson::Document());
+            documents.back()->Parse(corpus.messages[i].data(), corpus.messages[i].size());
+        }
+
+        bson_t* scratch = bson_new();
+
+        runner.run("to_bson/" + corpus.name, "row", corpus.rows, [&]()
+        {
+            for(const std::unique_ptr<rapidjson::Document>& document: documents)
+            {
+                for(const char* field: {"d", "c"})
+                {
+                    const rapidjson::Value::ConstMemberIterator member = document->FindMember(field);
+
+                    if(member == document->MemberEnd())
+                        continue;
+
+                    bson_reinit(scratch);
+                    json_to_bson::append_object(member->value, scratch);
+                }
+            }
+        });
+
+        bson_destroy(scratch);
+    }
+
+    // what on_changes does to every message before routing it
+    void decode(runner& runner, const corpus& corpus)
+    {
+        change_decoder decoder;
+        change_t change;
+        std::vector<int> subscribers;
+
+        runner.run("decode/" + corpus.name, "row", corpus.rows, [&]()
+        {
+            for(const std::string& message: corpus.messages)
+                decoder.decode(message.data(), unsigned(message.size()), change, subscribers);
+        });
+    }
+
+    // the subscriber lookup dispatch does for every id of every change
+    void route(runner& runner, unsigned subscribers)
+    {
+        const std::string name = "route/" + std::to_string(subscribers);
+
+        if(!runner.selected(name))
+            return;
+
+        psql_to_mongo_probe replication;
+
+        connect_null_sinks(replication, subscribers);
+
+        runner.run(name, "call", lookups_per_pass, [&]()
+        {
+            for(unsigned i = 0; i < lookups_per_pass; ++i)
+                replication.get_db_instance(i % subscribers);
+        });
+    }
+
+    // What a server keepalive or a quiet stream costs: the windows due, the applied position
+    // and the feedback it produces. The stream side of sendFeedback is in pg_recvlogical.
+    void keepalive(runner& runner, unsigned subscribers)
+    {
+        const std::string name = "keepalive/" + std::to_string(subscribers);
+
+        if(!runner.selected(name))
+            return;
+
+        psql_to_mongo replication;
+        const char* slot = nullptr;
+        const char* plugin_options = nullptr;
+        const std::string begin = "{\"a\":3,\"x\":1}";
+        unsigned long long wal_end = 0x1000000;
+
+        connect_null_sinks(replication, subscribers);
+
+        {
+            quiet_output quiet;
+
+            replication.start_local(slot, plugin_options);
+            replication.receive(begin.data(), unsigned(begin.size()), wal_end, wal_end, 0);
+        }
+
+        runner.run(name, "call", keepalives_per_pass, [&]()
+        {
+            for(unsigned i = 0; i < keepalives_per_pass; ++i)
+                replication.idle(wal_end += 24);
+        });
+    }
+}
+
+void micro_benchmarks(runner& runner, const std::vector<corpus>& corpora)
+{
+    for(const corpus& corpus: corpora)
+    {
+        parse(runner, corpus);
+        to_bson(runner, corpus);
+        decode(runner, corpus);
+    }
+
+    for(unsigned subscribers: {1, 16})
+    {
+        route(runner, subscribers);
+        keepalive(runner, subscribers);
+    }
+}
+
+}
+}
@@ -0,0 +1,229 @@
+#include "bench.hpp"
+#include "rapidjson/document.h"
+#include <atomic>
+#include <cerrno>
+#include <fstream>
+#include <iomanip>
+
+namespace
+{
+    std::atomic<unsigned long long> allocated{0};
+}
+
+// Counted on top of glibc's allocator, so every library of the process is seen whether or
+// not it goes through operator new.
+extern "C"
+{
+    void* __libc_malloc(size_t size);
+    void* __libc_calloc(size_t count, size_t size);
+    void* __libc_realloc(void* pointer, size_t size);
+    void* __libc_memalign(size_t alignment, size_t size);
+
+    void* malloc(size_t size)
+    {
+        allocated.fetch_add(1, std::memory_order_relaxed);
+        return __libc_malloc(size);
+    }
+
+    void* calloc(size_t count, size_t size)
+    {
+        allocated.fetch_add(1, std::memory_order_relaxed);
+        return __libc_calloc(count, size);
+    }
+
+    void* realloc(void* pointer, size_t size)
+    {
+        allocated.fetch_add(1, std::memory_order_relaxed);
+        return __libc_realloc(pointer, size);
+    }
+
+    // the aligned ones all end in glibc's memalign, which is what aligned_alloc is there
+    void* memalign(size_t alignment, size_t size)
+    {
+        allocated.fetch_add(1, std::memory_order_relaxed);
+        return __libc_memalign(alignment, size);
+    }
+
+    void* aligned_alloc(size_t alignment, size_t size)
+    {
+        allocated.fetch_add(1, std::memory_order_relaxed);
+        return __libc_memalign(alignment, size);
+    }
+
+    int posix_memalign(void** pointer, size_t alignment, size_t size)
+    {
+        if(alignment % sizeof(void*) != 0 || (alignment & (alignment - 1)) != 0 || alignment == 0)
+            return EINVAL;
+
+        allocated.fetch_add(1, std::memory_order_relaxed);
+
+        void* memory = __libc_memalign(alignment, size);
+
+        if(memory == nullptr && size != 0)
+            return ENOMEM;
+
+        *pointer = memory;
+        return 0;
+    }
+}
+
+namespace psql_mongo_replication
+{
+namespace bench
+{
+
+bool corpus::load(const std::string& path)
+{
+    std::ifstream in(path);
+
+    if(!in)
+    {
+        std::cout << "psql_mongo_replication_bench: cannot open " << path << std::endl;
+        return false;
+    }
+
+    rapidjson::Document document;
+
+    for(std::string line; std::getline(in, line); )
+    {
+        // a checkout with CRLF line ends
+        if(!line.empty() && line.back() == '\r')
+            line.pop_back();
+
+        if(line.empty())
+            continue;
+
+        document.Parse(line.c_str(), line.size());
+
+        if(document.HasParseError() || !document.IsObject() || !document.HasMember("a") || !document["a"].IsInt())
+        {
+            std::cout << "psql_mongo_replication_bench: " << path << ":" << messages.size() + 1 << " is not a decoder_json message" << std::endl;
+            return false;
+        }
+
+        const bool change = document["a"].GetInt() <= 2;
+
+        rows += change? 1: 0;
+        bytes += line.size();
+
+        changes.push_back(change);
+        messages.push_back(std::move(line));
+    }
+
+    return rows > 0;
+}
+
+unsigned long long allocations()
+{
+    return allocated.load(std::memory_order_relaxed);
+}
+
+int quiet_output::null_buffer::overflow(int c)
+{
+    return traits_type::not_eof(c);
+}
+
+std::streamsize quiet_output::null_buffer::xsputn(const char*, std::streamsize n)
+{
+    return n;
+}
+
+quiet_output::quiet_output():
+    _saved(std::cout.rdbuf(&_null))
+{
+}
+
+quiet_output::~quiet_output()
+{
+    std::cout.rdbuf(_saved);
+}
+
+runner::runner(const options_t& options):
+    _options(options)
+{
+}
+
+bool runner::selected(const std::string& name) const
+{
+    return name.find(_options.filter) != std::string::npos;
+}
+
+void runner::run(const std::string& name, const std::string& unit, size_t units, const std::function<void()>& pass)
+{
+    if(!selected(name) || units == 0)
+        return;
+
+    std::cout << name << "..." << std::endl;
+
+    result measured;
+
+    measured.name = name;
+    measured.unit = unit;
+
+    {
+        quiet_output quiet;
+
+        pass();
+
+        const unsigned long long allocated_before = allocations();
+        const auto start = std::chrono::steady_clock::now();
+        auto elapsed = std::chrono::steady_clock::duration::zero();
+        size_t passes = 0;
+
+        do
+        {
+            pass();
+            ++passes;
+            elapsed = std::chrono::steady_clock::now() - start;
+        }
+        while(elapsed < _options.min_time);
+
+        measured.units = double(passes) * units;
+        measured.seconds = std::chrono::duration<double>(elapsed).count();
+        measured.allocations = double(allocations() - allocated_before);
+    }
+
+    _results.push_back(measured);
+}
+
+void runner::skip(const std::string& name, const std::string& reason)
+{
+    if(!selected(name))
+        return;
+
+    result skipped;
+
+    skipped.name = name;
+    skipped.skipped = reason;
+
+    _results.push_back(skipped);
+}
+
+void runner::report(std::ostream& out) const
+{
+    const std::ios::fmtflags flags = out.flags();
+
+    out << std::left << std::setw(28) << "benchmark" << std::setw(6) << "unit"
+        << std::right << std::setw(14) << "per second" << std::setw(12) << "ns per" << std::setw(12) << "allocs per" << std::endl;
+
+    for(const result& measured: _results)
+    {
+        out << std::left << std::setw(28) << measured.name;
+
+        if(!measured.skipped.empty())
+        {
+            out << "skipped, " << measured.skipped << std::endl;
+            continue;
+        }
+
+        out << std::setw(6) << measured.unit << std::right << std::fixed
+            << std::setw(14) << std::setprecision(0) << measured.units / measured.seconds
+            << std::setw(12) << std::setprecision(1) << measured.seconds * 1e9 / measured.units
+            << std::setw(12) << std::setprecision(2) << measured.allocations / measured.units << std::endl;
+    }
+
+    out.flags(flags);
+}
+
+}
+}
@@ -1,33 +1,151 @@
-#pragma once
-
-#include <memory>
-#include <thread>
-#include <mutex>
-#include <vector>
-
-struct pg_recvlogical_connection_settings_t;
-
-namespace psql_mongo_replication
-{
-    class mongo_replication;
-
-    class psql_to_mongo
-    {
-        private:
-        std::vector<std::unique_ptr<mongo_replication>> _mongo_replications_db;
-        static unsigned char on_changes_static(const void* context, const char* changes, unsigned size);
-        psql_mongo_replication::mongo_replication* get_db_instance(int id);
-        std::unique_ptr<std::thread> _replication_thread;
-        std::mutex _mutex;
-
-        public:
-        psql_to_mongo();
-        ~psql_to_mongo();
-        void on_changes(const char* changes, unsigned size);
-        void connect_to_mongo_db(const pg_recvlogical_connection_settings_t& connection);
-        void reconnect(int id);
-        void unconnect_from_mongo_db();
-        void connect_to_mongo_dbs(const pg_recvlogical_connection_settings_t* connection, unsigned count);
-        void start_replication(const pg_recvlogical_connection_settings_t& host_connection);
-    };
-}
+#pragma once
+
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <chrono>
+#include <string>
+#include <unordered_map>
+
+struct pg_recvlogical_connection_settings_t;
+struct psql_to_mongo_stats_t;
+
+namespace psql_mongo_replication
+{
+    class sink;
+    class change_decoder;
+    class memory_budget;
+    class replication_metrics;
+    struct throughput_t;
+    class transaction_stage;
+    struct change_t;
+
+    class psql_to_mongo
+    {
+        private:
+        std::unique_ptr<memory_budget> _budget;      // staged chunks give their bytes back when flushed
+        std::unique_ptr<replication_metrics> _metrics;
+        std::unordered_map<std::string, throughput_t*> _relation_metrics;
+        std::chrono::seconds _metrics_interval{60};
+        std::chrono::steady_clock::time_point _metrics_reported;
+        psql_to_mongo_stats_t* _stats = nullptr;
+        std::chrono::steady_clock::time_point _stats_published;
+        std::unique_ptr<change_decoder> _decoder;    // outlives the subscribers holding decoded changes
+        std::unique_ptr<transaction_stage> _transaction;
+        std::unordered_map<unsigned int, std::unique_ptr<transaction_stage>> _streams;   // in-progress, by top-level xid
+        transaction_stage* _streaming = nullptr;                                          // stream of the open chunk
+        unsigned long long _received_lsn = 0;
+        unsigned long long _wal_end = 0;
+        unsigned long long _catch_up_enter = 256ull << 20;    // lag in bytes of WAL
+        unsigned long long _catch_up_exit = 16ull << 20;
+        std::chrono::seconds _catch_up_feedback{30};
+        std::chrono::steady_clock::time_point _confirmed;
+        bool _catch_up = false;
+        std::string _spill_directory = "psql_to_mongo_spill";
+        std::string _archive_path;                  // empty archives nothing
+        bool _archive_tar = false;
+        std::string _archive_compression = "none";
+        int _archive_compression_level = 0;
+        int _archive_zstd_window_log = 0;
+        unsigned _archive_segment_mb = 64;
+        bool _archiving = false;
+        unsigned long long _archived_lsn = 0;       // synced to the archive, nothing past it is confirmed
+        std::chrono::steady_clock::time_point _archive_synced;
+        bool _replaying = false;
+        std::atomic<bool> _stop_replay{false};
+        unsigned _snapshot_readers = 4;
+        size_t _snapshot_batch_size = 1000;
+        unsigned long long _snapshot_split = 1ull << 30;
+        std::vector<int> _subscribers;
+        std::string _sink = "mongo";
+        std::string _sink_directory = "psql_to_mongo_sink";
+        std::vector<std::unique_ptr<sink>> _mongo_replications_db;
+        static unsigned char on_changes_static(const void* context, const char* changes, unsigned size);
+        static void on_idle_static(const void* context);
+        void process(change_t& change);
+        void dispatch(change_t& change, const std::vector<int>& subscribers);
+        void commit(transaction_stage& transaction, long long send_time);
+        void fail(const std::string& reason);
+        bool on_stream(const change_t& change);
+        void track_progress();
+        bool archived(unsigned long long& applied, std::chrono::steady_clock::time_point now);
+        const char* plugin_options();
+        void init_replication(const pg_recvlogical_connection_settings_t& host_connection);
+        void open_archive();
+        void close_archive();
+        std::unique_ptr<std::thread> _replication_thread;
+        void (*_host_idle)() = nullptr;
+        bool _local = false;                        // the host decodes the slot in-process
+        unsigned long long _local_applied = 0;
+        bool _failed = false;                       // see fail()
+        std::mutex _mutex;
+        unsigned _confirm_interval = 0;
+
+        protected:
+        // The subscriber changes for `id` are routed to, nullptr when there is none.
+        // A seam for benchmarks deriving from psql_to_mongo, not part of the host API.
+        sink* get_db_instance(int id);
+
+        public:
+        // how often pending batches are checked for an expired window while the stream is quiet
+        static constexpr unsigned idle_interval_ms = 50;
+
+        // how often the shared stats segment is refreshed
+        static constexpr std::chrono::seconds stats_interval{1};
+
+        // how often the archive is synced, and so how far confirmations lag behind it
+        static constexpr std::chrono::seconds archive_sync_interval{1};
+
+        static constexpr const char* slot_name = "custom_slot";
+        static constexpr const char* plugin_name = "decoder_json";
+
+        psql_to_mongo();
+        ~psql_to_mongo();
+        void on_changes(const char* changes, unsigned size);
+        void on_idle();
+
+        // One output plugin message and where it stands, whoever decoded it.
+        void receive(const char* changes, unsigned size, unsigned long long lsn, unsigned long long wal_end, long long send_time);
+        void idle(unsigned long long wal_end);
+        void connect_to_mongo_db(const pg_recvlogical_connection_settings_t& connection);
+        void reconnect(int id);
+        bool set_subscriber_option(int id, const std::string& name, const std::string& value);
+        bool set_replication_option(const std::string& name, const std::string& value);
+        replication_metrics& metrics();
+        void set_stats(psql_to_mongo_stats_t* stats);
+        void unconnect_from_mongo_db();
+        void connect_to_mongo_dbs(const pg_recvlogical_connection_settings_t* connection, unsigned count);
+        // Streams on a thread of its own, for the standalone tool.
+        void start_replication(const pg_recvlogical_connection_settings_t& host_connection);
+
+        // Streams on the calling thread until stop_replication(), for the background worker.
+        void run_replication(const pg_recvlogical_connection_settings_t& host_connection);
+
+        // Creates the slot with an exported snapshot, copies the subscribed tables as of it
+        // and streams from the slot's consistent point on the calling thread. False, without
+        // streaming, when the slot exists, the copy failed or a key index wasn't built; a
+        // failed copy drops the slot, failed index builds keep it.
+        bool initial_sync(const pg_recvlogical_connection_settings_t& host_connection);
+
+        // Feeds an archive written with archive_path through receive() as fast as the sinks
+        // take it, without a server; nothing is confirmed to any slot.
+        bool replay(const std::string& path);
+
+        // The host drives logical decoding on the slot itself and feeds receive() and idle();
+        // it confirms applied_lsn() to the slot instead of the stream doing it.
+        void start_local(const char*& slot, const char*& plugin_options);
+        unsigned long long applied_lsn() const;
+
+        // A change could not be applied and the stream was stopped; the host restarts it.
+        bool failed() const;
+
+        // Async signal safe.
+        void stop_replication();
+
+        // Called on the stream thread while it is idle, outside of any lock, so the host can
+        // handle its interrupts and reload options.
+        void set_host_idle(void (*host_idle)());
+    };
+}
@@ -1,31 +1,87 @@
-#ifndef _psql_to_mongo_c_to_cpp_h_
-#define _psql_to_mongo_c_to_cpp_h_
-
-#ifdef __cplusplus
-extern "C"{
-#endif 
-
-void psql_mongo_replication_cpp_connect_mongo_db(
-      const char* dbname
-    , const char* host
-    , const char* port
-    , const char* username
-    , const char* password
-    , unsigned int id);
-
-void psql_mongo_replication_cpp_start_replication(
-      const char* dbname
-    , const char* host
-    , const char* port
-    , const char* username
-    , const char* password);
-
-void psql_mongo_replication_cpp_reconnect_mongo_db(int id);
-
-void psql_mongo_replication_cpp_test_linking();
-
-#ifdef __cplusplus
-}
-#endif
-
+#ifndef _psql_to_mongo_c_to_cpp_h_
+#define _psql_to_mongo_c_to_cpp_h_
+
+#ifdef __cplusplus
+extern "C"{
+#endif 
+
+struct psql_to_mongo_stats_t;
+
+void psql_mongo_replication_cpp_connect_mongo_db(
+      const char* dbname
+    , const char* host
+    , const char* port
+    , const char* username
+    , const char* password
+    , unsigned int id);
+
+void psql_mongo_replication_cpp_start_replication(
+      const char* dbname
+    , const char* host
+    , const char* port
+    , const char* username
+    , const char* password);
+
+/* blocks on the calling thread until psql_mongo_replication_cpp_stop_replication() */
+void psql_mongo_replication_cpp_run_replication(
+      const char* dbname
+    , const char* host
+    , const char* port
+    , const char* username
+    , const char* password);
+
+/* in-process decoding: the caller drives logical decoding on *slot with *plugin_options
+   ("name=value,name" or NULL), hands every message to on_local_changes, calls on_local_idle
+   while waiting for WAL and confirms applied_lsn to the slot */
+void psql_mongo_replication_cpp_start_local(const char** slot, const char** plugin_options);
+
+void psql_mongo_replication_cpp_on_local_changes(
+      const char* changes
+    , unsigned int size
+    , unsigned long long lsn
+    , unsigned long long wal_end
+    , long long send_time);
+
+void psql_mongo_replication_cpp_on_local_idle(unsigned long long wal_end);
+
+unsigned long long psql_mongo_replication_cpp_applied_lsn();
+
+/* 1 once a change could not be applied: nothing more is applied or confirmed and the
+   host restarts decoding from the slot */
+int psql_mongo_replication_cpp_failed();
+
+/* creates the slot, copies the subscribed tables in its exported snapshot and streams from
+   its consistent point on the calling thread; 0, without streaming, when that failed */
+int psql_mongo_replication_cpp_initial_sync(
+      const char* dbname
+    , const char* host
+    , const char* port
+    , const char* username
+    , const char* password);
+
+/* replays an archive written with the archive_path option through the subscribers on the
+   calling thread, without a server; 0 when a segment was unreadable */
+int psql_mongo_replication_cpp_replay(const char* path);
+
+/* async signal safe, the stream returns at its next wakeup */
+void psql_mongo_replication_cpp_stop_replication();
+
+/* called on the stream thread while it is idle */
+void psql_mongo_replication_cpp_set_on_idle(void (*on_idle)(void));
+
+void psql_mongo_replication_cpp_reconnect_mongo_db(int id);
+
+int psql_mongo_replication_cpp_set_subscriber_option(int id, const char* name, const char* value);
+
+int psql_mongo_replication_cpp_set_replication_option(const char* name, const char* value);
+
+/* shared segment the worker publishes its counters to, NULL stops publishing */
+void psql_mongo_replication_cpp_set_stats(struct psql_to_mongo_stats_t* stats);
+
+void psql_mongo_replication_cpp_test_linking();
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif
\ No newline at end of file
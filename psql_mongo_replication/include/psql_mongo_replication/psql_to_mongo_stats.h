@@ -0,0 +1,61 @@
+#ifndef _psql_to_mongo_stats_h_
+#define _psql_to_mongo_stats_h_
+
+#include <stdint.h>
+
+/* the seqlock count, written with release and read with acquire ordering from both sides */
+#ifdef __cplusplus
+#include <atomic>
+typedef std::atomic<uint32_t> psql_to_mongo_changecount_t;
+static_assert(sizeof(psql_to_mongo_changecount_t) == sizeof(uint32_t) && std::atomic<uint32_t>::is_always_lock_free,
+    "the changecount is shared with C");
+#else
+#include <stdatomic.h>
+typedef _Atomic uint32_t psql_to_mongo_changecount_t;
+#endif
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+#define PSQL_TO_MONGO_STATS_MAX_SUBSCRIBERS 64
+
+/*
+ * Layout of the shared memory segment the replication worker publishes its counters to
+ * and psql_to_mongo_stats() reads. The worker is the only writer; every slot is guarded by
+ * changecount, odd while a write is in progress, so readers retry instead of locking.
+ */
+struct psql_to_mongo_subscriber_stats_t
+{
+    psql_to_mongo_changecount_t changecount;
+    int32_t  subscriber_id;
+    uint64_t queued;
+    uint64_t applied_lsn;
+    uint64_t lag_bytes;
+    double   lag_seconds;
+    uint64_t batch_limit;
+    uint64_t batches;
+    uint64_t errors;
+    uint64_t rows_applied;
+    double   rows_per_sec;
+    double   bytes_per_sec;
+    uint64_t ack_p50_ms;
+    uint64_t ack_p99_ms;
+};
+
+struct psql_to_mongo_stats_t
+{
+    psql_to_mongo_changecount_t changecount;
+    uint32_t subscriber_count;
+    uint64_t received_lsn;
+    uint64_t wal_end;
+    int64_t  updated_at;        /* us since the Unix epoch */
+    double   received_rows_per_sec;
+    struct psql_to_mongo_subscriber_stats_t subscribers[PSQL_TO_MONGO_STATS_MAX_SUBSCRIBERS];
+};
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
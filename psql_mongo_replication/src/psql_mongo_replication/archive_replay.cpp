@@ -0,0 +1,482 @@
+#include "psql_mongo_replication/archive_replay.hpp"
+#include "pg_recvlogical/pg_recvlogical.h"
+#include <zlib.h>
+#ifdef HAVE_LIBZSTD
+#include <zstd.h>
+#endif
+#ifdef HAVE_LIBLZ4
+#include <lz4frame.h>
+#endif
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "stdafx.hpp"
+
+namespace
+{
+    uint64_t read_be(const uint8_t* data, size_t bytes)
+    {
+        uint64_t value = 0;
+
+        for(size_t i = 0; i < bytes; ++i)
+            value = (value << 8) | data[i];
+
+        return value;
+    }
+
+    // "<lsn>.chg", compressed or still .partial
+    bool is_segment(const std::string& name)
+    {
+        return name.find(".chg") != std::string::npos;
+    }
+
+    const size_t tar_block = 512;
+
+    const uint8_t zstd_magic[] = {0x28, 0xb5, 0x2f, 0xfd};
+    const uint8_t lz4_magic[] = {0x04, 0x22, 0x4d, 0x18};
+}
+
+namespace psql_mongo_replication
+{
+
+archive_replay::input::~input()
+{
+    if(_zstream)
+    {
+        inflateEnd(_zstream);
+        delete _zstream;
+    }
+
+#ifdef HAVE_LIBZSTD
+    if(_zstd)
+        ZSTD_freeDCtx(_zstd);
+#endif
+
+#ifdef HAVE_LIBLZ4
+    if(_lz4)
+        LZ4F_freeDecompressionContext(_lz4);
+#endif
+
+    if(_map)
+        munmap(_map, _size);
+}
+
+bool archive_replay::input::open(const std::string& path)
+{
+    _name = path;
+
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+    if(fd == -1)
+    {
+        std::cout << "archive_replay: can't open " << path << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    struct stat st;
+
+    if(fstat(fd, &st) != 0)
+    {
+        std::cout << "archive_replay: can't stat " << path << ": " << strerror(errno) << std::endl;
+        ::close(fd);
+        return false;
+    }
+
+    // a segment opened but never written
+    if(st.st_size == 0)
+    {
+        ::close(fd);
+        return true;
+    }
+
+    _size = st.st_size;
+    _map = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    ::close(fd);
+
+    if(_map == MAP_FAILED)
+    {
+        std::cout << "archive_replay: can't map " << path << ": " << strerror(errno) << std::endl;
+        _map = nullptr;
+        return false;
+    }
+
+    madvise(_map, _size, MADV_SEQUENTIAL);
+
+    _pos = static_cast<const uint8_t*>(_map);
+    _end = _pos + _size;
+
+    return start();
+}
+
+bool archive_replay::input::open(const std::string& name, const uint8_t* data, size_t size)
+{
+    _name = name;
+    _pos = data;
+    _end = data + size;
+
+    return start();
+}
+
+// The magic decides, whatever the name says.
+bool archive_replay::input::start()
+{
+    const size_t size = _end - _pos;
+
+    if(size >= 2 && _pos[0] == 0x1f && _pos[1] == 0x8b)
+    {
+        _zstream = new z_stream_s();
+
+        if(inflateInit2(_zstream, 15 + 16) != Z_OK)
+        {
+            std::cout << "archive_replay: can't inflate " << _name << std::endl;
+            delete _zstream;
+            _zstream = nullptr;
+            return false;
+        }
+    }
+    else if(size >= sizeof(zstd_magic) && memcmp(_pos, zstd_magic, sizeof(zstd_magic)) == 0)
+    {
+#ifdef HAVE_LIBZSTD
+        _zstd = ZSTD_createDCtx();
+
+        // archives written in long mode may use a window over the default limit
+        if(_zstd == nullptr || ZSTD_isError(ZSTD_DCtx_setParameter(_zstd, ZSTD_d_windowLogMax, 31)))
+        {
+            std::cout << "archive_replay: can't decompress " << _name << std::endl;
+            return false;
+        }
+#else
+        std::cout << "archive_replay: " << _name << " is zstd compressed, built without zstd" << std::endl;
+        return false;
+#endif
+    }
+    else if(size >= sizeof(lz4_magic) && memcmp(_pos, lz4_magic, sizeof(lz4_magic)) == 0)
+    {
+#ifdef HAVE_LIBLZ4
+        if(LZ4F_isError(LZ4F_createDecompressionContext(&_lz4, LZ4F_VERSION)))
+        {
+            _lz4 = nullptr;
+            std::cout << "archive_replay: can't decompress " << _name << std::endl;
+            return false;
+        }
+#else
+        std::cout << "archive_replay: " << _name << " is lz4 compressed, built without lz4" << std::endl;
+        return false;
+#endif
+    }
+
+    return true;
+}
+
+size_t archive_replay::input::decompress(uint8_t* out, size_t n)
+{
+    size_t produced = 0;
+
+    while(produced < n && _pos < _end)
+    {
+        size_t consumed = std::min<size_t>(_end - _pos, UINT32_MAX);
+        size_t written = std::min<size_t>(n - produced, UINT32_MAX);
+        bool ok = true;
+
+        if(_zstream)
+        {
+            _zstream->next_in = const_cast<Bytef*>(_pos);
+            _zstream->avail_in = consumed;
+            _zstream->next_out = out + produced;
+            _zstream->avail_out = written;
+
+            const int ret = inflate(_zstream, Z_NO_FLUSH);
+
+            consumed -= _zstream->avail_in;
+            written -= _zstream->avail_out;
+
+            // the tar method closes a gzip member at every header, the next one follows
+            if(ret == Z_STREAM_END)
+                inflateReset(_zstream);
+            else
+                ok = ret == Z_OK;
+        }
+#ifdef HAVE_LIBZSTD
+        else if(_zstd)
+        {
+            // a finished frame resets the context, the next one follows
+            ZSTD_inBuffer from = {_pos, consumed, 0};
+            ZSTD_outBuffer to = {out + produced, written, 0};
+
+            ok = !ZSTD_isError(ZSTD_decompressStream(_zstd, &to, &from));
+            consumed = from.pos;
+            written = to.pos;
+        }
+#endif
+#ifdef HAVE_LIBLZ4
+        else if(_lz4)
+            ok = !LZ4F_isError(LZ4F_decompress(_lz4, out + produced, &written, _pos, &consumed, nullptr));
+#endif
+        else
+        {
+            written = std::min(written, consumed);
+            memcpy(out + produced, _pos, written);
+            consumed = written;
+        }
+
+        if(!ok)
+        {
+            std::cout << "archive_replay: " << _name << " is corrupt" << std::endl;
+            _pos = _end;
+            break;
+        }
+
+        _pos += consumed;
+        produced += written;
+
+        if(consumed == 0 && written == 0)
+            break;
+    }
+
+    return produced;
+}
+
+const uint8_t* archive_replay::input::take(size_t n)
+{
+    if(_zstream == nullptr && _zstd == nullptr && _lz4 == nullptr)
+    {
+        if(size_t(_end - _pos) < n)
+            return nullptr;
+
+        const uint8_t* data = _pos;
+
+        _pos += n;
+
+        return data;
+    }
+
+    _buffer.resize(n);
+
+    return decompress(_buffer.data(), n) == n? _buffer.data(): nullptr;
+}
+
+const uint8_t* archive_replay::input::rest(size_t& n)
+{
+    if(_zstream == nullptr && _zstd == nullptr && _lz4 == nullptr)
+    {
+        n = _end - _pos;
+
+        const uint8_t* data = _pos;
+
+        _pos = _end;
+
+        return data;
+    }
+
+    const size_t chunk = 1 << 20;
+
+    _buffer.clear();
+
+    for(size_t produced = chunk; produced == chunk; )
+    {
+        const size_t offset = _buffer.size();
+
+        _buffer.resize(offset + chunk);
+
+        produced = decompress(_buffer.data() + offset, chunk);
+
+        _buffer.resize(offset + produced);
+    }
+
+    n = _buffer.size();
+
+    return _buffer.data();
+}
+
+archive_replay::archive_replay(const std::string& path):
+    _path(path)
+{
+}
+
+bool archive_replay::run(const record_f& on_record, const segment_f& on_segment)
+{
+    struct stat st;
+
+    if(stat(_path.c_str(), &st) != 0)
+    {
+        std::cout << "archive_replay: " << _path << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    const bool ok = S_ISDIR(st.st_mode)? replay_directory(on_record, on_segment): replay_tar(on_record, on_segment);
+
+    std::cout << "archive_replay: " << _stats.records << " record(s), " << _stats.bytes << " bytes from "
+              << _stats.segments << " segment(s), " << _stats.skipped << " already replayed" << std::endl;
+
+    return ok;
+}
+
+// Segment names are the hex LSN of their first record, name order is stream order.
+bool archive_replay::replay_directory(const record_f& on_record, const segment_f& on_segment)
+{
+    DIR* dir = opendir(_path.c_str());
+
+    if(dir == nullptr)
+    {
+        std::cout << "archive_replay: can't list " << _path << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    std::vector<std::string> names;
+
+    while(const dirent* entry = readdir(dir))
+    {
+        if(is_segment(entry->d_name))
+            names.push_back(entry->d_name);
+    }
+
+    closedir(dir);
+
+    std::sort(names.begin(), names.end());
+
+    for(const std::string& name: names)
+    {
+        input segment;
+
+        if(!segment.open(_path + "/" + name))
+            return false;
+
+        // the whole segment, inflated when compressed
+        size_t size = 0;
+        const uint8_t* data = segment.rest(size);
+
+        if(!replay_segment(name, data, size, on_record, on_segment))
+            return false;
+    }
+
+    return true;
+}
+
+// Members were written in stream order, one at a time.
+bool archive_replay::replay_tar(const record_f& on_record, const segment_f& on_segment)
+{
+    input tar;
+
+    if(!tar.open(_path))
+        return false;
+
+    while(const uint8_t* header = tar.take(tar_block))
+    {
+        if(header[0] == '\0')
+            break;
+
+        const std::string name(reinterpret_cast<const char*>(header), strnlen(reinterpret_cast<const char*>(header), 100));
+        const size_t size = std::strtoull(std::string(reinterpret_cast<const char*>(header) + 124, 12).c_str(), nullptr, 8);
+        const size_t padding = (tar_block - size % tar_block) % tar_block;
+
+        // a member still being written when the archiver crashed: the header is
+        // rewritten with the size on close, so it reads 0 and the data runs to the end
+        if(size == 0 && is_segment(name))
+        {
+            std::cout << "archive_replay: " << name << " was not closed, replaying it as the last member" << std::endl;
+
+            size_t length = 0;
+            const uint8_t* data = tar.rest(length);
+            input member;
+
+            if(!member.open(name, data, length))
+                return false;
+
+            const uint8_t* content = member.rest(length);
+
+            return replay_segment(name, content, length, on_record, on_segment);
+        }
+
+        const uint8_t* data = size? tar.take(size): nullptr;
+
+        if(size && data == nullptr)
+        {
+            std::cout << "archive_replay: " << _path << " ends inside " << name << std::endl;
+            return false;
+        }
+
+        if(is_segment(name))
+        {
+            // .lz4/.zst members are compressed on their own
+            input member;
+            size_t length = 0;
+
+            if(!member.open(name, data, size))
+                return false;
+
+            const uint8_t* content = member.rest(length);
+
+            if(!replay_segment(name, content, length, on_record, on_segment))
+                return false;
+        }
+
+        if(padding && tar.take(padding) == nullptr)
+            break;
+    }
+
+    return true;
+}
+
+bool archive_replay::replay_segment(const std::string& name, const uint8_t* data, size_t size,
+    const record_f& on_record, const segment_f& on_segment)
+{
+    const size_t header = PG_RECVLOGICAL_ARCHIVE_HEADER_SIZE;
+    const unsigned long long replayed = _replayed_lsn;
+    size_t offset = 0;
+    unsigned long long wal_end = 0;
+
+    ++_stats.segments;
+
+    while(size - offset >= header)
+    {
+        const uint8_t* record = data + offset;
+        const size_t length = read_be(record, 4);
+
+        if(size - offset - header < length)
+            break;
+
+        const unsigned long long lsn = read_be(record + 4, 8);
+
+        // zeros, the end of a tar or space never written
+        if(lsn == 0)
+            break;
+
+        wal_end = read_be(record + 12, 8);
+        offset += header + length;
+
+        if(lsn <= replayed)
+        {
+            ++_stats.skipped;
+            continue;
+        }
+
+        if(!on_record(reinterpret_cast<const char*>(record + header), length, lsn, wal_end, read_be(record + 20, 8)))
+            return false;
+
+        _replayed_lsn = std::max(_replayed_lsn, lsn);
+
+        ++_stats.records;
+        _stats.bytes += length;
+    }
+
+    // a segment cut short by a crash still replays every complete record
+    if(offset != size)
+        std::cout << "archive_replay: " << name << " has " << size - offset << " trailing byte(s)" << std::endl;
+
+    on_segment(wal_end);
+
+    return true;
+}
+
+archive_replay::stats_t archive_replay::stats() const
+{
+    return _stats;
+}
+
+}
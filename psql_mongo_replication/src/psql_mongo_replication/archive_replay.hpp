@@ -0,0 +1,95 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+
+struct z_stream_s;
+struct ZSTD_DCtx_s;
+struct LZ4F_dctx_s;
+
+namespace psql_mongo_replication
+{
+    // Reads back what pg_recvlogical_archive_write() archived: the segment files of a
+    // directory, or the members of a .tar/.tar.gz, in LSN order. Files are mapped, not
+    // read; uncompressed records are handed out straight from the mapping, gzip, zstd and
+    // lz4 segments are decompressed a segment at a time. zstd and lz4 need the library at
+    // build time (HAVE_LIBZSTD, HAVE_LIBLZ4).
+    class archive_replay
+    {
+        public:
+        // false stops the replay
+        using record_f = std::function<bool(const char* message, unsigned size, unsigned long long lsn,
+            unsigned long long wal_end, long long send_time)>;
+        using segment_f = std::function<void(unsigned long long wal_end)>;
+
+        struct stats_t
+        {
+            size_t segments = 0;
+            uint64_t records = 0;
+            uint64_t bytes = 0;
+            // at or below an LSN already replayed, resent after a restart
+            uint64_t skipped = 0;
+        };
+
+        private:
+        // A mapped file or a tar member, read front to back; compressed content, told by
+        // its magic, is decompressed into _buffer. Concatenated frames read as one.
+        class input
+        {
+            private:
+            std::string _name;
+            void* _map = nullptr;
+            size_t _size = 0;
+            const uint8_t* _pos = nullptr;
+            const uint8_t* _end = nullptr;
+            z_stream_s* _zstream = nullptr;
+            ZSTD_DCtx_s* _zstd = nullptr;
+            LZ4F_dctx_s* _lz4 = nullptr;
+            std::vector<uint8_t> _buffer;
+
+            bool start();
+
+            // Up to n bytes into out, fewer at the end of the input.
+            size_t decompress(uint8_t* out, size_t n);
+
+            public:
+            ~input();
+
+            bool open(const std::string& path);
+
+            // Bytes owned by someone else, alive as long as the input.
+            bool open(const std::string& name, const uint8_t* data, size_t size);
+
+            // The next n bytes, nullptr when the file has fewer.
+            const uint8_t* take(size_t n);
+
+            // Everything left.
+            const uint8_t* rest(size_t& n);
+        };
+
+        std::string _path;
+        stats_t _stats;
+        // highest LSN of the segments replayed so far
+        unsigned long long _replayed_lsn = 0;
+
+        bool replay_directory(const record_f& on_record, const segment_f& on_segment);
+        bool replay_tar(const record_f& on_record, const segment_f& on_segment);
+        bool replay_segment(const std::string& name, const uint8_t* data, size_t size,
+            const record_f& on_record, const segment_f& on_segment);
+
+        public:
+        // A directory of segments, or a tar file with its suffix.
+        explicit archive_replay(const std::string& path);
+
+        // Calls on_record for every archived message and on_segment after each segment;
+        // false when a segment is unreadable or on_record asked to stop. A restart resends
+        // from the confirmed position, so a record at or below the highest LSN of an earlier
+        // segment is skipped.
+        bool run(const record_f& on_record, const segment_f& on_segment);
+
+        stats_t stats() const;
+    };
+}
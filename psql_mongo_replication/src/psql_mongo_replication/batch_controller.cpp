@@ -0,0 +1,63 @@
+#include "psql_mongo_replication/batch_controller.hpp"
+#include <algorithm>
+#include "stdafx.hpp"
+
+namespace psql_mongo_replication
+{
+
+void batch_controller::clamp()
+{
+    _limit = std::min(std::max(_limit, _min), _max);
+}
+
+size_t batch_controller::limit() const
+{
+    return _limit;
+}
+
+void batch_controller::set_limit(size_t limit)
+{
+    _limit = limit;
+    clamp();
+}
+
+void batch_controller::set_max(size_t max)
+{
+    _max = std::max(max, _min);
+    clamp();
+}
+
+void batch_controller::set_target(std::chrono::milliseconds target)
+{
+    _target = target;
+}
+
+void batch_controller::set_adaptive(bool adaptive)
+{
+    _adaptive = adaptive;
+}
+
+void batch_controller::observe(size_t changes, std::chrono::microseconds latency, bool failed)
+{
+    if(!_adaptive)
+        return;
+
+    if(failed || latency > _target)
+    {
+        const size_t previous = _limit;
+
+        _limit /= 2;
+        clamp();
+
+        if(_limit != previous)
+            std::cout << "batch limit " << previous << " -> " << _limit << " ("
+                      << (failed? "write failed": "slow batch") << ", " << latency.count() / 1000 << " ms)" << std::endl;
+    }
+    else if(changes >= _limit)
+    {
+        _limit += _step;
+        clamp();
+    }
+}
+
+}
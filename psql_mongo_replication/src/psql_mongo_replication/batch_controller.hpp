@@ -0,0 +1,34 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+
+namespace psql_mongo_replication
+{
+    // AIMD limit on the changes written per flush. A full batch that was written within the
+    // target latency raises the limit by a step, a slow or failed one halves it. Batches cut
+    // by the window at low load leave the limit alone, they say nothing about capacity.
+    class batch_controller
+    {
+        private:
+        size_t _limit = 1000;
+        size_t _min = 16;
+        size_t _max = 50000;
+        size_t _step = 100;
+        std::chrono::milliseconds _target{200};
+        bool _adaptive = true;
+
+        void clamp();
+
+        public:
+        size_t limit() const;
+
+        // Fixed limit when not adaptive, the starting point otherwise.
+        void set_limit(size_t limit);
+        void set_max(size_t max);
+        void set_target(std::chrono::milliseconds target);
+        void set_adaptive(bool adaptive);
+
+        void observe(size_t changes, std::chrono::microseconds latency, bool failed);
+    };
+}
@@ -0,0 +1,107 @@
+#include "psql_mongo_replication/change_arena.hpp"
+#include "stdafx.hpp"
+
+namespace psql_mongo_replication
+{
+
+change_arena::change_arena(size_t size):
+      _buffer(new char[size])
+    , _resource(_buffer.get(), size)
+{
+}
+
+void* change_arena::do_allocate(size_t bytes, size_t alignment)
+{
+    _allocated += bytes;
+
+    return _resource.allocate(bytes, alignment);
+}
+
+void change_arena::do_deallocate(void*, size_t, size_t)
+{
+}
+
+bool change_arena::do_is_equal(const std::pmr::memory_resource& other) const noexcept
+{
+    return this == &other;
+}
+
+void change_arena::hold()
+{
+    _live.fetch_add(1, std::memory_order_relaxed);
+}
+
+void change_arena::drop()
+{
+    _live.fetch_sub(1, std::memory_order_release);
+}
+
+bool change_arena::idle() const
+{
+    return _live.load(std::memory_order_acquire) == 0;
+}
+
+size_t change_arena::allocated() const
+{
+    return _allocated;
+}
+
+// keeps the initial buffer, overflow chunks go back to the heap
+void change_arena::reset()
+{
+    _resource.release();
+    _allocated = 0;
+}
+
+arena_pool::arena_pool(size_t arena_size):
+    _arena_size(arena_size)
+{
+}
+
+void arena_pool::set_arena_size(size_t arena_size)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    _arena_size = arena_size;
+    _free.clear();
+}
+
+change_arena* arena_pool::current()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    if(_current && _current->allocated() < _arena_size)
+        return _current.get();
+
+    if(_current)
+        _retired.push_back(std::move(_current));
+
+    for(auto it = _retired.begin(); it != _retired.end();)
+    {
+        if((*it)->idle())
+        {
+            (*it)->reset();
+            _free.push_back(std::move(*it));
+            it = _retired.erase(it);
+        }
+        else
+            ++it;
+    }
+
+    if(!_free.empty())
+    {
+        _current = std::move(_free.back());
+        _free.pop_back();
+    }
+    else
+    {
+        _current.reset(new change_arena(_arena_size));
+    }
+
+    if(_retired.size() > 8)
+        std::cout << "arena_pool: " << _retired.size() << " arenas wait for their changes to be flushed" << std::endl;
+
+    return _current.get();
+}
+
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <memory_resource>
+
+namespace psql_mongo_replication
+{
+    // Monotonic memory for the changes decoded during one window. Nothing is freed piecemeal:
+    // once the last change allocated in it is released the whole arena is reset at once.
+    class change_arena : public std::pmr::memory_resource
+    {
+        private:
+        std::unique_ptr<char[]> _buffer;
+        std::pmr::monotonic_buffer_resource _resource;
+        size_t _allocated = 0;
+        std::atomic<size_t> _live{0};
+
+        void* do_allocate(size_t bytes, size_t alignment) override;
+        void do_deallocate(void* p, size_t bytes, size_t alignment) override;
+        bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override;
+
+        public:
+        explicit change_arena(size_t size);
+
+        // Every change allocated in the arena holds it until destroyed.
+        void hold();
+        void drop();
+        bool idle() const;
+
+        size_t allocated() const;
+        void reset();
+    };
+
+    // Hands out the arena new changes go to. A full arena is retired and recycled
+    // when all of its changes were flushed, so steady state does no malloc at all.
+    class arena_pool
+    {
+        private:
+        size_t _arena_size;
+        std::unique_ptr<change_arena> _current;
+        std::vector<std::unique_ptr<change_arena>> _retired;
+        std::vector<std::unique_ptr<change_arena>> _free;
+        std::mutex _mutex;
+
+        public:
+        explicit arena_pool(size_t arena_size = 1 << 20);
+
+        void set_arena_size(size_t arena_size);
+        change_arena* current();
+    };
+}
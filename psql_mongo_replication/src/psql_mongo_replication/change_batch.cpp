@@ -0,0 +1,210 @@
+#include "psql_mongo_replication/change_batch.hpp"
+#include "psql_mongo_replication/relation_keys.hpp"
+#include "psql_mongo_replication/update_delta.hpp"
+#include <bson.h>
+
+namespace
+{
+    using psql_mongo_replication::bson_ref;
+    using psql_mongo_replication::change_t;
+
+    // columns of `newer` override those of `older`
+    bson_ref merge(const bson_t* older, const bson_t* newer)
+    {
+        bson_t* merged = bson_new();
+        bson_iter_t iter;
+
+        if(bson_iter_init(&iter, older))
+        {
+            while(bson_iter_next(&iter))
+            {
+                if(!bson_has_field(newer, bson_iter_key(&iter)))
+                    bson_append_iter(merged, NULL, 0, &iter);
+            }
+        }
+
+        bson_concat(merged, newer);
+
+        return psql_mongo_replication::make_bson_ref(merged);
+    }
+
+    // collection + '\0' + key column values
+    bool make_key(const change_t& change, const std::vector<std::string>& columns, std::string& key)
+    {
+        const bson_t* source = change.action == psql_mongo_replication::ACTION_INSERT? change.data.get(): change.clause.get();
+
+        if(source == nullptr)
+            return false;
+
+        bson_t values = BSON_INITIALIZER;
+
+        const bool found = psql_mongo_replication::relation_keys::append_columns(columns, source, &values);
+
+        if(found)
+        {
+            key = change.collection;
+            key.push_back('\0');
+            key.append((const char*)bson_get_data(&values), values.len);
+        }
+
+        bson_destroy(&values);
+
+        return found;
+    }
+}
+
+namespace psql_mongo_replication
+{
+
+bson_ref make_bson_ref(bson_t* bson)
+{
+    return bson_ref(bson, [](const bson_t* owned) { bson_destroy(const_cast<bson_t*>(owned)); });
+}
+
+void change_batch::set_idempotent(bool idempotent)
+{
+    _idempotent = idempotent;
+}
+
+void change_batch::push(change_t&& change)
+{
+    if(_pending == 0)
+        _opened = std::chrono::steady_clock::now();
+
+    _collections.insert(change.collection);
+    _changes.push_back(std::move(change));
+    _dropped.push_back(false);
+    ++_pending;
+}
+
+void change_batch::forget_collection(const std::string& collection)
+{
+    _independent = false;
+
+    for(auto it = _latest.begin(); it != _latest.end();)
+    {
+        if(it->first.compare(0, collection.size() + 1, collection.c_str(), collection.size() + 1) == 0)
+            it = _latest.erase(it);
+        else
+            ++it;
+    }
+}
+
+void change_batch::add(change_t&& change, const std::vector<std::string>* columns)
+{
+    std::string key;
+
+    const bool keyed = columns && make_key(change, *columns, key);
+
+    if(!keyed || (change.action == ACTION_UPDATE && change.data
+        && update_delta::changes_columns(change.data.get(), change.clause.get(), *columns)))
+    {
+        // may touch any document of the collection, nothing is merged across it
+        forget_collection(change.collection);
+        _unkeyed.insert(change.collection);
+        push(std::move(change));
+        return;
+    }
+
+    auto latest = _latest.find(key);
+
+    if(latest != _latest.end())
+    {
+        change_t& first = _changes[latest->second];
+
+        if((first.action == ACTION_INSERT || first.action == ACTION_UPDATE)
+            && change.action == ACTION_UPDATE && first.data && change.data)
+        {
+            first.data = merge(first.data.get(), change.data.get());
+            ++_coalesced;
+            return;
+        }
+
+        if(first.action == ACTION_INSERT && change.action == ACTION_DELETE && !_idempotent)
+        {
+            _dropped[latest->second] = true;
+            _latest.erase(latest);
+            --_pending;
+            _coalesced += 2;
+            return;
+        }
+
+        if(first.action == ACTION_UPDATE && change.action == ACTION_DELETE)
+        {
+            // the first clause still matches the document as Mongo has it
+            first.action = ACTION_DELETE;
+            first.data.reset();
+            ++_coalesced;
+            return;
+        }
+    }
+
+    if(latest != _latest.end())
+        _independent = false;
+
+    _latest[key] = _changes.size();
+    push(std::move(change));
+}
+
+size_t change_batch::size() const
+{
+    return _pending;
+}
+
+bool change_batch::independent() const
+{
+    return _independent;
+}
+
+write_set change_batch::footprint() const
+{
+    write_set footprint;
+
+    footprint.keys.reserve(_latest.size());
+
+    for(const auto& latest: _latest)
+        footprint.keys.push_back(latest.first);
+
+    footprint.collections.assign(_collections.begin(), _collections.end());
+    footprint.unkeyed.assign(_unkeyed.begin(), _unkeyed.end());
+
+    return footprint;
+}
+
+size_t change_batch::coalesced() const
+{
+    return _coalesced;
+}
+
+std::chrono::milliseconds change_batch::age() const
+{
+    if(_pending == 0)
+        return std::chrono::milliseconds(0);
+
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - _opened);
+}
+
+std::vector<change_t> change_batch::take()
+{
+    std::vector<change_t> pending;
+
+    pending.reserve(_pending);
+
+    for(size_t i = 0; i < _changes.size(); ++i)
+    {
+        if(!_dropped[i])
+            pending.push_back(std::move(_changes[i]));
+    }
+
+    _changes.clear();
+    _dropped.clear();
+    _latest.clear();
+    _collections.clear();
+    _unkeyed.clear();
+    _pending = 0;
+    _independent = true;
+
+    return pending;
+}
+
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <unordered_map>
+#include <unordered_set>
+
+struct _bson_t;
+
+namespace psql_mongo_replication
+{
+    // "a" of a decoder message. Transaction control messages carry the xid in "x" and
+    // no subscribers; a decoder that doesn't send them gets every change applied as it arrives.
+    // The stream messages frame chunks of an in-progress transaction (PostgreSQL 14+
+    // streaming), a stream abort names the aborted subtransaction in "s".
+    enum ACTION_ID
+    {
+        ACTION_INSERT,
+        ACTION_UPDATE,
+        ACTION_DELETE,
+        ACTION_BEGIN,
+        ACTION_COMMIT,
+        ACTION_STREAM_START,
+        ACTION_STREAM_STOP,
+        ACTION_STREAM_COMMIT,
+        ACTION_STREAM_ABORT,
+    };
+
+    // Immutable, refcounted bson. A change fanned out to several subscribers is encoded once
+    // and every subscriber's batch holds a reference to the same document.
+    using bson_ref = std::shared_ptr<const _bson_t>;
+
+    // Takes ownership of a heap bson_t.
+    bson_ref make_bson_ref(_bson_t* bson);
+
+    struct change_t
+    {
+        ACTION_ID action;
+        unsigned int xid = 0;
+        unsigned int subxid = 0;
+        unsigned long long lsn = 0;   // WAL position the change is resent from after a restart
+        long long send_time = 0;      // server clock, us since the Unix epoch
+        std::string collection;
+        bson_ref data;      // "d", the new tuple
+        bson_ref clause;    // "c", the key or, with REPLICA IDENTITY FULL, the old tuple
+    };
+
+    // What a window may write: the (collection, key) of its keyed changes, the collections it
+    // touches and those where an unkeyed change may hit any document.
+    struct write_set
+    {
+        std::vector<std::string> keys;
+        std::vector<std::string> collections;
+        std::vector<std::string> unkeyed;
+    };
+
+    // Changes of one subscriber collected during a flush window. Changes to the same
+    // (collection, key) are coalesced into the slot of the first one:
+    //   insert + update -> insert, update + update -> update, insert + delete -> nothing,
+    //   update + delete -> delete.
+    // Changes to different keys keep their arrival order.
+    class change_batch
+    {
+        private:
+        std::vector<change_t> _changes;
+        std::vector<bool> _dropped;
+        std::unordered_map<std::string, size_t> _latest;   // (collection, key) -> slot
+        size_t _pending = 0;
+        size_t _coalesced = 0;
+        bool _idempotent = false;
+        bool _independent = true;
+        std::unordered_set<std::string> _collections;
+        std::unordered_set<std::string> _unkeyed;
+        std::chrono::steady_clock::time_point _opened;
+
+        void push(change_t&& change);
+        void forget_collection(const std::string& collection);
+
+        public:
+        // With upsert apply an insert may be the replay of a document Mongo already has,
+        // insert + delete then keeps the delete.
+        void set_idempotent(bool idempotent);
+
+        // `columns` are the key columns of the change's relation, nullptr when unknown.
+        void add(change_t&& change, const std::vector<std::string>* columns);
+
+        size_t size() const;
+
+        // True while no two pending changes may touch the same document, so the window
+        // can be written in any order.
+        bool independent() const;
+
+        write_set footprint() const;
+        size_t coalesced() const;
+        std::chrono::milliseconds age() const;
+
+        // Hands out the pending changes in order and opens a new window.
+        std::vector<change_t> take();
+    };
+}
@@ -0,0 +1,176 @@
+#include "psql_mongo_replication/change_decoder.hpp"
+#include "psql_mongo_replication/json_to_bson.hpp"
+#include <bson.h>
+#include <cstring>
+#include "stdafx.hpp"
+
+namespace
+{
+    using psql_mongo_replication::change_arena;
+
+    // "d" and "c" of one change, allocated in an arena and shared by all subscribers
+    struct change_payload
+    {
+        change_arena* arena;
+        bson_t data = BSON_INITIALIZER;
+        bson_t clause = BSON_INITIALIZER;
+        std::shared_ptr<const void> backing;   // owner of the bytes when they aren't in the arena
+
+        explicit change_payload(change_arena* owner): arena(owner)
+        {
+            arena->hold();
+        }
+
+        ~change_payload()
+        {
+            arena->drop();
+        }
+    };
+}
+
+namespace psql_mongo_replication
+{
+
+change_decoder::change_decoder():
+      _parse_buffer(new char[parse_buffer_size])
+    , _parse_allocator(_parse_buffer.get(), parse_buffer_size)
+    , _document(&_parse_allocator)
+    , _scratch(bson_new())
+{
+}
+
+change_decoder::~change_decoder()
+{
+    bson_destroy(_scratch);
+}
+
+void change_decoder::set_arena_size(size_t size)
+{
+    _arenas.set_arena_size(size);
+}
+
+// built in the reused scratch document, then copied to the arena in one piece
+bool change_decoder::encode(const rapidjson::Value& object, change_arena* arena, bson_t* out)
+{
+    bson_reinit(_scratch);
+
+    if(!json_to_bson::append_object(object, _scratch))
+        return false;
+
+    const uint32_t length = _scratch->len;
+    void* bytes = arena->allocate(length, alignof(std::max_align_t));
+
+    std::memcpy(bytes, bson_get_data(_scratch), length);
+
+    return bson_init_static(out, (const uint8_t*)bytes, length);
+}
+
+bool change_decoder::decode(const char* changes, unsigned size, change_t& change, std::vector<int>& subscribers)
+{
+    _document.Parse(changes, size);
+
+    const bool decoded = !_document.HasParseError() && _document.IsObject() && decode_document(change, subscribers);
+
+    // everything needed was copied out, the parsed values go in one step
+    _parse_allocator.Clear();
+
+    return decoded;
+}
+
+bool change_decoder::decode_document(change_t& change, std::vector<int>& subscribers)
+{
+    rapidjson::Document& d = _document;
+
+    if (d.FindMember("a") == d.MemberEnd() || !d["a"].IsInt() || d["a"].GetInt() < ACTION_INSERT)
+        return false;
+
+    change.action = (ACTION_ID)d["a"].GetInt();
+
+    // "x" is the xid of the transaction, or in a stream the subtransaction, the message belongs to
+    const rapidjson::Value::ConstMemberIterator xid = d.FindMember("x");
+
+    change.xid = xid != d.MemberEnd() && xid->value.IsUint()? xid->value.GetUint(): 0;
+
+    if (change.action >= ACTION_BEGIN)
+    {
+        const rapidjson::Value::ConstMemberIterator subxid = d.FindMember("s");
+
+        change.subxid = subxid != d.MemberEnd() && subxid->value.IsUint()? subxid->value.GetUint(): change.xid;
+        change.collection.clear();
+        change.data = nullptr;
+        change.clause = nullptr;
+        subscribers.clear();
+
+        return change.action <= ACTION_STREAM_ABORT;
+    }
+
+    const rapidjson::Value::ConstMemberIterator r = d.FindMember("r");
+
+    if (r == d.MemberEnd() || !r->value.IsString())
+        return false;
+
+    const char* relation = r->value.GetString();
+    const char* dot = std::strchr(relation, '.');
+
+    change.collection.assign(dot? dot + 1: relation);
+
+    const bool is_d_field_pressent = d.FindMember("d") != d.MemberEnd();
+
+    const bool is_c_field_pressent = d.FindMember("c") != d.MemberEnd();
+
+    const bool needs_data = change.action != ACTION_DELETE;
+    const bool needs_clause = change.action != ACTION_INSERT;
+
+    if (needs_data && !(is_d_field_pressent && d["d"].IsObject()))
+        return false;
+
+    if (needs_clause && !is_c_field_pressent)
+    {
+        std::cout << "in Document no [c]" << std::endl;
+        return false;
+    }
+
+    change_arena* arena = _arenas.current();
+
+    auto payload = std::allocate_shared<change_payload>(std::pmr::polymorphic_allocator<change_payload>(arena), arena);
+
+    if (needs_data && !encode(d["d"], arena, &payload->data))
+        return false;
+
+    if (needs_clause && !encode(d["c"], arena, &payload->clause))
+        return false;
+
+    // aliasing references, the payload lives as long as any subscriber holds one
+    change.data = needs_data? bson_ref(payload, &payload->data): nullptr;
+    change.clause = needs_clause? bson_ref(payload, &payload->clause): nullptr;
+
+    subscribers.clear();
+
+    if (d.FindMember("subsribers") != d.MemberEnd() && d["subsribers"].IsArray())
+    {
+        const rapidjson::Value& ids = d["subsribers"];
+
+        for (rapidjson::SizeType i = 0; i < ids.Size(); i++)
+            subscribers.push_back(ids[i].GetInt());
+    }
+
+    return true;
+}
+
+void change_decoder::attach(
+      change_t& change
+    , std::shared_ptr<const void> backing
+    , const uint8_t* data, uint32_t data_length
+    , const uint8_t* clause, uint32_t clause_length)
+{
+    change_arena* arena = _arenas.current();
+
+    auto payload = std::allocate_shared<change_payload>(std::pmr::polymorphic_allocator<change_payload>(arena), arena);
+
+    payload->backing = std::move(backing);
+
+    change.data = data && bson_init_static(&payload->data, data, data_length)? bson_ref(payload, &payload->data): nullptr;
+    change.clause = clause && bson_init_static(&payload->clause, clause, clause_length)? bson_ref(payload, &payload->clause): nullptr;
+}
+
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include "psql_mongo_replication/change_batch.hpp"
+#include "psql_mongo_replication/change_arena.hpp"
+#include "rapidjson/document.h"
+
+namespace psql_mongo_replication
+{
+    // Turns one decoder_json message into a change and the ids of its subscribers.
+    // The parse state is reused from message to message and the converted change lives
+    // in the current arena, so decoding does not touch the heap in steady state.
+    class change_decoder
+    {
+        private:
+        static constexpr size_t parse_buffer_size = 64 * 1024;
+
+        std::unique_ptr<char[]> _parse_buffer;
+        rapidjson::MemoryPoolAllocator<> _parse_allocator;
+        rapidjson::Document _document;
+        _bson_t* _scratch;
+        arena_pool _arenas;
+
+        bool encode(const rapidjson::Value& object, change_arena* arena, _bson_t* out);
+        bool decode_document(change_t& change, std::vector<int>& subscribers);
+
+        public:
+        change_decoder();
+        ~change_decoder();
+
+        void set_arena_size(size_t size);
+        bool decode(const char* changes, unsigned size, change_t& change, std::vector<int>& subscribers);
+
+        // Points the documents of `change` at bson already encoded elsewhere (a staged
+        // transaction, a mapped segment); `backing` is kept alive as long as the change.
+        void attach(
+              change_t& change
+            , std::shared_ptr<const void> backing
+            , const uint8_t* data, uint32_t data_length
+            , const uint8_t* clause, uint32_t clause_length);
+    };
+}
@@ -0,0 +1,346 @@
+#include "psql_mongo_replication/dump_sink.hpp"
+#include "psql_mongo_replication/options.hpp"
+#include <bson.h>
+#include <zlib.h>
+#include <cstring>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "stdafx.hpp"
+
+namespace
+{
+    // fsync of a file, or a directory for the entries in it
+    bool sync_path(const std::string& path)
+    {
+        const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+        if(fd == -1)
+            return false;
+
+        const bool synced = ::fsync(fd) == 0;
+
+        ::close(fd);
+
+        return synced;
+    }
+
+    std::string parent(const std::string& path)
+    {
+        const size_t slash = path.rfind('/');
+
+        return slash == std::string::npos? ".": slash == 0? "/": path.substr(0, slash);
+    }
+
+    // mkdir -p, a directory created is synced into its parent
+    bool make_directories(const std::string& path)
+    {
+        for(size_t slash = path.find('/', 1); ; slash = path.find('/', slash + 1))
+        {
+            const std::string directory = path.substr(0, slash);
+
+            if(::mkdir(directory.c_str(), 0700) == 0)
+            {
+                if(!sync_path(parent(directory)))
+                {
+                    std::cout << "dump_sink: can't sync " << parent(directory) << ": " << strerror(errno) << std::endl;
+                    return false;
+                }
+            }
+            else if(errno != EEXIST)
+            {
+                std::cout << "dump_sink: can't create " << directory << ": " << strerror(errno) << std::endl;
+                return false;
+            }
+
+            if(slash == std::string::npos)
+                return true;
+        }
+    }
+}
+
+namespace psql_mongo_replication
+{
+
+dump_sink::dump_sink(unsigned int id, const std::string& directory, const std::string& db_name):
+      sink(id)
+    , _directory(directory + "/subscriber-" + std::to_string(id))
+    , _db_name(db_name)
+{
+    std::cout << "dump_sink[" << _id << "] dumps to " << _directory << std::endl;
+}
+
+dump_sink::~dump_sink()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    for(auto& file: _files)
+        close(*file.second);
+}
+
+bool dump_sink::connected()
+{
+    return true;
+}
+
+dump_sink::file_t& dump_sink::file(const std::string& collection)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    std::unique_ptr<file_t>& file = _files[collection];
+
+    if(!file)
+        file.reset(new file_t());
+
+    return *file;
+}
+
+bool dump_sink::open(file_t& file, const std::string& collection)
+{
+    char part[16];
+
+    snprintf(part, sizeof(part), "part-%06u", file.part);
+
+    const std::string directory = _directory + "/" + part + "/" + _db_name;
+
+    if(!make_directories(directory))
+    {
+        file.failed = true;
+        return false;
+    }
+
+    file.path = directory + "/" + collection + (_compression > 0? ".bson.gz": ".bson");
+
+    // "T" writes through zlib without a gzip wrapper
+    const std::string mode = _compression > 0? "wb" + std::to_string(std::min(_compression, 9)): "wbT";
+
+    file.fd = ::open(file.path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    file.gz = file.fd != -1 && sync_path(directory)? gzdopen(file.fd, mode.c_str()): nullptr;
+
+    if(file.gz == nullptr)
+    {
+        std::cout << "dump_sink[" << _id << "]: can't open " << file.path << ": " << strerror(errno) << std::endl;
+
+        if(file.fd != -1)
+            ::close(file.fd);
+
+        file.fd = -1;
+        file.failed = true;
+        return false;
+    }
+
+    gzbuffer(file.gz, gz_buffer_size);
+
+    file.written = 0;
+
+    return true;
+}
+
+void dump_sink::close(file_t& file)
+{
+    if(file.gz == nullptr)
+        return;
+
+    // gzclose writes the end of the stream and closes the descriptor, the sync reopens it
+    if(gzclose(file.gz) != Z_OK || !sync_path(file.path))
+    {
+        std::cout << "dump_sink[" << _id << "]: closing part " << file.part << " failed" << std::endl;
+        file.failed = true;
+    }
+
+    file.gz = nullptr;
+    file.fd = -1;
+}
+
+// Keyed like mongo_replication::insert() keys it, so a restore matches what streaming writes.
+bool dump_sink::write(file_t& file, const std::string& collection, const bson_t* document)
+{
+    if(file.gz && _rotate_bytes > 0 && file.written >= _rotate_bytes)
+    {
+        close(file);
+        ++file.part;
+    }
+
+    if(file.gz == nullptr && !open(file, collection))
+        return false;
+
+    const std::vector<std::string>* columns = _id_mapping? _keys.find(collection): nullptr;
+
+    bson_t keyed = BSON_INITIALIZER;
+
+    if(columns && relation_keys::append_key(*columns, document, &keyed, "_id"))
+    {
+        bson_copy_to_excluding_noinit (document, &keyed, "_id", NULL);
+        document = &keyed;
+    }
+
+    const bool written = gzwrite(file.gz, bson_get_data(document), document->len) == (int)document->len;
+
+    file.written += document->len;
+
+    bson_destroy(&keyed);
+
+    if(!written)
+    {
+        int error = 0;
+
+        std::cout << "dump_sink[" << _id << "]: write to " << collection << " failed: " << gzerror(file.gz, &error) << std::endl;
+        file.failed = true;
+    }
+
+    return written;
+}
+
+void dump_sink::enqueue(change_t change)
+{
+    if(change.action != ACTION_INSERT || !change.data)
+    {
+        if(_refused_lsn == 0)
+        {
+            std::cout << "dump_sink[" << _id << "]: a dump takes inserts only, refusing a change to " << change.collection
+                      << " at " << std::hex << change.lsn << std::dec << std::endl;
+
+            _refused_lsn = change.lsn;
+        }
+
+        if(_metrics)
+            _metrics->errors.fetch_add(1, std::memory_order_relaxed);
+
+        return;
+    }
+
+    if(_pending_changes == 0)
+    {
+        _pending_lsn = change.lsn;
+        _opened = std::chrono::steady_clock::now();
+    }
+
+    ++_pending_changes;
+
+    file_t& target = file(change.collection);
+
+    std::lock_guard<std::mutex> lock(target.mutex);
+
+    const bool written = write(target, change.collection, change.data.get());
+
+    if(_metrics == nullptr)
+        return;
+
+    if(written)
+        _metrics->applied.add(1, change.data->len);
+    else
+        _metrics->errors.fetch_add(1, std::memory_order_relaxed);
+}
+
+void dump_sink::flush_if_due()
+{
+    if(_pending_changes > 0 && std::chrono::steady_clock::now() - _opened >= _window)
+        flush();
+}
+
+// A sync flush and an fdatasync per window cost a little ratio, documents confirmed to the
+// slot are on disk. Once a file failed the dump has a hole: the window stays pending and nothing past it is
+// confirmed, so the changes are streamed again after a restart.
+void dump_sink::flush()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    bool failed = false;
+
+    for(auto& file: _files)
+    {
+        std::lock_guard<std::mutex> file_lock(file.second->mutex);
+
+        if(file.second->gz && (gzflush(file.second->gz, Z_SYNC_FLUSH) != Z_OK || ::fdatasync(file.second->fd) != 0))
+            file.second->failed = true;
+
+        failed = failed || file.second->failed;
+    }
+
+    if(failed)
+    {
+        if(!_failure_reported)
+            std::cout << "dump_sink[" << _id << "]: a dump file failed, holding the position at " << std::hex << _pending_lsn << std::dec << std::endl;
+
+        _failure_reported = true;
+        return;
+    }
+
+    if(_metrics && _pending_changes > 0)
+        _metrics->batches.fetch_add(1, std::memory_order_relaxed);
+
+    _pending_lsn = 0;
+    _pending_changes = 0;
+}
+
+bool dump_sink::set_option(const std::string& name, const std::string& value)
+{
+    std::string relation;
+    unsigned long long number = 0;
+
+    if(name == "compression" && options::parse_unsigned(value, number) && number <= 9)
+    {
+        _compression = number;
+        return true;
+    }
+
+    if(name == "rotate_mb" && options::parse_unsigned(value, number))
+    {
+        _rotate_bytes = number << 20;
+        return true;
+    }
+
+    if(name == "batch_window_ms" && options::parse_unsigned(value, number))
+    {
+        _window = std::chrono::milliseconds(number);
+        return true;
+    }
+
+    if(name == "id_mapping")
+        return options::parse_bool(value, _id_mapping);
+
+    if(options::strip_prefix(name, "key_columns.", relation))
+    {
+        _keys.set(relation, relation_keys::parse_columns(value));
+        return true;
+    }
+
+    return false;
+}
+
+// a refused change holds the position before it, the stream stops there
+unsigned long long dump_sink::pending_lsn() const
+{
+    return _refused_lsn != 0 && (_pending_lsn == 0 || _refused_lsn < _pending_lsn)? _refused_lsn: _pending_lsn;
+}
+
+bool dump_sink::failed() const
+{
+    return _refused_lsn != 0;
+}
+
+bool dump_sink::load(const std::string& collectionName, bson_t* const* documents, size_t count)
+{
+    file_t& target = file(collectionName);
+
+    std::lock_guard<std::mutex> lock(target.mutex);
+
+    uint64_t bytes = 0;
+    bool ok = true;
+
+    for(size_t i = 0; i < count && ok; ++i)
+    {
+        ok = write(target, collectionName, documents[i]);
+        bytes += documents[i]->len;
+    }
+
+    if(_metrics && ok)
+        _metrics->applied.add(count, bytes);
+
+    return ok;
+}
+
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "psql_mongo_replication/sink.hpp"
+#include "psql_mongo_replication/relation_keys.hpp"
+#include <map>
+#include <memory>
+#include <mutex>
+#include <chrono>
+
+struct gzFile_s;
+
+namespace psql_mongo_replication
+{
+    // Writes documents the way mongodump lays them out, for mongorestore to bulk load:
+    //   <directory>/subscriber-<id>/part-<n>/<db>/<collection>.bson[.gz]
+    // A collection file that reaches the rotation size is closed and the collection goes
+    // on in the next part, so every part is a complete dump directory of its own that can
+    // be restored, or shipped, independently.
+    // Documents are keyed like mongo_replication keys them (id_mapping, key_columns.*).
+    // A dump holds documents, not operations: it takes the initial sync and inserts. An
+    // update or delete can't be written, it fails the stream rather than be confirmed past.
+    // Files are synced before a window counts as written.
+    class dump_sink: public sink
+    {
+        private:
+        struct file_t
+        {
+            std::mutex mutex;       // loaders write different collections in parallel
+            gzFile_s* gz = nullptr;
+            int fd = -1;            // the file gz writes, for fdatasync
+            std::string path;
+            unsigned part = 0;
+            unsigned long long written = 0;
+            bool failed = false;
+        };
+
+        std::string _directory;
+        std::string _db_name;
+        int _compression = 0;                   // gzip level, 0 writes plain .bson
+        unsigned long long _rotate_bytes = 0;   // 0 never rotates
+        bool _id_mapping = false;
+        relation_keys _keys;
+        std::chrono::milliseconds _window{1000};
+        std::chrono::steady_clock::time_point _opened;
+        unsigned long long _pending_lsn = 0;
+        size_t _pending_changes = 0;
+        unsigned long long _refused_lsn = 0;   // first update or delete, see failed()
+        bool _failure_reported = false;
+        std::mutex _mutex;      // the map of files
+        std::map<std::string, std::unique_ptr<file_t>> _files;
+
+        file_t& file(const std::string& collection);
+        bool open(file_t& file, const std::string& collection);
+        bool write(file_t& file, const std::string& collection, const _bson_t* document);
+        void close(file_t& file);
+
+        public:
+        static constexpr size_t gz_buffer_size = 1 << 20;
+
+        dump_sink(unsigned int id, const std::string& directory, const std::string& db_name);
+        ~dump_sink();
+
+        bool connected() override;
+        void enqueue(change_t change) override;
+        void flush_if_due() override;
+        void flush() override;
+
+        // compression      0-9    gzip level, mongorestore --gzip reads the files
+        // rotate_mb        n      start the next part once a collection file is this large
+        // batch_window_ms  n      longest a document stays buffered
+        // id_mapping       on|off key columns become the document _id
+        // key_columns.<relation> a,b,...
+        bool set_option(const std::string& name, const std::string& value) override;
+        unsigned long long pending_lsn() const override;
+        bool failed() const override;
+        bool load(const std::string& collectionName, _bson_t* const* documents, size_t count) override;
+    };
+}
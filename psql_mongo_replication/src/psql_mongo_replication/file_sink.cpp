@@ -0,0 +1,212 @@
+#include "psql_mongo_replication/file_sink.hpp"
+#include "psql_mongo_replication/options.hpp"
+#include <bson.h>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "stdafx.hpp"
+
+namespace psql_mongo_replication
+{
+
+file_sink::file_sink(unsigned int id, const std::string& directory):
+      sink(id)
+    , _directory(directory)
+{
+    _buffer.reserve(buffer_size);
+
+    open();
+}
+
+file_sink::~file_sink()
+{
+    flush();
+
+    if(_fd != -1)
+        ::close(_fd);
+}
+
+bool file_sink::open()
+{
+    if(::mkdir(_directory.c_str(), 0700) != 0 && errno != EEXIST)
+    {
+        std::cout << "file_sink[" << _id << "]: can't create " << _directory << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    const std::string path = _directory + "/subscriber-" + std::to_string(_id) + ".bson";
+
+    _fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+
+    if(_fd == -1)
+    {
+        std::cout << "file_sink[" << _id << "]: can't open " << path << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    std::cout << "file_sink[" << _id << "] writes to " << path << std::endl;
+
+    return true;
+}
+
+bool file_sink::connected()
+{
+    return _fd != -1;
+}
+
+void file_sink::append(int action, const std::string& collection, unsigned long long lsn, long long send_time,
+    const bson_t* data, const bson_t* clause)
+{
+    bson_t record = BSON_INITIALIZER;
+
+    bson_append_int32(&record, "a", -1, action);
+    bson_append_utf8(&record, "n", -1, collection.c_str(), collection.size());
+    bson_append_int64(&record, "l", -1, lsn);
+    bson_append_int64(&record, "t", -1, send_time);
+
+    if(data)
+        bson_append_document(&record, "d", -1, data);
+
+    if(clause)
+        bson_append_document(&record, "c", -1, clause);
+
+    const uint8_t* bytes = bson_get_data(&record);
+
+    _buffer.insert(_buffer.end(), bytes, bytes + record.len);
+
+    bson_destroy(&record);
+}
+
+void file_sink::enqueue(change_t change)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    if(_pending_changes == 0)
+    {
+        _pending_lsn = change.lsn;
+        _opened = std::chrono::steady_clock::now();
+    }
+
+    append(change.action, change.collection, change.lsn, change.send_time, change.data.get(), change.clause.get());
+
+    ++_pending_changes;
+
+    if(_metrics)
+        _metrics->applied.add(1, (change.data? change.data->len: 0) + (change.clause? change.clause->len: 0));
+
+    if(_buffer.size() >= buffer_size)
+        write_buffer();
+}
+
+void file_sink::flush_if_due()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    if(_pending_changes > 0 && std::chrono::steady_clock::now() - _opened >= _window)
+        write_buffer();
+}
+
+void file_sink::flush()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    write_buffer();
+}
+
+// A failed write keeps what didn't reach the file and the position pending, so nothing
+// past it is confirmed; the next flush tries again.
+bool file_sink::write_buffer()
+{
+    const uint8_t* data = _buffer.data();
+    size_t left = _buffer.size();
+    bool ok = _fd != -1;
+
+    while(ok && left > 0)
+    {
+        const ssize_t written = ::write(_fd, data, left);
+
+        if(written < 0 && errno == EINTR)
+            continue;
+
+        if(written < 0)
+        {
+            std::cout << "file_sink[" << _id << "]: write failed: " << strerror(errno) << std::endl;
+            ok = false;
+            break;
+        }
+
+        data += written;
+        left -= written;
+    }
+
+    _buffer.erase(_buffer.begin(), _buffer.begin() + (_buffer.size() - left));
+
+    if(ok && _fsync && _pending_changes > 0 && ::fdatasync(_fd) != 0)
+    {
+        std::cout << "file_sink[" << _id << "]: fdatasync failed: " << strerror(errno) << std::endl;
+        ok = false;
+    }
+
+    if(_metrics && _pending_changes > 0)
+    {
+        _metrics->batches.fetch_add(1, std::memory_order_relaxed);
+
+        if(!ok)
+            _metrics->errors.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    if(!ok)
+        return false;
+
+    _pending_lsn = 0;
+    _pending_changes = 0;
+
+    return true;
+}
+
+bool file_sink::set_option(const std::string& name, const std::string& value)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    unsigned long long number = 0;
+
+    if(name == "batch_window_ms" && options::parse_unsigned(value, number))
+    {
+        _window = std::chrono::milliseconds(number);
+        return true;
+    }
+
+    if(name == "fsync")
+        return options::parse_bool(value, _fsync);
+
+    return false;
+}
+
+unsigned long long file_sink::pending_lsn() const
+{
+    return _pending_lsn;
+}
+
+bool file_sink::load(const std::string& collectionName, bson_t* const* documents, size_t count)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    uint64_t bytes = 0;
+
+    for(size_t i = 0; i < count; ++i)
+    {
+        append(ACTION_INSERT, collectionName, 0, 0, documents[i], nullptr);
+        bytes += documents[i]->len;
+    }
+
+    _pending_changes += count;
+
+    if(_metrics)
+        _metrics->applied.add(count, bytes);
+
+    return write_buffer();
+}
+
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "psql_mongo_replication/sink.hpp"
+#include <mutex>
+#include <chrono>
+#include <vector>
+#include <cstdint>
+
+namespace psql_mongo_replication
+{
+    // Appends every change to <directory>/subscriber-<id>.bson as one document
+    //   { a: action, n: collection, l: lsn, t: send time, d: new tuple, c: clause }
+    // a stream bsondump reads as is. A change counts as written once its buffer reaches
+    // the file, and with fsync once it is synced. Without fsync, confirms are not durable:
+    // the slot moves past changes still in the page cache, which a crash of the host loses.
+    class file_sink: public sink
+    {
+        private:
+        std::string _directory;
+        int _fd = -1;
+        bool _fsync = false;
+        std::vector<uint8_t> _buffer;
+        std::chrono::milliseconds _window{100};
+        std::chrono::steady_clock::time_point _opened;
+        unsigned long long _pending_lsn = 0;
+        size_t _pending_changes = 0;
+        std::mutex _mutex;      // loaders of the initial sync append from several threads
+
+        bool open();
+        void append(int action, const std::string& collection, unsigned long long lsn, long long send_time,
+            const _bson_t* data, const _bson_t* clause);
+        bool write_buffer();
+
+        public:
+        static constexpr size_t buffer_size = 1 << 20;
+
+        file_sink(unsigned int id, const std::string& directory);
+        ~file_sink();
+
+        bool connected() override;
+        void enqueue(change_t change) override;
+        void flush_if_due() override;
+        void flush() override;
+
+        // batch_window_ms  n      longest a change stays buffered
+        // fsync            on|off sync the file on every flush, before the changes count as written
+        bool set_option(const std::string& name, const std::string& value) override;
+        unsigned long long pending_lsn() const override;
+        bool load(const std::string& collectionName, _bson_t* const* documents, size_t count) override;
+    };
+}
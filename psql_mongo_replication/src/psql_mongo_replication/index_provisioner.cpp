@@ -0,0 +1,277 @@
+#include "psql_mongo_replication/index_provisioner.hpp"
+#include <mongoc.h>
+#include <chrono>
+#include "stdafx.hpp"
+
+namespace psql_mongo_replication
+{
+
+index_provisioner::~index_provisioner()
+{
+    wait();
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+
+    _changed.notify_all();
+
+    for(std::thread& builder: _builders)
+        builder.join();
+}
+
+bool index_provisioner::wait()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    _changed.wait(lock, [this]() { return _queue.empty() && _busy == 0; });
+
+    const bool built = _unbuilt == 0;
+
+    _unbuilt = 0;
+
+    return built;
+}
+
+bool index_provisioner::set_policy(const std::string& policy)
+{
+    if(policy == "off")
+        _policy = POLICY_OFF;
+    else if(policy == "foreground")
+        _policy = POLICY_FOREGROUND;
+    else if(policy == "background")
+        _policy = POLICY_BACKGROUND;
+    else
+        return false;
+
+    return true;
+}
+
+// neither built nor being built, and not failed within the retry interval
+bool index_provisioner::due(const std::string& collection) const
+{
+    if(_built.count(collection) || _building.count(collection))
+        return false;
+
+    const auto failed = _retry_at.find(collection);
+
+    return failed == _retry_at.end() || std::chrono::steady_clock::now() >= failed->second;
+}
+
+void index_provisioner::ensure(
+      mongoc_client_t* client
+    , const mongoc_uri_t* uri
+    , const std::string& db_name
+    , const std::string& collection
+    , const std::vector<std::string>& columns)
+{
+    if(_policy == POLICY_OFF || columns.empty())
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        if(_deferred)
+        {
+            _pending.emplace(collection, columns);
+            return;
+        }
+
+        if(!due(collection))
+            return;
+
+        _building.insert(collection);
+
+        if(_policy == POLICY_BACKGROUND && uri)
+        {
+            queue({uri, db_name, collection, columns, false});
+            return;
+        }
+    }
+
+    const bool built = build(client, db_name, collection, columns);
+
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    finished(collection, built, false);
+}
+
+void index_provisioner::defer()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    _deferred = true;
+}
+
+// Nothing reads the collections yet, so the builds don't need to yield to writes. Without
+// a uri there is no connection to build them on, they count as failed.
+void index_provisioner::build_deferred(const mongoc_uri_t* uri, const std::string& db_name)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    _deferred = false;
+
+    for(auto& collection: _pending)
+    {
+        if(!due(collection.first))
+            continue;
+
+        if(uri == nullptr)
+        {
+            std::cout << "index " << index_name << " on " << collection.first << " failed: no connection" << std::endl;
+
+            ++_stats.failed;
+            finished(collection.first, false, true);
+            continue;
+        }
+
+        _building.insert(collection.first);
+
+        queue({uri, db_name, collection.first, std::move(collection.second), true});
+    }
+
+    _pending.clear();
+}
+
+// With _mutex held. Builders are started as builds are queued, up to max_builders.
+void index_provisioner::queue(build_t build)
+{
+    _queue.push_back(std::move(build));
+
+    if(_builders.size() < max_builders && _builders.size() < _busy + _queue.size())
+        _builders.emplace_back(&index_provisioner::work, this);
+
+    _changed.notify_all();
+}
+
+// With _mutex held.
+void index_provisioner::finished(const std::string& collection, bool built, bool deferred)
+{
+    _building.erase(collection);
+
+    if(built)
+    {
+        _built.insert(collection);
+        _retry_at.erase(collection);
+        return;
+    }
+
+    _retry_at[collection] = std::chrono::steady_clock::now() + retry_interval;
+
+    if(deferred)
+        ++_unbuilt;
+}
+
+// mongoc clients are not thread safe, each builder has its own for all its builds
+void index_provisioner::work()
+{
+    mongoc_client_t* client = nullptr;
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    for(;;)
+    {
+        _changed.wait(lock, [this]() { return _stop || !_queue.empty(); });
+
+        if(_queue.empty())
+            break;
+
+        build_t next = std::move(_queue.front());
+
+        _queue.pop_front();
+        ++_busy;
+
+        lock.unlock();
+
+        if(client == nullptr)
+            client = mongoc_client_new_from_uri(next.uri);
+
+        const bool built = client && build(client, next.db_name, next.collection, next.columns);
+
+        lock.lock();
+
+        if(client == nullptr)
+        {
+            std::cout << "index " << index_name << " on " << next.collection << " failed: no connection" << std::endl;
+            ++_stats.failed;
+        }
+
+        --_busy;
+        finished(next.collection, built, next.deferred);
+
+        _changed.notify_all();
+    }
+
+    lock.unlock();
+
+    if(client)
+        mongoc_client_destroy(client);
+}
+
+bool index_provisioner::build(mongoc_client_t* client, const std::string& db_name, const std::string& collection, const std::vector<std::string>& columns)
+{
+    bson_t command = BSON_INITIALIZER;
+    bson_t indexes, index, keys;
+    bson_t reply;
+    bson_error_t error;
+
+    bson_append_utf8(&command, "createIndexes", -1, collection.c_str(), -1);
+    bson_append_array_begin(&command, "indexes", -1, &indexes);
+    bson_append_document_begin(&indexes, "0", -1, &index);
+    bson_append_document_begin(&index, "key", -1, &keys);
+
+    for(const std::string& column: columns)
+        bson_append_int32(&keys, column.c_str(), -1, 1);
+
+    bson_append_document_end(&index, &keys);
+    bson_append_utf8(&index, "name", -1, index_name, -1);
+    bson_append_document_end(&indexes, &index);
+    bson_append_array_end(&command, &indexes);
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        ++_stats.requested;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+
+    mongoc_database_t* database = mongoc_client_get_database(client, db_name.c_str());
+
+    const bool created = mongoc_database_write_command_with_opts(database, &command, NULL, &reply, &error);
+
+    const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    if(created)
+    {
+        ++_stats.created;
+        _stats.build_ms += elapsed;
+
+        std::cout << "index " << index_name << " on " << collection << " built in " << elapsed << " ms" << std::endl;
+    }
+    else
+    {
+        ++_stats.failed;
+
+        std::cout << "index " << index_name << " on " << collection << " failed: " << error.message << std::endl;
+    }
+
+    std::cout << "index stats: requested " << _stats.requested << ", created " << _stats.created
+              << ", failed " << _stats.failed << ", build " << _stats.build_ms << " ms" << std::endl;
+
+    bson_destroy(&reply);
+    bson_destroy(&command);
+    mongoc_database_destroy(database);
+
+    return created;
+}
+
+index_provisioner::stats_t index_provisioner::stats()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    return _stats;
+}
+
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <unordered_set>
+#include <unordered_map>
+
+struct _mongoc_uri_t;
+struct _mongoc_client_t;
+
+namespace psql_mongo_replication
+{
+    // Creates the index over a relation's key columns the first time the relation is seen,
+    // so "c" clause filters don't turn into collection scans. A relation counts as indexed
+    // once createIndexes succeeded; a failed build is tried again after retry_interval.
+    class index_provisioner
+    {
+        public:
+        enum POLICY
+        {
+            POLICY_OFF,
+            POLICY_FOREGROUND,  // build before the change that discovered the relation is applied
+            POLICY_BACKGROUND,  // build on a builder's connection, apply continues meanwhile
+        };
+
+        struct stats_t
+        {
+            unsigned requested = 0;
+            unsigned created = 0;
+            unsigned failed = 0;
+            unsigned long long build_ms = 0;
+        };
+
+        static constexpr const char* index_name = "psql_to_mongo_key";
+        static constexpr unsigned max_builders = 4;
+        static constexpr std::chrono::seconds retry_interval{60};
+
+        private:
+        struct build_t
+        {
+            const _mongoc_uri_t* uri;
+            std::string db_name;
+            std::string collection;
+            std::vector<std::string> columns;
+            bool deferred;
+        };
+
+        POLICY _policy = POLICY_BACKGROUND;
+        std::unordered_set<std::string> _built;
+        std::unordered_set<std::string> _building;      // queued or being built
+        std::unordered_map<std::string, std::chrono::steady_clock::time_point> _retry_at;   // failed builds
+        bool _deferred = false;
+        std::unordered_map<std::string, std::vector<std::string>> _pending;   // collection -> key columns, while deferred
+        unsigned _unbuilt = 0;      // deferred builds that failed since the last wait()
+        std::deque<build_t> _queue;
+        unsigned _busy = 0;         // builds taken from the queue and not done
+        bool _stop = false;
+        std::vector<std::thread> _builders;
+        std::mutex _mutex;
+        std::condition_variable _changed;
+        stats_t _stats;
+
+        bool due(const std::string& collection) const;
+        void queue(build_t build);
+        void finished(const std::string& collection, bool built, bool deferred);
+        void work();
+        bool build(_mongoc_client_t* client, const std::string& db_name, const std::string& collection, const std::vector<std::string>& columns);
+
+        public:
+        ~index_provisioner();
+
+        bool set_policy(const std::string& policy);
+
+        // Returns once every queued build is done; false when a deferred build failed since
+        // the last call.
+        bool wait();
+
+        // Bulk loading into empty collections: ensure() only records what to build, from any
+        // thread, until build_deferred() queues it all at once for the builders.
+        void defer();
+        void build_deferred(const _mongoc_uri_t* uri, const std::string& db_name);
+        void ensure(
+              _mongoc_client_t* client
+            , const _mongoc_uri_t* uri
+            , const std::string& db_name
+            , const std::string& collection
+            , const std::vector<std::string>& columns);
+        stats_t stats();
+    };
+}
@@ -0,0 +1,80 @@
+#include "psql_mongo_replication/json_to_bson.hpp"
+#include <bson.h>
+#include <cstdio>
+
+namespace
+{
+    bool append_value(bson_t* out, const char* key, int key_length, const rapidjson::Value& value);
+
+    bool append_array(bson_t* out, const rapidjson::Value& array)
+    {
+        char index[16];
+
+        for(rapidjson::SizeType i = 0; i < array.Size(); ++i)
+        {
+            const int length = snprintf(index, sizeof(index), "%u", i);
+
+            if(!append_value(out, index, length, array[i]))
+                return false;
+        }
+
+        return true;
+    }
+
+    bool append_value(bson_t* out, const char* key, int key_length, const rapidjson::Value& value)
+    {
+        switch(value.GetType())
+        {
+            case rapidjson::kNullType:
+                return bson_append_null(out, key, key_length);
+            case rapidjson::kFalseType:
+            case rapidjson::kTrueType:
+                return bson_append_bool(out, key, key_length, value.GetBool());
+            case rapidjson::kStringType:
+                return bson_append_utf8(out, key, key_length, value.GetString(), value.GetStringLength());
+            case rapidjson::kNumberType:
+                if(value.IsInt())
+                    return bson_append_int32(out, key, key_length, value.GetInt());
+                if(value.IsInt64())
+                    return bson_append_int64(out, key, key_length, value.GetInt64());
+                return bson_append_double(out, key, key_length, value.GetDouble());
+            case rapidjson::kObjectType:
+            {
+                bson_t child;
+
+                return bson_append_document_begin(out, key, key_length, &child)
+                    && psql_mongo_replication::json_to_bson::append_object(value, &child)
+                    && bson_append_document_end(out, &child);
+            }
+            case rapidjson::kArrayType:
+            {
+                bson_t child;
+
+                return bson_append_array_begin(out, key, key_length, &child)
+                    && append_array(&child, value)
+                    && bson_append_array_end(out, &child);
+            }
+        }
+
+        return false;
+    }
+}
+
+namespace psql_mongo_replication
+{
+namespace json_to_bson
+{
+
+bool append_object(const rapidjson::Value& object, bson_t* out)
+{
+    for(auto member = object.MemberBegin(); member != object.MemberEnd(); ++member)
+    {
+        if(!append_value(out, member->name.GetString(), member->name.GetStringLength(), member->value))
+            return false;
+    }
+
+    return true;
+}
+
+}
+}
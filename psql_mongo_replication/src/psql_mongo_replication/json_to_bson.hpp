@@ -0,0 +1,15 @@
+#pragma once
+
+#include "rapidjson/document.h"
+
+struct _bson_t;
+
+namespace psql_mongo_replication
+{
+    namespace json_to_bson
+    {
+        // Appends the members of a parsed JSON object to `out` without a text round trip.
+        // Integers keep the narrowest of int32/int64, like bson_new_from_json.
+        bool append_object(const rapidjson::Value& object, _bson_t* out);
+    }
+}
@@ -1,256 +1,688 @@
-#include "psql_mongo_replication/mongo_replication.hpp"
-#include "pg_recvlogical/pg_recvlogical.h"
-#include <mongoc.h>
-#include "stdafx.hpp"
-namespace
-{
-static void print_bson (const bson_t *b)
-{
-   char *str;
-
-   str = bson_as_canonical_extended_json (b, NULL);
-   fprintf (stdout, "%s\n", str);
-   bson_free (str);
-}
-
-// find()
-// {
-//     mongoc_cursor_t *cursor = mongoc_collection_find_with_opts (collection, filter, NULL, NULL);
-
-//     if(mongoc_cursor_error (cursor, &error))
-//     {
-//         std::cout << error.message << std::endl;
-//         return;
-//     }
-
-//     const bson_t *doc;
-
-//     mongoc_cursor_next (cursor, &doc);
-
-//     print_bson (doc);
-
-//     bson_oid_t oid;
-
-//    bson_iter_t iter;
-
-//     if (bson_iter_init (&iter, doc)) 
-//     {
-//         const bson_value_t *value;
-
-//         value = bson_iter_value (&iter);
-
-//         if(value->value_type == BSON_TYPE_OID);
-//             oid = value->value.v_oid;
-//     }
-// }
-
-int mongo_test (mongoc_client_t* client, const std::string& db_name)
-{
-    mongoc_database_t *database;
-    mongoc_collection_t *collection;
-    bson_t *command, reply, *insert;
-    char *str;
-    bool retval;
-
-    /*
-        * Get a handle on the database "db_name" and collection "coll_name"
-        */
-    database = mongoc_client_get_database (client, db_name.c_str());
-    collection = mongoc_client_get_collection (client,  db_name.c_str(), "coll_name");
-
-    /*
-        * Do work. This example pings the database, prints the result as JSON and
-        * performs an insert
-        */
-    command = BCON_NEW ("ping", BCON_INT32 (1));
-
-    bson_error_t error;
-
-    printf ("mongoc_client_command_simple\n");
-
-    retval = mongoc_client_command_simple (
-        client, "admin", command, NULL, &reply, &error);
-
-    if (!retval) {
-        printf ("%s\n", error.message);
-        return EXIT_FAILURE;
-    }
-
-    str = bson_as_json (&reply, NULL);
-    printf ("bson_as_json: %s\n", str);
-
-    insert = BCON_NEW ("hello", BCON_UTF8 ("world"));
-
-    if (!mongoc_collection_insert_one (collection, insert, NULL, NULL, &error)) {
-        fprintf (stderr, "%s\n", error.message);
-    }
-
-    bson_destroy (insert);
-    bson_destroy (&reply);
-    bson_destroy (command);
-    bson_free (str);
-
-    /*
-        * Release our handles and clean up libmongoc
-        */
-    mongoc_collection_destroy (collection);
-    mongoc_database_destroy (database);
-
-    return EXIT_SUCCESS;
-}
-
-mongoc_client_t* init(const std::string& uri_string, mongoc_uri_t *uri)
-{
-     std::cout << "mongoc_client_t init" << std::endl;
-    /*
-    * Required to initialize libmongoc's internals
-    */
-    mongoc_init ();
-
-    /*
-    * Safely create a MongoDB URI object from the given string
-    */
-    bson_error_t error;
-
-    uri = mongoc_uri_new_with_error (uri_string.c_str(), &error);
-
-    if (!uri) 
-    {
-        std::cout << "failed to parse URI:"<< uri_string << "\n"
-                << "error message:" << error.message << "\n";
-        return NULL;
-    }
-
-    /*
-    * Create a new client instance
-    */
-    return mongoc_client_new_from_uri (uri);
-}
-
-//mongodb://[username:password@]host1[:port1][,...hostN[:portN]][/[defaultauthdb][?options]]
-std::string make_uri(      
-      const char* dbname
-    , const char* port
-    , const char* host
-    , const char* username
-    , const char* password)
-{
-    std::stringstream ss;
-
-    ss << "mongodb://";
-
-    if(username && password)
-       ss << username << ":" << password << "@";
- 
-    ss << host <<":"<< port << "/" << dbname;
-
-    return ss.str();
-}
-
-}
-namespace psql_mongo_replication
-{
-
-mongo_replication::mongo_replication(const pg_recvlogical_connection_settings_t& connection): 
-      _db_name(connection._dbname)
-    , _id(connection._id)
-{
-    const std::string uri_string = make_uri(
-          connection._dbname
-        , connection._port
-        , connection._host
-        , connection._username
-        , connection._password);
-
-    std::cout << "uri_string: " << uri_string << std::endl;
-
-    _client = init(uri_string, _uri);
-    
-    /*
-    * Register the application name so we can track it in the profile logs
-    * on the server. This can also be done from the URI (see other examples).
-    */
-    mongoc_client_set_appname (_client, "connect-example");
-}
-
-mongo_replication::~mongo_replication()
-{
-    mongoc_uri_destroy (_uri);
-    mongoc_client_destroy (_client);
-    mongoc_cleanup ();
-
-    std::cout << "~mongo_replication" << std::endl;
-}
-
-void mongo_replication::insert(const std::string& collectionName, const std::string& changes)
-{
-    bson_error_t error;
-    mongoc_database_t *database = mongoc_client_get_database (_client, _db_name.c_str());
-    mongoc_collection_t *collection = mongoc_client_get_collection (_client, _db_name.c_str(), collectionName.c_str());
-
-    std::cout << "mongo_replication insert: "<< collectionName << ":" << changes << std::endl;
-
-    bson_t *insert = bson_new_from_json ((const uint8_t *)changes.c_str(), changes.size(), &error);
-
-    if (!mongoc_collection_insert_one (collection, insert, NULL, NULL, &error)) 
-    {
-        std::cout << error.message << std::endl;
-        return;
-    }
-}
-
-void mongo_replication::update(const std::string& collectionName, const std::string& changes, const std::string& clause)
-{
-    bson_error_t error;
-    mongoc_database_t *database = mongoc_client_get_database (_client, _db_name.c_str());
-    mongoc_collection_t *collection = mongoc_client_get_collection (_client, _db_name.c_str(), collectionName.c_str());
-
-    std::cout << "update << "<< collectionName << ":" << changes << "->" << clause << std::endl;
-
-    bson_t * query = bson_new_from_json ((const uint8_t *)clause.c_str(), clause.size(), &error);
-
-    bson_t *update = bson_new_from_json ((const uint8_t *)changes.c_str(), changes.size(), &error);
-
-    if (!mongoc_collection_update(collection, MONGOC_UPDATE_NONE, query, update, NULL, &error)) 
-    {
-        std::cout << error.message << std::endl;
-        return;
-    }
-}
-
-void mongo_replication::deleteDocs(const std::string& collectionName, const std::string& clause)
-{
-    bson_error_t error;
-    mongoc_database_t *database = mongoc_client_get_database (_client, _db_name.c_str());
-    mongoc_collection_t *collection = mongoc_client_get_collection (_client, _db_name.c_str(), collectionName.c_str());
-
-    std::cout << "delete << "<< collectionName << "->" << clause << std::endl;
-
-    bson_t * query = bson_new_from_json ((const uint8_t *)clause.c_str(), clause.size(), &error);
-
-    if (!mongoc_collection_remove (collection, MONGOC_REMOVE_NONE, query, NULL, &error))
-    {
-        std::cout << error.message << std::endl;
-        return;
-    }
-}
-
-unsigned int mongo_replication::get_id()
-{
-    return _id;
-}
-
-bool mongo_replication::connected()
-{
-    return mongoc_client_get_database (_client, _db_name.c_str()) != nullptr;
-}
-
-void mongo_replication::test()
-{
-    std::cout << __FUNCTION__ << std::endl;
-
-    mongo_test(_client, _db_name);
-}
-
-
+#include "psql_mongo_replication/mongo_replication.hpp"
+#include "psql_mongo_replication/options.hpp"
+#include "psql_mongo_replication/update_delta.hpp"
+#include "pg_recvlogical/pg_recvlogical.h"
+#include <mongoc.h>
+#include "stdafx.hpp"
+namespace
+{
+static void print_bson (const bson_t *b)
+{
+   char *str;
+
+   str = bson_as_canonical_extended_json (b, NULL);
+   fprintf (stdout, "%s\n", str);
+   bson_free (str);
+}
+
+// find()
+// {
+//     mongoc_cursor_t *cursor = mongoc_collection_find_with_opts (collection, filter, NULL, NULL);
+
+//     if(mongoc_cursor_error (cursor, &error))
+//     {
+//         std::cout << error.message << std::endl;
+//         return;
+//     }
+
+//     const bson_t *doc;
+
+//     mongoc_cursor_next (cursor, &doc);
+
+//     print_bson (doc);
+
+//     bson_oid_t oid;
+
+//    bson_iter_t iter;
+
+//     if (bson_iter_init (&iter, doc)) 
+//     {
+//         const bson_value_t *value;
+
+//         value = bson_iter_value (&iter);
+
+//         if(value->value_type == BSON_TYPE_OID);
+//             oid = value->value.v_oid;
+//     }
+// }
+
+int mongo_test (mongoc_client_t* client, const std::string& db_name)
+{
+    mongoc_database_t *database;
+    mongoc_collection_t *collection;
+    bson_t *command, reply, *insert;
+    char *str;
+    bool retval;
+
+    /*
+        * Get a handle on the database "db_name" and collection "coll_name"
+        */
+    database = mongoc_client_get_database (client, db_name.c_str());
+    collection = mongoc_client_get_collection (client,  db_name.c_str(), "coll_name");
+
+    /*
+        * Do work. This example pings the database, prints the result as JSON and
+        * performs an insert
+        */
+    command = BCON_NEW ("ping", BCON_INT32 (1));
+
+    bson_error_t error;
+
+    printf ("mongoc_client_command_simple\n");
+
+    retval = mongoc_client_command_simple (
+        client, "admin", command, NULL, &reply, &error);
+
+    if (!retval) {
+        printf ("%s\n", error.message);
+        return EXIT_FAILURE;
+    }
+
+    str = bson_as_json (&reply, NULL);
+    printf ("bson_as_json: %s\n", str);
+
+    insert = BCON_NEW ("hello", BCON_UTF8 ("world"));
+
+    if (!mongoc_collection_insert_one (collection, insert, NULL, NULL, &error)) {
+        fprintf (stderr, "%s\n", error.message);
+    }
+
+    bson_destroy (insert);
+    bson_destroy (&reply);
+    bson_destroy (command);
+    bson_free (str);
+
+    /*
+        * Release our handles and clean up libmongoc
+        */
+    mongoc_collection_destroy (collection);
+    mongoc_database_destroy (database);
+
+    return EXIT_SUCCESS;
+}
+
+mongoc_client_t* init(const std::string& uri_string, mongoc_uri_t *&uri)
+{
+     std::cout << "mongoc_client_t init" << std::endl;
+    /*
+    * Required to initialize libmongoc's internals
+    */
+    mongoc_init ();
+
+    /*
+    * Safely create a MongoDB URI object from the given string
+    */
+    bson_error_t error;
+
+    uri = mongoc_uri_new_with_error (uri_string.c_str(), &error);
+
+    if (!uri) 
+    {
+        std::cout << "failed to parse URI:"<< uri_string << "\n"
+                << "error message:" << error.message << "\n";
+        return NULL;
+    }
+
+    /*
+    * Create a new client instance
+    */
+    return mongoc_client_new_from_uri (uri);
+}
+
+//mongodb://[username:password@]host1[:port1][,...hostN[:portN]][/[defaultauthdb][?options]]
+std::string make_uri(      
+      const char* dbname
+    , const char* port
+    , const char* host
+    , const char* username
+    , const char* password)
+{
+    std::stringstream ss;
+
+    ss << "mongodb://";
+
+    if(username && password)
+       ss << username << ":" << password << "@";
+ 
+    ss << host <<":"<< port << "/" << dbname;
+
+    return ss.str();
+}
+
+}
+namespace psql_mongo_replication
+{
+
+mongo_replication::mongo_replication(const pg_recvlogical_connection_settings_t& connection): 
+      sink(connection._id)
+    , _uri(nullptr)
+    , _db_name(connection._dbname)
+    , _catch_up_concern(mongoc_write_concern_new())
+{
+    mongoc_write_concern_set_w (_catch_up_concern, 1);
+    mongoc_write_concern_set_journal (_catch_up_concern, false);
+
+    const std::string uri_string = make_uri(
+          connection._dbname
+        , connection._port
+        , connection._host
+        , connection._username
+        , connection._password);
+
+    std::cout << "uri_string: " << uri_string << std::endl;
+
+    _client = init(uri_string, _uri);
+
+    if (_uri)
+        _pipeline.reset(new write_pipeline(_uri, _db_name));
+    
+    /*
+    * Register the application name so we can track it in the profile logs
+    * on the server. This can also be done from the URI (see other examples).
+    */
+    mongoc_client_set_appname (_client, "connect-example");
+}
+
+mongo_replication::~mongo_replication()
+{
+    flush();
+
+    _pipeline.reset();
+
+    _indexes.wait();
+
+    mongoc_write_concern_destroy (_catch_up_concern);
+    mongoc_uri_destroy (_uri);
+    mongoc_client_destroy (_client);
+    mongoc_cleanup ();
+
+    std::cout << "~mongo_replication" << std::endl;
+}
+
+// Key columns of a relation as configured with key_columns.<relation>, never taken from a
+// clause: rows inserted before the first clause would keep generated _ids, and a
+// REPLICA IDENTITY FULL clause holds every column. Without _id mapping the first use also
+// provisions the index the clause filters will use.
+const std::vector<std::string>* mongo_replication::relation_key(const std::string& collectionName)
+{
+    const std::vector<std::string>* columns = _keys.find(collectionName);
+
+    if(columns && !_id_mapping)
+        _indexes.ensure(_client, _uri, _db_name, collectionName, *columns);
+
+    return columns;
+}
+
+// With _id mapping the key columns of the clause become an _id lookup written to `storage`,
+// otherwise the clause itself is the filter.
+const bson_t* mongo_replication::make_filter(const std::string& collectionName, const bson_t* clause, bson_t* storage)
+{
+    const std::vector<std::string>* columns = relation_key(collectionName);
+
+    if(!_id_mapping || columns == nullptr)
+        return clause;
+
+    if(!relation_keys::append_key(*columns, clause, storage, "_id"))
+    {
+        std::cout << "no key columns in clause of " << collectionName << ", filter is not _id mapped" << std::endl;
+        return clause;
+    }
+
+    return storage;
+}
+
+void mongo_replication::insert(const std::string& collectionName, const bson_t* changes)
+{
+    const bson_t *insert = changes;
+    bson_t document = BSON_INITIALIZER;
+
+    const std::vector<std::string>* columns = relation_key(collectionName);
+
+    if (columns && _id_mapping)
+    {
+        if (relation_keys::append_key(*columns, changes, &document, "_id"))
+        {
+            bson_copy_to_excluding_noinit (changes, &document, "_id", NULL);
+            insert = &document;
+        }
+        else
+            std::cout << "no key columns in " << collectionName << " insert, _id is generated" << std::endl;
+    }
+
+    bson_t filter = BSON_INITIALIZER;
+
+    const bool keyed = _upsert && columns && (insert == &document?
+        relation_keys::append_key({"_id"}, insert, &filter, "_id"):
+        relation_keys::append_columns(*columns, insert, &filter));
+
+    if (keyed)
+    {
+        // replayed inserts overwrite what the first delivery wrote
+        bson_t opts = BSON_INITIALIZER;
+        bson_append_bool (&opts, "upsert", -1, true);
+
+        _job->add(collectionName, write_job::OPERATION_REPLACE_ONE, &filter, insert, &opts);
+
+        bson_destroy (&opts);
+    }
+    else
+        _job->add(collectionName, write_job::OPERATION_INSERT, nullptr, insert, nullptr);
+
+    bson_destroy (&filter);
+    bson_destroy (&document);
+}
+
+void mongo_replication::update(const std::string& collectionName, const bson_t* changes, const bson_t* clause)
+{
+    bson_t delta = BSON_INITIALIZER;
+
+    const bool changed = update_delta::make(changes, clause, &delta);
+
+    const std::vector<std::string>* columns = relation_key(collectionName);
+
+    if (changed && _id_mapping && columns && update_delta::changes_columns(changes, clause, *columns))
+    {
+        // _id is immutable: the old document moves to the new key, merged so the columns
+        // missing from "d" (unchanged TOAST) are kept
+        bson_t old_key = BSON_INITIALIZER;
+        bson_t document = BSON_INITIALIZER;
+        bson_t opts = BSON_INITIALIZER;
+
+        // with upsert, "d" is written under the new key when neither document exists
+        if (_upsert)
+            bson_append_bool (&opts, "upsert", -1, true);
+
+        if (relation_keys::append_key(*columns, clause, &old_key, "_id") && relation_keys::append_key(*columns, changes, &document, "_id"))
+        {
+            bson_copy_to_excluding_noinit (changes, &document, "_id", NULL);
+
+            _job->add(collectionName, write_job::OPERATION_REKEY, &old_key, &document, &opts);
+        }
+        else
+            std::cout << "key of " << collectionName << " changed without its key columns, update is not applied" << std::endl;
+
+        bson_destroy (&opts);
+        bson_destroy (&document);
+        bson_destroy (&old_key);
+        bson_destroy (&delta);
+        return;
+    }
+
+    if (!changed)
+    {
+        if (_metrics)
+            _metrics->unchanged.fetch_add(1, std::memory_order_relaxed);
+
+        bson_destroy (&delta);
+        return;
+    }
+
+    bson_t storage = BSON_INITIALIZER;
+    const bson_t *query = make_filter(collectionName, clause, &storage);
+
+    bson_t opts = BSON_INITIALIZER;
+
+    // an update replayed before its insert creates the document instead of being lost
+    if (_upsert)
+        bson_append_bool (&opts, "upsert", -1, true);
+
+    _job->add(collectionName, write_job::OPERATION_UPDATE_ONE, query, &delta, &opts);
+
+    bson_destroy (&opts);
+    bson_destroy (&delta);
+    bson_destroy (&storage);
+}
+
+void mongo_replication::deleteDocs(const std::string& collectionName, const bson_t* clause)
+{
+    bson_t storage = BSON_INITIALIZER;
+    const bson_t *query = make_filter(collectionName, clause, &storage);
+
+    // deleting a document that is already gone is not an error, replays stay idempotent
+    _job->add(collectionName, _id_mapping || _upsert? write_job::OPERATION_REMOVE_ONE: write_job::OPERATION_REMOVE_MANY, query, nullptr, nullptr);
+
+    bson_destroy (&storage);
+}
+
+void mongo_replication::apply(const change_t& change)
+{
+    switch(change.action)
+    {
+        case ACTION_INSERT:
+            if(change.data)
+                insert(change.collection, change.data.get());
+            break;
+        case ACTION_UPDATE:
+            if(change.data && change.clause)
+                update(change.collection, change.data.get(), change.clause.get());
+            break;
+        case ACTION_DELETE:
+            if(change.clause)
+                deleteDocs(change.collection, change.clause.get());
+            break;
+        default:
+            break;
+    }
+}
+
+bool mongo_replication::load(const std::string& collectionName, bson_t* const* documents, size_t count)
+{
+    if (!_pipeline || count == 0)
+        return _pipeline != nullptr;
+
+    bson_error_t error;
+
+    mongoc_client_t* client = _pipeline->acquire_client();
+    mongoc_collection_t* collection = mongoc_client_get_collection (client, _db_name.c_str(), collectionName.c_str());
+
+    bson_t opts = BSON_INITIALIZER;
+    bson_append_bool (&opts, "ordered", -1, false);
+
+    mongoc_bulk_operation_t* bulk = mongoc_collection_create_bulk_operation_with_opts (collection, &opts);
+
+    // nothing reads the copy until streaming starts, a replayed batch only hits duplicates
+    mongoc_bulk_operation_set_write_concern (bulk, _catch_up_concern);
+
+    const std::vector<std::string>* columns = _keys.find(collectionName);
+
+    if (columns && !_id_mapping)
+        _indexes.ensure(client, _uri, _db_name, collectionName, *columns);
+
+    if (!_id_mapping)
+        columns = nullptr;
+
+    bson_t document = BSON_INITIALIZER;
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        const bson_t* insert = documents[i];
+
+        if (columns)
+        {
+            bson_reinit (&document);
+
+            if (relation_keys::append_key(*columns, documents[i], &document, "_id"))
+            {
+                bson_copy_to_excluding_noinit (documents[i], &document, "_id", NULL);
+                insert = &document;
+            }
+        }
+
+        if (!mongoc_bulk_operation_insert_with_opts (bulk, insert, NULL, &error))
+            std::cout << "mongo_replication[" << _id << "] load into " << collectionName << ": " << error.message << std::endl;
+    }
+
+    bson_t reply;
+
+    const bool written = mongoc_bulk_operation_execute (bulk, &reply, &error);
+
+    if (!written)
+        std::cout << "mongo_replication[" << _id << "] load of " << count << " document(s) into "
+                  << collectionName << " failed: " << error.message << std::endl;
+
+    bson_destroy (&reply);
+    bson_destroy (&document);
+    bson_destroy (&opts);
+    mongoc_bulk_operation_destroy (bulk);
+    mongoc_collection_destroy (collection);
+
+    _pipeline->release_client(client);
+
+    return written;
+}
+
+void mongo_replication::defer_indexes()
+{
+    _indexes.defer();
+}
+
+void mongo_replication::build_deferred_indexes()
+{
+    _indexes.build_deferred(_uri, _db_name);
+}
+
+bool mongo_replication::wait_indexes()
+{
+    return _indexes.wait();
+}
+
+void mongo_replication::enqueue(change_t change)
+{
+    const std::vector<std::string>* columns = relation_key(change.collection);
+
+    if(_pending_lsn == 0)
+        _pending_lsn = change.lsn;
+
+    if(_pending_send_time == 0)
+        _pending_send_time = change.send_time;
+
+    _batch.add(std::move(change), columns);
+
+    flush_if_due();
+}
+
+void mongo_replication::reap()
+{
+    if (!_pipeline)
+        return;
+
+    for(const write_pipeline::result_t& result: _pipeline->completed())
+    {
+        _batch_limit.observe(result.changes, result.latency, result.failed);
+
+        _in_flight_changes -= result.changes;
+
+        if(_metrics == nullptr)
+            continue;
+
+        _metrics->applied.add(result.changes, result.bytes);
+        _metrics->batches.fetch_add(1, std::memory_order_relaxed);
+
+        if(result.failed)
+            _metrics->errors.fetch_add(1, std::memory_order_relaxed);
+
+        if(result.commit_latency.count() > 0)
+            _metrics->ack_latency.record(result.commit_latency);
+    }
+}
+
+void mongo_replication::publish()
+{
+    if(_metrics == nullptr)
+        return;
+
+    unsigned long long lsn = 0;
+    long long oldest = 0;
+
+    if(!_pipeline || !_pipeline->oldest(lsn, oldest))
+        oldest = _pending_send_time;
+
+    _metrics->queued.store(_batch.size() + _in_flight_changes, std::memory_order_relaxed);
+    _metrics->oldest_queued.store(oldest, std::memory_order_relaxed);
+    _metrics->batch_limit.store(_batch_limit.limit(), std::memory_order_relaxed);
+    _metrics->coalesced.store(_batch.coalesced(), std::memory_order_relaxed);
+}
+
+void mongo_replication::flush_if_due()
+{
+    reap();
+
+    const std::chrono::milliseconds window = _catch_up? _batch_window * catch_up_window_factor: _batch_window;
+
+    if(_batch.size() >= _batch_limit.limit() || _batch.age() >= window)
+        flush();
+
+    publish();
+}
+
+void mongo_replication::flush()
+{
+    if(_batch.size() == 0)
+    {
+        _pending_lsn = 0;
+        _pending_send_time = 0;
+        return;
+    }
+
+    // kept, and pending, until there is a connection to write them to
+    if(!_pipeline)
+    {
+        if(!_unconnected_reported)
+            std::cout << "mongo_replication[" << _id << "] has no connection, holding " << _batch.size() << " change(s)" << std::endl;
+
+        _unconnected_reported = true;
+        return;
+    }
+
+    _job.reset(new write_job());
+    _job->ordered = !_catch_up || !_batch.independent();
+    _job->concern = _catch_up? _catch_up_concern: nullptr;
+    _job->footprint = _batch.footprint();
+    _job->lsn = _pending_lsn;
+    _job->send_time = _pending_send_time;
+
+    std::vector<change_t> changes = _batch.take();
+
+    _job->changes = changes.size();
+
+    for(const change_t& change: changes)
+        _job->bytes += (change.data? change.data->len: 0) + (change.clause? change.clause->len: 0);
+
+    for(const change_t& change: changes)
+        apply(change);
+
+    // the window counts as pending until the pipeline acknowledges it
+    _pending_lsn = 0;
+    _pending_send_time = 0;
+    _in_flight_changes += changes.size();
+
+    _pipeline->submit(std::move(_job));
+
+    reap();
+}
+
+// id_mapping             on|off   the key_columns of a relation become the document _id
+// key_columns.<relation> a,b,...  key columns of a relation, compound keys in index order
+// index_build            off|foreground|background  key index provisioning without _id mapping
+// apply_mode             plain|upsert  upsert makes inserts/updates replay safe, keyed by the key columns
+// batch_window_ms        n        changes are coalesced for up to n ms before they are written
+// batch_size             n        ... or until n changes are pending; the starting limit when adaptive
+// batch_adaptive         on|off   adapt the batch limit to the write latency (AIMD)
+// batch_target_ms        n        flush latency the adaptive limit aims for
+// batch_size_max         n        upper bound of the adaptive limit
+// pipeline_depth         n        windows written concurrently over pooled connections
+bool mongo_replication::set_option(const std::string& name, const std::string& value)
+{
+    std::string relation;
+    unsigned long long number = 0;
+
+    if(name == "apply_mode")
+    {
+        if(value != "plain" && value != "upsert")
+            return false;
+
+        _upsert = value == "upsert";
+        _batch.set_idempotent(_upsert);
+        return true;
+    }
+
+    if(name == "batch_window_ms" && options::parse_unsigned(value, number))
+    {
+        _batch_window = std::chrono::milliseconds(number);
+        return true;
+    }
+
+    if(name == "batch_size" && options::parse_unsigned(value, number))
+    {
+        _batch_limit.set_limit(number);
+        return true;
+    }
+
+    if(name == "batch_size_max" && options::parse_unsigned(value, number))
+    {
+        _batch_limit.set_max(number);
+        return true;
+    }
+
+    if(name == "batch_target_ms" && options::parse_unsigned(value, number) && number > 0)
+    {
+        _batch_limit.set_target(std::chrono::milliseconds(number));
+        return true;
+    }
+
+    if(name == "pipeline_depth" && options::parse_unsigned(value, number) && number > 0 && _pipeline)
+    {
+        _pipeline->set_depth(number);
+        return true;
+    }
+
+    bool flag = false;
+
+    if(name == "batch_adaptive" && options::parse_bool(value, flag))
+    {
+        _batch_limit.set_adaptive(flag);
+        return true;
+    }
+
+    if(name == "id_mapping")
+        return options::parse_bool(value, _id_mapping);
+
+    if(name == "index_build")
+        return _indexes.set_policy(value);
+
+    if(options::strip_prefix(name, "key_columns.", relation))
+    {
+        _keys.set(relation, relation_keys::parse_columns(value));
+        return true;
+    }
+
+    std::cout << "mongo_replication unknown option: " << name << std::endl;
+
+    return false;
+}
+
+void mongo_replication::set_catch_up(bool catch_up)
+{
+    if(_catch_up == catch_up)
+        return;
+
+    flush();
+
+    _catch_up = catch_up;
+}
+
+unsigned long long mongo_replication::pending_lsn() const
+{
+    unsigned long long lsn = 0;
+    long long send_time = 0;
+
+    if(_pipeline && _pipeline->oldest(lsn, send_time) && lsn != 0)
+        return lsn;
+
+    return _pending_lsn;
+}
+
+bool mongo_replication::failed() const
+{
+    return _pipeline && _pipeline->failed();
+}
+
+index_provisioner::stats_t mongo_replication::index_stats()
+{
+    return _indexes.stats();
+}
+
+bool mongo_replication::connected()
+{
+    return mongoc_client_get_database (_client, _db_name.c_str()) != nullptr;
+}
+
+void mongo_replication::test()
+{
+    std::cout << __FUNCTION__ << std::endl;
+
+    mongo_test(_client, _db_name);
+}
+
+
 }
\ No newline at end of file
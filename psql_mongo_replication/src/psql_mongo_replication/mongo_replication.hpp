@@ -1,32 +1,87 @@
-#pragma once
-
-#include <string>
-
-struct _mongoc_uri_t;
-struct _mongoc_client_t;
-struct pg_recvlogical_connection_settings_t;
-
-namespace psql_mongo_replication
-{
-    class mongo_replication
-    {
-        private:
-        _mongoc_uri_t *_uri;
-        _mongoc_client_t *_client;
-        std::string _db_name;
-        unsigned int _id;
-    
-        public:
-        mongo_replication(const pg_recvlogical_connection_settings_t& connection);
-        ~mongo_replication();
-
-        void insert(const std::string& collectionName, const std::string& changes);
-        void update(const std::string& collectionName, const std::string& changes, const std::string& clause);
-        void deleteDocs(const std::string& collectionName, const std::string& clause);
-        unsigned int get_id();
-        bool connected();
-        void test();
-    };
-}
-
-
+#pragma once
+
+#include <string>
+#include <chrono>
+#include "psql_mongo_replication/sink.hpp"
+#include "psql_mongo_replication/relation_keys.hpp"
+#include "psql_mongo_replication/index_provisioner.hpp"
+#include "psql_mongo_replication/change_batch.hpp"
+#include "psql_mongo_replication/batch_controller.hpp"
+#include "psql_mongo_replication/write_pipeline.hpp"
+#include "psql_mongo_replication/replication_metrics.hpp"
+
+struct _mongoc_uri_t;
+struct _mongoc_client_t;
+struct _mongoc_write_concern_t;
+struct pg_recvlogical_connection_settings_t;
+
+namespace psql_mongo_replication
+{
+    class mongo_replication: public sink
+    {
+        private:
+        _mongoc_uri_t *_uri;
+        _mongoc_client_t *_client;
+        std::string _db_name;
+        bool _id_mapping = false;
+        bool _upsert = false;
+        relation_keys _keys;
+        index_provisioner _indexes;
+        change_batch _batch;
+        std::chrono::milliseconds _batch_window{100};
+        batch_controller _batch_limit;
+        std::unique_ptr<write_pipeline> _pipeline;
+        std::unique_ptr<write_job> _job;    // the window being built
+        bool _catch_up = false;
+        bool _unconnected_reported = false;
+        _mongoc_write_concern_t* _catch_up_concern;
+        unsigned long long _pending_lsn = 0;
+        long long _pending_send_time = 0;
+        size_t _in_flight_changes = 0;
+
+        const std::vector<std::string>* relation_key(const std::string& collectionName);
+        const _bson_t* make_filter(const std::string& collectionName, const _bson_t* clause, _bson_t* storage);
+        void apply(const change_t& change);
+        void reap();
+        void publish();
+    
+        public:
+        static constexpr unsigned catch_up_window_factor = 10;
+
+        mongo_replication(const pg_recvlogical_connection_settings_t& connection);
+        ~mongo_replication();
+
+        void insert(const std::string& collectionName, const _bson_t* changes);
+        void update(const std::string& collectionName, const _bson_t* changes, const _bson_t* clause);
+        void deleteDocs(const std::string& collectionName, const _bson_t* clause);
+        void enqueue(change_t change) override;
+
+        // Initial sync: `count` documents as one unordered bulk insert on a pooled client of
+        // its own, so loaders on several threads write over several connections. Not to be
+        // mixed with enqueue() while the stream runs.
+        bool load(const std::string& collectionName, _bson_t* const* documents, size_t count) override;
+
+        // Key indexes of loaded collections are built once the load is done, not kept up
+        // to date row by row. build_deferred_indexes() starts the builds, wait_indexes()
+        // returns when they are all done, false when one of them failed.
+        void defer_indexes() override;
+        void build_deferred_indexes() override;
+        bool wait_indexes() override;
+        void flush_if_due() override;
+        void flush() override;
+        bool set_option(const std::string& name, const std::string& value) override;
+
+        // Catching up trades durability per write for throughput: w:1 without journal,
+        // unordered bulks when the window allows it and a longer window.
+        void set_catch_up(bool catch_up) override;
+
+        unsigned long long pending_lsn() const override;
+        bool failed() const override;
+
+        index_provisioner::stats_t index_stats();
+        bool connected() override;
+        void test() override;
+    };
+}
+
+
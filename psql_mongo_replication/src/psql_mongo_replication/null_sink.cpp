@@ -0,0 +1,60 @@
+#include "psql_mongo_replication/null_sink.hpp"
+#include <bson.h>
+#include "stdafx.hpp"
+
+namespace psql_mongo_replication
+{
+
+null_sink::null_sink(unsigned int id):
+    sink(id)
+{
+    std::cout << "null_sink[" << _id << "] discards every change" << std::endl;
+}
+
+bool null_sink::connected()
+{
+    return true;
+}
+
+void null_sink::enqueue(change_t change)
+{
+    if(_metrics == nullptr)
+        return;
+
+    _metrics->applied.add(1, (change.data? change.data->len: 0) + (change.clause? change.clause->len: 0));
+}
+
+void null_sink::flush_if_due()
+{
+}
+
+void null_sink::flush()
+{
+}
+
+// Nothing is written, so every option of the other sinks is accepted and has no effect:
+// the options configured for a subscriber apply unchanged when it is switched to null.
+bool null_sink::set_option(const std::string&, const std::string&)
+{
+    return true;
+}
+
+unsigned long long null_sink::pending_lsn() const
+{
+    return 0;
+}
+
+bool null_sink::load(const std::string&, bson_t* const* documents, size_t count)
+{
+    uint64_t bytes = 0;
+
+    for(size_t i = 0; i < count; ++i)
+        bytes += documents[i]->len;
+
+    if(_metrics)
+        _metrics->applied.add(count, bytes);
+
+    return true;
+}
+
+}
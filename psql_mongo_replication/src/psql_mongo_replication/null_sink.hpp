@@ -0,0 +1,21 @@
+#pragma once
+
+#include "psql_mongo_replication/sink.hpp"
+
+namespace psql_mongo_replication
+{
+    // Counts and drops every change, for the throughput of everything before the sink.
+    class null_sink: public sink
+    {
+        public:
+        explicit null_sink(unsigned int id);
+
+        bool connected() override;
+        void enqueue(change_t change) override;
+        void flush_if_due() override;
+        void flush() override;
+        bool set_option(const std::string& name, const std::string& value) override;
+        unsigned long long pending_lsn() const override;
+        bool load(const std::string& collectionName, _bson_t* const* documents, size_t count) override;
+    };
+}
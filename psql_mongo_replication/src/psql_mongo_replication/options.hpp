@@ -0,0 +1,46 @@
+#pragma once
+
+#include <string>
+#include <cstdlib>
+
+namespace psql_mongo_replication
+{
+    // Parsers for the textual values of psql_to_mongo_set_subscriber_option().
+    namespace options
+    {
+        inline bool parse_bool(const std::string& value, bool& result)
+        {
+            if(value == "on" || value == "true" || value == "1")
+                result = true;
+            else if(value == "off" || value == "false" || value == "0")
+                result = false;
+            else
+                return false;
+
+            return true;
+        }
+
+        inline bool parse_unsigned(const std::string& value, unsigned long long& result)
+        {
+            if(value.empty() || value.find_first_not_of("0123456789") != std::string::npos)
+                return false;
+
+            result = std::strtoull(value.c_str(), nullptr, 10);
+
+            return true;
+        }
+
+        // "key_columns.users" -> "users" for prefix "key_columns."
+        inline bool strip_prefix(const std::string& name, const char* prefix, std::string& rest)
+        {
+            const std::string p(prefix);
+
+            if(name.compare(0, p.size(), p) != 0 || name.size() == p.size())
+                return false;
+
+            rest = name.substr(p.size());
+
+            return true;
+        }
+    }
+}
@@ -1,208 +1,826 @@
-#include "psql_mongo_replication/psql_mongo_replication.hpp"
-#include "psql_mongo_replication/mongo_replication.hpp"
-#include "pg_recvlogical/pg_recvlogical.h" // TODO find way to include path include_directories doesnt work
-#include "rapidjson/document.h"
-#include "rapidjson/writer.h"
-#include "rapidjson/stringbuffer.h"
-#include "stdafx.hpp"
-
-namespace
-{
-    enum ACTION_ID
-    {
-        ACTION_INSERT,
-        ACTION_UPDATE,
-        ACTION_DELETE,
-    };
-
-    void apply_changes(rapidjson::Document &d, psql_mongo_replication::mongo_replication *subsriber)
-    {
-        if (d.FindMember("r") == d.MemberEnd())
-            return;
-
-        rapidjson::Value &r = d["r"];
-
-        std::string str = r.GetString();
-
-        size_t pos = str.find(".");
-
-        if (pos != std::string::npos)
-            str.erase(0, pos + 1);
-
-        r.SetString(rapidjson::StringRef(str.c_str()));
-
-        rapidjson::Value &a = d["a"];
-
-        ACTION_ID action = (ACTION_ID)a.GetInt();
-        std::string collection = d["r"].GetString();
-
-        bool is_d_field_pressent = true;
-
-        if (d.FindMember("d") == d.MemberEnd())
-        {
-            std::cout << "in Document no [d]" << std::endl;
-            is_d_field_pressent = false;
-        }
-
-        if (action == ACTION_INSERT && is_d_field_pressent && d["d"].IsObject())
-        {
-            rapidjson::StringBuffer buffer;
-            rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
-            d["d"].Accept(writer);
-
-            subsriber->insert(collection, std::string(buffer.GetString()));
-        }
-        else if (action == ACTION_UPDATE && is_d_field_pressent && d["d"].IsObject())
-        {
-            if (d.FindMember("c") == d.MemberEnd())
-            {
-                std::cout << "in Document no [c]" << std::endl;
-                return;
-            }
-
-            rapidjson::StringBuffer buffer;
-            rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
-
-            d["d"].Accept(writer);
-            std::string data = buffer.GetString();
-
-            buffer.Clear();
-
-            d["c"].Accept(writer);
-            std::string clause = buffer.GetString();
-
-            subsriber->update(collection, data, clause);
-        }
-        else if (action == ACTION_DELETE)
-        {
-            if (d.FindMember("c") == d.MemberEnd())
-            {
-                std::cout << "in Document no [c]" << std::endl;
-                return;
-            }
-
-            rapidjson::StringBuffer buffer;
-            rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
-
-            d["c"].Accept(writer);
-            std::string clause = buffer.GetString();
-
-            subsriber->deleteDocs(collection, clause);
-        }
-    }
-}
-
-namespace psql_mongo_replication
-{
-
-psql_to_mongo::psql_to_mongo() = default;
-
-psql_to_mongo::~psql_to_mongo()
-{
-    std::cout << "wait for replication worker..." << std::endl;
-    _replication_thread->join();
-};
-
-unsigned char psql_to_mongo::on_changes_static(const void* context, const char* changes, unsigned size)
-{
-    std::cout << "psql_mongo_replication got changes..." << std::endl;
-    psql_to_mongo* _this = (psql_to_mongo*)context;
-
-    _this->on_changes(changes, size);
-
-    return 0;
-}
-
-psql_mongo_replication::mongo_replication* psql_to_mongo::get_db_instance(int id)
-{
-    std::cout << "get_db_instance " << id << std::endl;
-
-    for(auto& subscriber: _mongo_replications_db)
-    {
-        std::cout << "subscriber ptr: " << subscriber.get() << std::endl;
-
-        if(subscriber && subscriber->get_id() == id)
-            return subscriber.get();
-    }
-
-    return nullptr;
-}
-
-void psql_to_mongo::on_changes(const char* changes, unsigned size)
-{
-    rapidjson::Document d;
-
-    d.Parse(changes, size);
-
-    std::cout << changes << std::endl;
-
-    rapidjson::Value& subsribers = d["subsribers"];
-
-    for (rapidjson::SizeType i = 0; i < subsribers.Size(); i++) // Uses SizeType instead of size_t
-    {
-        int id_subsriber = subsribers[i].GetInt();
-        std::cout << "subsribers[" << i << "] =" << id_subsriber << std::endl;
-
-        std::lock_guard<std::mutex> lock(_mutex);
-
-        psql_mongo_replication::mongo_replication* subsriber = get_db_instance(id_subsriber);
-
-        if(subsriber == nullptr || !subsriber->connected()) continue;
-
-        apply_changes(d, subsriber);
-    }
-}
-
-void psql_to_mongo::connect_to_mongo_db(const pg_recvlogical_connection_settings_t& connection)
-{
-    std::lock_guard<std::mutex> lock(_mutex);
-
-    if(get_db_instance(connection._id))
-        return;
-
-    _mongo_replications_db.push_back(std::make_unique<mongo_replication>(connection));
-
-    _mongo_replications_db.front()->test();
-}
-
-void psql_to_mongo::reconnect(int id)
-{
-    _mongo_replications_db.front()->test();
-}
-
-void psql_to_mongo::unconnect_from_mongo_db()
-{
-
-}
-
-void psql_to_mongo::connect_to_mongo_dbs(const pg_recvlogical_connection_settings_t* connection, unsigned count)
-{
-    for(size_t i = 0; i < count; ++i)
-        connect_to_mongo_db(connection[i]);
-}
-
-void psql_to_mongo::start_replication(const pg_recvlogical_connection_settings_t& host_connection)
-{
-    std::cout << "psql_to_mongo_init..." << std::endl;
-
-    if(_replication_thread) return;
-
-    pg_recvlogical_init_settings_t settings;
-
-    settings._verbose = true;
-    settings._repication._plugin = NULL;
-    settings._repication._slot = "custom_slot";//"custom_slot";
-    settings._connection._dbname = "json_repl";
-    // settings._connection._host = NULL;
-    // settings._connection._password = NULL;
-    // settings._connection._port = NULL;
-    // settings._connection._username = NULL;
-    settings._repication._status_interval = 10;
-    settings._connection = host_connection;
-
-    pg_recvlogical_init(&settings, NULL);
-
-    _replication_thread.reset( new std::thread(&pg_recvlogical_stream_logical_start, this, std::ref(on_changes_static)) );
-}
-
-}
+#include "psql_mongo_replication/psql_mongo_replication.hpp"
+#include "psql_mongo_replication/mongo_replication.hpp"
+#include "psql_mongo_replication/null_sink.hpp"
+#include "psql_mongo_replication/file_sink.hpp"
+#include "psql_mongo_replication/dump_sink.hpp"
+#include "psql_mongo_replication/options.hpp"
+#include "pg_recvlogical/pg_recvlogical.h" // TODO find way to include path include_directories doesnt work
+#include "psql_mongo_replication/change_decoder.hpp"
+#include "psql_mongo_replication/transaction_stage.hpp"
+#include "psql_mongo_replication/replication_metrics.hpp"
+#include "psql_mongo_replication/snapshot_loader.hpp"
+#include "psql_mongo_replication/archive_replay.hpp"
+#include <algorithm>
+#include "stdafx.hpp"
+
+namespace psql_mongo_replication
+{
+
+psql_to_mongo::psql_to_mongo():
+      _budget(std::make_unique<memory_budget>())
+    , _metrics(std::make_unique<replication_metrics>())
+    , _decoder(std::make_unique<change_decoder>())
+{
+}
+
+psql_to_mongo::~psql_to_mongo()
+{
+    std::cout << "wait for replication worker..." << std::endl;
+
+    if(_replication_thread)
+        _replication_thread->join();
+
+    close_archive();
+};
+
+unsigned char psql_to_mongo::on_changes_static(const void* context, const char* changes, unsigned size)
+{
+    psql_to_mongo* _this = (psql_to_mongo*)context;
+
+    _this->on_changes(changes, size);
+
+    return 0;
+}
+
+void psql_to_mongo::on_idle_static(const void* context)
+{
+    psql_to_mongo* _this = (psql_to_mongo*)context;
+
+    _this->on_idle();
+}
+
+void psql_to_mongo::on_idle()
+{
+    unsigned long long wal_end = 0;
+
+    pg_recvlogical_get_position(nullptr, &wal_end);
+
+    idle(wal_end);
+
+    if(_host_idle)
+        _host_idle();
+}
+
+void psql_to_mongo::idle(unsigned long long wal_end)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    for(auto& subscriber: _mongo_replications_db)
+        subscriber->flush_if_due();
+
+    _wal_end = wal_end;
+
+    _metrics->wal_end.store(_wal_end, std::memory_order_relaxed);
+
+    track_progress();
+}
+
+// Everything before the oldest unwritten change of any subscriber is applied. A staged
+// transaction not committed yet doesn't hold it back: its commit lies past anything
+// confirmed, so the server resends it whole. The lag to the server's WAL end switches
+// catch-up mode, which also confirms less often.
+void psql_to_mongo::track_progress()
+{
+    unsigned long long applied = _received_lsn;
+
+    for(auto& subscriber: _mongo_replications_db)
+    {
+        if(!_failed && subscriber->failed())
+            fail("subscriber " + std::to_string(subscriber->get_id()) + " could not write its changes");
+
+        const unsigned long long pending = subscriber->pending_lsn();
+        const unsigned long long subscriber_applied = pending != 0 && pending - 1 < _received_lsn? pending - 1: _received_lsn;
+
+        if(subscriber_metrics* metrics = subscriber->metrics())
+            metrics->applied_lsn.store(subscriber_applied, std::memory_order_relaxed);
+
+        if(subscriber_applied < applied)
+            applied = subscriber_applied;
+    }
+
+    const auto now = std::chrono::steady_clock::now();
+
+    if(_metrics_interval.count() > 0 && now - _metrics_reported >= _metrics_interval)
+    {
+        _metrics->report(std::cout);
+        _metrics_reported = now;
+    }
+
+    if(_stats && now - _stats_published >= stats_interval)
+    {
+        _metrics->publish(_stats);
+        _stats_published = now;
+    }
+
+    if(applied == 0)
+        return;
+
+    const unsigned long long lag = _wal_end > applied? _wal_end - applied: 0;
+
+    const bool catch_up = _catch_up_enter > 0 && (_catch_up? lag > _catch_up_exit: lag > _catch_up_enter);
+
+    if(catch_up != _catch_up)
+    {
+        std::cout << (catch_up? "entering": "leaving") << " catch-up mode, lag " << (lag >> 20) << " MB" << std::endl;
+
+        _catch_up = catch_up;
+
+        for(auto& subscriber: _mongo_replications_db)
+            subscriber->set_catch_up(catch_up);
+    }
+
+    if(_failed || (_catch_up && now - _confirmed < _catch_up_feedback) || !archived(applied, now))
+        return;
+
+    if(_local)
+        _local_applied = applied;
+    else if(!_replaying)
+        pg_recvlogical_confirm_applied(applied);
+
+    _confirmed = now;
+}
+
+// Caps `applied` at what the archive holds on disk, syncing it at most every
+// archive_sync_interval; false when nothing can be confirmed yet.
+bool psql_to_mongo::archived(unsigned long long& applied, std::chrono::steady_clock::time_point now)
+{
+    if(!_archiving || _replaying)
+        return true;
+
+    if(applied > _archived_lsn && now - _archive_synced >= archive_sync_interval)
+    {
+        if(!pg_recvlogical_archive_flush())
+        {
+            fail("the archive could not be synced");
+            return false;
+        }
+
+        _archived_lsn = _received_lsn;
+        _archive_synced = now;
+    }
+
+    applied = std::min(applied, _archived_lsn);
+
+    return applied != 0;
+}
+
+sink* psql_to_mongo::get_db_instance(int id)
+{
+    for(auto& subscriber: _mongo_replications_db)
+    {
+        if(subscriber && subscriber->get_id() == id)
+            return subscriber.get();
+    }
+
+    return nullptr;
+}
+
+void psql_to_mongo::on_changes(const char* changes, unsigned size)
+{
+    unsigned long long lsn = 0;
+    unsigned long long wal_end = 0;
+
+    pg_recvlogical_get_position(&lsn, &wal_end);
+
+    receive(changes, size, lsn, wal_end, pg_recvlogical_get_send_time());
+}
+
+void psql_to_mongo::receive(const char* changes, unsigned size, unsigned long long lsn, unsigned long long wal_end, long long send_time)
+{
+    if (_failed)
+        return;
+
+    // a gap in the archive is not confirmed past, the message is streamed again after a restart
+    if (_archiving && !_replaying && !pg_recvlogical_archive_write(lsn, wal_end, send_time, changes, size))
+    {
+        fail("the archive could not be written");
+        return;
+    }
+
+    change_t change;
+
+    if (!_decoder->decode(changes, size, change, _subscribers))
+        return;
+
+    change.lsn = lsn;
+    change.send_time = send_time;
+    _wal_end = wal_end;
+
+    _metrics->wal_end.store(_wal_end, std::memory_order_relaxed);
+    _metrics->send_time.store(change.send_time, std::memory_order_relaxed);
+    _metrics->received.add(1, size);
+
+    if (change.action <= ACTION_DELETE)
+    {
+        throughput_t*& relation = _relation_metrics[change.collection];
+
+        if (relation == nullptr)
+            relation = _metrics->relation(change.collection);
+
+        relation->add(1, size);
+    }
+
+    process(change);
+
+    // the failed transaction is streamed again from before its commit
+    if (_failed)
+        return;
+
+    _received_lsn = change.lsn;
+
+    _metrics->received_lsn.store(_received_lsn, std::memory_order_relaxed);
+
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    track_progress();
+}
+
+void psql_to_mongo::process(change_t& change)
+{
+    if (change.action == ACTION_BEGIN)
+    {
+        if (_transaction)
+            std::cout << "transaction " << _transaction->xid() << " has no commit, its changes are dropped" << std::endl;
+
+        _transaction.reset(new transaction_stage(change.xid, change.lsn, *_budget, _spill_directory));
+        return;
+    }
+
+    if (change.action == ACTION_COMMIT)
+    {
+        if (!_transaction)
+            return;
+
+        std::unique_ptr<transaction_stage> transaction = std::move(_transaction);
+
+        commit(*transaction, change.send_time);
+        return;
+    }
+
+    if (on_stream(change))
+        return;
+
+    if (_streaming)
+    {
+        _streaming->add(change, _subscribers);
+        return;
+    }
+
+    if (_transaction)
+    {
+        _transaction->add(change, _subscribers);
+        return;
+    }
+
+    dispatch(change, _subscribers);
+}
+
+// the changes are as old as their commit
+void psql_to_mongo::commit(transaction_stage& transaction, long long send_time)
+{
+    const bool replayed = transaction.replay(*_decoder, [this, send_time](change_t& staged, const std::vector<int>& subscribers)
+    {
+        staged.send_time = send_time;
+        dispatch(staged, subscribers);
+    });
+
+    if (!replayed)
+        fail("transaction " + std::to_string(transaction.xid()) + " could not be applied");
+}
+
+// Nothing is received or confirmed after a change that could not be applied; the stream
+// stops and a restart decodes it again from the last confirmed position.
+void psql_to_mongo::fail(const std::string& reason)
+{
+    std::cout << "psql_to_mongo: " << reason << ", stopping the stream" << std::endl;
+
+    _failed = true;
+
+    stop_replication();
+}
+
+bool psql_to_mongo::failed() const
+{
+    return _failed;
+}
+
+// Chunks of a streamed transaction go to its stage as they arrive, so neither the server
+// nor we hold it in memory; it is applied at stream commit or thrown away at abort.
+bool psql_to_mongo::on_stream(const change_t& change)
+{
+    switch (change.action)
+    {
+        case ACTION_STREAM_START:
+        {
+            std::unique_ptr<transaction_stage>& stage = _streams[change.xid];
+
+            if (!stage)
+                stage.reset(new transaction_stage(change.xid, change.lsn, *_budget, _spill_directory));
+
+            _streaming = stage.get();
+            return true;
+        }
+        case ACTION_STREAM_STOP:
+            _streaming = nullptr;
+            return true;
+        case ACTION_STREAM_COMMIT:
+        {
+            auto stream = _streams.find(change.xid);
+
+            _streaming = nullptr;
+
+            if (stream == _streams.end())
+                return true;
+
+            std::unique_ptr<transaction_stage> transaction = std::move(stream->second);
+
+            _streams.erase(stream);
+            commit(*transaction, change.send_time);
+            return true;
+        }
+        case ACTION_STREAM_ABORT:
+        {
+            auto stream = _streams.find(change.xid);
+
+            _streaming = nullptr;
+
+            if (stream == _streams.end())
+                return true;
+
+            if (change.subxid != change.xid)
+            {
+                stream->second->abort_subtransaction(change.subxid);
+                return true;
+            }
+
+            std::cout << "streamed transaction " << change.xid << " aborted, "
+                      << stream->second->size() << " change(s) discarded" << std::endl;
+
+            _streams.erase(stream);
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+void psql_to_mongo::dispatch(change_t& change, const std::vector<int>& subscribers)
+{
+    for (size_t i = 0; i < subscribers.size(); i++)
+    {
+        int id_subsriber = subscribers[i];
+
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        sink* subsriber = get_db_instance(id_subsriber);
+
+        if(subsriber == nullptr || !subsriber->connected()) continue;
+
+        subsriber->enqueue(change);
+    }
+}
+
+void psql_to_mongo::connect_to_mongo_db(const pg_recvlogical_connection_settings_t& connection)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    if(get_db_instance(connection._id))
+        return;
+
+    if(_sink == "null")
+        _mongo_replications_db.push_back(std::make_unique<null_sink>(connection._id));
+    else if(_sink == "file")
+        _mongo_replications_db.push_back(std::make_unique<file_sink>(connection._id, _sink_directory));
+    else if(_sink == "dump")
+        _mongo_replications_db.push_back(std::make_unique<dump_sink>(connection._id, _sink_directory, connection._dbname));
+    else
+        _mongo_replications_db.push_back(std::make_unique<mongo_replication>(connection));
+
+    _mongo_replications_db.back()->set_metrics(_metrics->subscriber(connection._id));
+
+    _mongo_replications_db.front()->test();
+}
+
+void psql_to_mongo::reconnect(int id)
+{
+    _mongo_replications_db.front()->test();
+}
+
+bool psql_to_mongo::set_subscriber_option(int id, const std::string& name, const std::string& value)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    sink* subsriber = get_db_instance(id);
+
+    if(subsriber == nullptr)
+    {
+        std::cout << "set_subscriber_option: no subscriber " << id << std::endl;
+        return false;
+    }
+
+    std::cout << "set_subscriber_option[" << id << "] " << name << " = " << value << std::endl;
+
+    return subsriber->set_option(name, value);
+}
+
+// confirm_interval  n  seconds between flush position confirmations; with upsert apply
+//                      a replay is harmless, so it can be raised to confirm less often
+// arena_size_kb     n  size of the arenas decoded changes are allocated in
+// memory_budget_mb  n  memory open transactions may stage before they spill to disk
+// spill_directory   s  where spilled transactions are written
+// stream_changes    b  only off: the pinned decoder_json has no streaming option, so
+//                      in-progress transactions are not streamed
+// catch_up_lag_mb   n  WAL lag that switches to catch-up mode, 0 never does
+// catch_up_exit_lag_mb n  lag under which catch-up mode ends
+// catch_up_feedback_interval n  seconds between flush confirmations while catching up
+// metrics_interval  n  seconds between metrics reports in the log, 0 turns them off
+// sink              s  mongo, null, file or dump, where subscribers connected from now on write;
+//                      null discards, file appends to sink_directory/subscriber-<id>.bson,
+//                      dump writes mongorestore dumps under sink_directory/subscriber-<id>
+// sink_directory    s  where the file and dump sinks write
+// archive_path      s  archive every received message under this directory, or tar file
+//                      without suffix, empty for none; takes effect when replication starts
+// archive_format    s  directory or tar
+// archive_compression s  none, gzip, lz4 or zstd; gzip compresses the whole tar file, lz4
+//                      and zstd each segment; a number is a gzip level, 0 for none
+// archive_compression_level n  level of the compression, 0 for the library's default
+// archive_zstd_window_log n  log2 of zstd's long distance matching window, 0 for off;
+//                      replay accepts windows up to 2^31
+// archive_segment_mb n  archive segments rotate at this size
+// snapshot_readers  n  parallel readers of the initial sync
+// snapshot_batch_size n  rows per bulk insert of the initial sync
+// snapshot_split_mb n  tables larger than this are copied in ranges of this size (PostgreSQL 14+)
+bool psql_to_mongo::set_replication_option(const std::string& name, const std::string& value)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    std::cout << "set_replication_option " << name << " = " << value << std::endl;
+
+    unsigned long long number = 0;
+
+    if(name == "confirm_interval" && options::parse_unsigned(value, number))
+    {
+        _confirm_interval = number;
+        return true;
+    }
+
+    if(name == "arena_size_kb" && options::parse_unsigned(value, number) && number > 0)
+    {
+        _decoder->set_arena_size(number * 1024);
+        return true;
+    }
+
+    if(name == "memory_budget_mb" && options::parse_unsigned(value, number))
+    {
+        _budget->set_limit(number << 20);
+        return true;
+    }
+
+    if(name == "catch_up_lag_mb" && options::parse_unsigned(value, number))
+    {
+        _catch_up_enter = number << 20;
+        return true;
+    }
+
+    if(name == "catch_up_exit_lag_mb" && options::parse_unsigned(value, number))
+    {
+        _catch_up_exit = number << 20;
+        return true;
+    }
+
+    if(name == "metrics_interval" && options::parse_unsigned(value, number))
+    {
+        _metrics_interval = std::chrono::seconds(number);
+        return true;
+    }
+
+    if(name == "catch_up_feedback_interval" && options::parse_unsigned(value, number))
+    {
+        _catch_up_feedback = std::chrono::seconds(number);
+        return true;
+    }
+
+    if(name == "snapshot_readers" && options::parse_unsigned(value, number) && number > 0)
+    {
+        _snapshot_readers = number;
+        return true;
+    }
+
+    if(name == "snapshot_batch_size" && options::parse_unsigned(value, number) && number > 0)
+    {
+        _snapshot_batch_size = number;
+        return true;
+    }
+
+    if(name == "snapshot_split_mb" && options::parse_unsigned(value, number))
+    {
+        _snapshot_split = number << 20;
+        return true;
+    }
+
+    bool flag = false;
+
+    if(name == "stream_changes" && options::parse_bool(value, flag))
+    {
+        if(flag)
+            std::cout << "psql_to_mongo: stream_changes is not supported by the pinned decoder_json" << std::endl;
+
+        return !flag;
+    }
+
+    if(name == "sink" && (value == "mongo" || value == "null" || value == "file" || value == "dump"))
+    {
+        _sink = value;
+        return true;
+    }
+
+    if(name == "sink_directory" && !value.empty())
+    {
+        _sink_directory = value;
+        return true;
+    }
+
+    if(name == "archive_path")
+    {
+        _archive_path = value;
+        return true;
+    }
+
+    if(name == "archive_format" && (value == "directory" || value == "tar"))
+    {
+        _archive_tar = value == "tar";
+        return true;
+    }
+
+    if(name == "archive_compression" && (value == "none" || value == "gzip" || value == "lz4" || value == "zstd"))
+    {
+        _archive_compression = value;
+        return true;
+    }
+
+    if(name == "archive_compression" && options::parse_unsigned(value, number) && number <= 9)
+    {
+        _archive_compression = number? "gzip": "none";
+        _archive_compression_level = number;
+        return true;
+    }
+
+    if(name == "archive_compression_level" && options::parse_unsigned(value, number) && number <= 22)
+    {
+        _archive_compression_level = number;
+        return true;
+    }
+
+    if(name == "archive_zstd_window_log" && options::parse_unsigned(value, number) && (number == 0 || (number >= 10 && number <= 31)))
+    {
+        _archive_zstd_window_log = number;
+        return true;
+    }
+
+    if(name == "archive_segment_mb" && options::parse_unsigned(value, number))
+    {
+        _archive_segment_mb = number;
+        return true;
+    }
+
+    if(name == "spill_directory" && !value.empty())
+    {
+        _spill_directory = value;
+        return true;
+    }
+
+    std::cout << "psql_to_mongo unknown option: " << name << std::endl;
+
+    return false;
+}
+
+replication_metrics& psql_to_mongo::metrics()
+{
+    return *_metrics;
+}
+
+void psql_to_mongo::set_stats(psql_to_mongo_stats_t* stats)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    _stats = stats;
+}
+
+void psql_to_mongo::unconnect_from_mongo_db()
+{
+
+}
+
+void psql_to_mongo::connect_to_mongo_dbs(const pg_recvlogical_connection_settings_t* connection, unsigned count)
+{
+    for(size_t i = 0; i < count; ++i)
+        connect_to_mongo_db(connection[i]);
+}
+
+// START_REPLICATION options of the decoder, NULL for none; the pinned decoder_json
+// takes none, an option it doesn't know fails START_REPLICATION
+const char* psql_to_mongo::plugin_options()
+{
+    return NULL;
+}
+
+void psql_to_mongo::init_replication(const pg_recvlogical_connection_settings_t& host_connection)
+{
+    pg_recvlogical_init_settings_t settings = {};
+
+    settings._verbose = true;
+    settings._repication._plugin = NULL;
+    settings._repication._slot = slot_name;
+    settings._connection._dbname = "json_repl";
+    // settings._connection._host = NULL;
+    // settings._connection._password = NULL;
+    // settings._connection._port = NULL;
+    // settings._connection._username = NULL;
+    settings._repication._status_interval = 10;
+    settings._repication._fsync_interval = _confirm_interval;
+    settings._repication._option = plugin_options();
+    settings._connection = host_connection;
+
+    pg_recvlogical_init(&settings, NULL);
+
+    pg_recvlogical_set_on_idle(on_idle_static, idle_interval_ms);
+
+    open_archive();
+}
+
+void psql_to_mongo::open_archive()
+{
+    if(_archiving || _archive_path.empty())
+        return;
+
+    _archiving = pg_recvlogical_archive_open(_archive_path.c_str(), _archive_tar, _archive_compression.c_str(),
+        _archive_compression_level, _archive_zstd_window_log, _archive_segment_mb);
+
+    if(!_archiving)
+        std::cout << "psql_to_mongo: archive " << _archive_path << " not opened, nothing is archived" << std::endl;
+}
+
+void psql_to_mongo::close_archive()
+{
+    if(!_archiving)
+        return;
+
+    pg_recvlogical_archive_close();
+
+    _archiving = false;
+}
+
+void psql_to_mongo::start_replication(const pg_recvlogical_connection_settings_t& host_connection)
+{
+    std::cout << "psql_to_mongo_init..." << std::endl;
+
+    if(_replication_thread) return;
+
+    init_replication(host_connection);
+
+    _replication_thread.reset( new std::thread(&pg_recvlogical_stream_logical_start, this, std::ref(on_changes_static)) );
+}
+
+void psql_to_mongo::run_replication(const pg_recvlogical_connection_settings_t& host_connection)
+{
+    std::cout << "psql_to_mongo_run..." << std::endl;
+
+    if(_replication_thread) return;
+
+    init_replication(host_connection);
+
+    pg_recvlogical_stream_logical_start(this, on_changes_static);
+
+    close_archive();
+
+    std::cout << "psql_to_mongo_run: stream stopped" << std::endl;
+}
+
+bool psql_to_mongo::initial_sync(const pg_recvlogical_connection_settings_t& host_connection)
+{
+    std::cout << "psql_to_mongo_initial_sync..." << std::endl;
+
+    if(_replication_thread) return false;
+
+    init_replication(host_connection);
+
+    char snapshot[64];
+    unsigned long long consistent = 0;
+
+    if(!pg_recvlogical_create_slot(plugin_name, snapshot, sizeof(snapshot), &consistent))
+    {
+        std::cout << "psql_to_mongo_initial_sync: slot " << slot_name << " not created, drop it to sync again" << std::endl;
+        return false;
+    }
+
+    snapshot_loader loader(host_connection, snapshot);
+
+    loader.set_readers(_snapshot_readers);
+    loader.set_batch_size(_snapshot_batch_size);
+    loader.set_split_size(_snapshot_split);
+
+    for(auto& subscriber: _mongo_replications_db)
+        subscriber->defer_indexes();
+
+    const bool loaded = loader.run([this](int id) { return get_db_instance(id); });
+
+    // built in parallel across collections and subscribers, streaming starts on ready indexes
+    for(auto& subscriber: _mongo_replications_db)
+        subscriber->build_deferred_indexes();
+
+    bool indexed = true;
+
+    for(auto& subscriber: _mongo_replications_db)
+        indexed = subscriber->wait_indexes() && indexed;
+
+    if(!loaded)
+    {
+        // streaming on top of an incomplete copy would never fill the gaps
+        std::cout << "psql_to_mongo_initial_sync: copy failed, slot " << slot_name << " dropped" << std::endl;
+
+        pg_recvlogical_drop_slot();
+
+        return false;
+    }
+
+    // the copy is complete and the slot kept: the worker started again streams from it,
+    // and the indexes are built again the first time their relations change
+    if(!indexed)
+    {
+        std::cout << "psql_to_mongo_initial_sync: index builds failed, not streaming from slot " << slot_name << std::endl;
+
+        return false;
+    }
+
+    std::cout << "psql_to_mongo_initial_sync: streaming from " << std::hex << consistent << std::dec << std::endl;
+
+    pg_recvlogical_stream_logical_start(this, on_changes_static);
+
+    close_archive();
+
+    return true;
+}
+
+bool psql_to_mongo::replay(const std::string& path)
+{
+    std::cout << "psql_to_mongo_replay " << path << "..." << std::endl;
+
+    if(_replication_thread) return false;
+
+    _replaying = true;
+    _stop_replay.store(false, std::memory_order_relaxed);
+
+    archive_replay archive(path);
+
+    const bool ok = archive.run(
+        [this](const char* changes, unsigned size, unsigned long long lsn, unsigned long long wal_end, long long send_time)
+        {
+            receive(changes, size, lsn, wal_end, send_time);
+            return !_stop_replay.load(std::memory_order_relaxed);
+        },
+        [this](unsigned long long wal_end) { idle(wal_end); });
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        for(auto& subscriber: _mongo_replications_db)
+            subscriber->flush();
+    }
+
+    idle(_wal_end);
+
+    _replaying = false;
+
+    return ok && !_failed;
+}
+
+void psql_to_mongo::start_local(const char*& slot, const char*& plugin_options)
+{
+    std::cout << "psql_to_mongo_local..." << std::endl;
+
+    _local = true;
+
+    open_archive();
+
+    slot = slot_name;
+    plugin_options = this->plugin_options();
+}
+
+unsigned long long psql_to_mongo::applied_lsn() const
+{
+    return _local_applied;
+}
+
+void psql_to_mongo::stop_replication()
+{
+    _stop_replay.store(true, std::memory_order_relaxed);
+
+    pg_recvlogical_stream_logical_stop();
+}
+
+void psql_to_mongo::set_host_idle(void (*host_idle)())
+{
+    _host_idle = host_idle;
+}
+
+}
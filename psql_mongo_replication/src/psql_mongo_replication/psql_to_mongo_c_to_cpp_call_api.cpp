@@ -1,53 +1,149 @@
-#include "psql_mongo_replication/psql_mongo_replication.hpp"
-#include "pg_recvlogical/pg_recvlogical.h"
-#include "psql_mongo_replication/psql_to_mongo_c_to_cpp_call_api.h"
-
-psql_mongo_replication::psql_to_mongo psqlToMongo;
-
-void psql_mongo_replication_cpp_connect_mongo_db(
-      const char* dbname
-    , const char* host
-    , const char* port
-    , const char* username
-    , const char* password
-    , unsigned int id)
-{
-    pg_recvlogical_connection_settings_t connection;
-
-    connection._dbname = dbname;
-    connection._port = port;
-    connection._host = host;
-    connection._password = password;
-    connection._username = username;
-    connection._id = id;
-
-    psqlToMongo.connect_to_mongo_db(connection);
-}
-
-void psql_mongo_replication_cpp_start_replication(
-      const char* dbname
-    , const char* host
-    , const char* port
-    , const char* username
-    , const char* password)
-{
-    pg_recvlogical_connection_settings_t host_connection;
-
-    host_connection._dbname = dbname;
-    host_connection._port = port;
-    host_connection._host = host;
-    host_connection._username = username;
-    host_connection._password = password;
- 
-    psqlToMongo.start_replication(host_connection);
-}
-
-void psql_mongo_replication_cpp_reconnect_mongo_db(int id)
-{
-    psqlToMongo.reconnect(id);
-}
-
-void psql_mongo_replication_cpp_test_linking()
-{
-
-}
+#include "psql_mongo_replication/psql_mongo_replication.hpp"
+#include "pg_recvlogical/pg_recvlogical.h"
+#include "psql_mongo_replication/psql_to_mongo_c_to_cpp_call_api.h"
+
+psql_mongo_replication::psql_to_mongo psqlToMongo;
+
+void psql_mongo_replication_cpp_connect_mongo_db(
+      const char* dbname
+    , const char* host
+    , const char* port
+    , const char* username
+    , const char* password
+    , unsigned int id)
+{
+    pg_recvlogical_connection_settings_t connection;
+
+    connection._dbname = dbname;
+    connection._port = port;
+    connection._host = host;
+    connection._password = password;
+    connection._username = username;
+    connection._id = id;
+
+    psqlToMongo.connect_to_mongo_db(connection);
+}
+
+void psql_mongo_replication_cpp_start_replication(
+      const char* dbname
+    , const char* host
+    , const char* port
+    , const char* username
+    , const char* password)
+{
+    pg_recvlogical_connection_settings_t host_connection;
+
+    host_connection._dbname = dbname;
+    host_connection._port = port;
+    host_connection._host = host;
+    host_connection._username = username;
+    host_connection._password = password;
+ 
+    psqlToMongo.start_replication(host_connection);
+}
+
+void psql_mongo_replication_cpp_run_replication(
+      const char* dbname
+    , const char* host
+    , const char* port
+    , const char* username
+    , const char* password)
+{
+    pg_recvlogical_connection_settings_t host_connection;
+
+    host_connection._dbname = dbname;
+    host_connection._port = port;
+    host_connection._host = host;
+    host_connection._username = username;
+    host_connection._password = password;
+
+    psqlToMongo.run_replication(host_connection);
+}
+
+int psql_mongo_replication_cpp_initial_sync(
+      const char* dbname
+    , const char* host
+    , const char* port
+    , const char* username
+    , const char* password)
+{
+    pg_recvlogical_connection_settings_t host_connection;
+
+    host_connection._dbname = dbname;
+    host_connection._port = port;
+    host_connection._host = host;
+    host_connection._username = username;
+    host_connection._password = password;
+
+    return psqlToMongo.initial_sync(host_connection);
+}
+
+int psql_mongo_replication_cpp_replay(const char* path)
+{
+    return psqlToMongo.replay(path);
+}
+
+void psql_mongo_replication_cpp_start_local(const char** slot, const char** plugin_options)
+{
+    psqlToMongo.start_local(*slot, *plugin_options);
+}
+
+void psql_mongo_replication_cpp_on_local_changes(
+      const char* changes
+    , unsigned int size
+    , unsigned long long lsn
+    , unsigned long long wal_end
+    , long long send_time)
+{
+    psqlToMongo.receive(changes, size, lsn, wal_end, send_time);
+}
+
+void psql_mongo_replication_cpp_on_local_idle(unsigned long long wal_end)
+{
+    psqlToMongo.idle(wal_end);
+}
+
+unsigned long long psql_mongo_replication_cpp_applied_lsn()
+{
+    return psqlToMongo.applied_lsn();
+}
+
+int psql_mongo_replication_cpp_failed()
+{
+    return psqlToMongo.failed()? 1: 0;
+}
+
+void psql_mongo_replication_cpp_stop_replication()
+{
+    psqlToMongo.stop_replication();
+}
+
+void psql_mongo_replication_cpp_set_on_idle(void (*on_idle)(void))
+{
+    psqlToMongo.set_host_idle(on_idle);
+}
+
+void psql_mongo_replication_cpp_reconnect_mongo_db(int id)
+{
+    psqlToMongo.reconnect(id);
+}
+
+int psql_mongo_replication_cpp_set_subscriber_option(int id, const char* name, const char* value)
+{
+    return psqlToMongo.set_subscriber_option(id, name, value);
+}
+
+int psql_mongo_replication_cpp_set_replication_option(const char* name, const char* value)
+{
+    return psqlToMongo.set_replication_option(name, value);
+}
+
+void psql_mongo_replication_cpp_set_stats(struct psql_to_mongo_stats_t* stats)
+{
+    psqlToMongo.set_stats(stats);
+}
+
+void psql_mongo_replication_cpp_test_linking()
+{
+
+}
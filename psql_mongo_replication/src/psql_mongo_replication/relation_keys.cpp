@@ -0,0 +1,86 @@
+#include "psql_mongo_replication/relation_keys.hpp"
+#include <bson.h>
+#include "stdafx.hpp"
+
+namespace psql_mongo_replication
+{
+
+void relation_keys::set(const std::string& collection, const std::vector<std::string>& columns)
+{
+    if(columns.empty())
+        _columns.erase(collection);
+    else
+        _columns[collection] = columns;
+}
+
+const std::vector<std::string>* relation_keys::find(const std::string& collection) const
+{
+    auto it = _columns.find(collection);
+
+    return it == _columns.end()? nullptr: &it->second;
+}
+
+bool relation_keys::append_key(const std::vector<std::string>& columns, const bson_t* source, bson_t* out, const char* field)
+{
+    bson_iter_t iter;
+
+    for(const std::string& column: columns)
+    {
+        if(!bson_iter_init_find(&iter, source, column.c_str()))
+            return false;
+    }
+
+    if(columns.size() == 1)
+    {
+        bson_iter_init_find(&iter, source, columns.front().c_str());
+
+        return bson_append_value(out, field, -1, bson_iter_value(&iter));
+    }
+
+    bson_t key;
+
+    bson_append_document_begin(out, field, -1, &key);
+
+    for(const std::string& column: columns)
+    {
+        bson_iter_init_find(&iter, source, column.c_str());
+        bson_append_value(&key, column.c_str(), -1, bson_iter_value(&iter));
+    }
+
+    return bson_append_document_end(out, &key);
+}
+
+bool relation_keys::append_columns(const std::vector<std::string>& columns, const bson_t* source, bson_t* out)
+{
+    bson_iter_t iter;
+
+    for(const std::string& column: columns)
+    {
+        if(!bson_iter_init_find(&iter, source, column.c_str()))
+            return false;
+
+        bson_append_value(out, column.c_str(), -1, bson_iter_value(&iter));
+    }
+
+    return true;
+}
+
+std::vector<std::string> relation_keys::parse_columns(const std::string& columns)
+{
+    std::vector<std::string> result;
+    std::stringstream ss(columns);
+    std::string column;
+
+    while(std::getline(ss, column, ','))
+    {
+        column.erase(0, column.find_first_not_of(' '));
+        column.erase(column.find_last_not_of(' ') + 1);
+
+        if(!column.empty())
+            result.push_back(column);
+    }
+
+    return result;
+}
+
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+struct _bson_t;
+
+namespace psql_mongo_replication
+{
+    // Key columns (replica identity / primary key) of the relations configured for a
+    // subscriber, indexed by collection name.
+    class relation_keys
+    {
+        private:
+        std::unordered_map<std::string, std::vector<std::string>> _columns;
+
+        public:
+        void set(const std::string& collection, const std::vector<std::string>& columns);
+        const std::vector<std::string>* find(const std::string& collection) const;
+
+        // Appends the key of `source` to `out` as `field`: the bare value for a single column,
+        // a sub-document for a compound key. Returns false if a key column is missing.
+        static bool append_key(const std::vector<std::string>& columns, const _bson_t* source, _bson_t* out, const char* field);
+
+        // Copies the key columns of `source` into `out` as top level fields.
+        static bool append_columns(const std::vector<std::string>& columns, const _bson_t* source, _bson_t* out);
+
+        static std::vector<std::string> parse_columns(const std::string& columns);
+    };
+}
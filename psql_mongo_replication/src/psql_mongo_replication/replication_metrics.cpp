@@ -0,0 +1,228 @@
+#include "psql_mongo_replication/replication_metrics.hpp"
+#include "psql_mongo_replication/psql_to_mongo_stats.h"
+#include <algorithm>
+#include "stdafx.hpp"
+
+namespace
+{
+    // the seqlock of a shared stats slot, readers retry while it is odd or has moved:
+    // the odd count is ordered before the fields, the fields before the even one
+    void begin_write(std::atomic<uint32_t>& changecount)
+    {
+        changecount.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+
+    void end_write(std::atomic<uint32_t>& changecount)
+    {
+        changecount.fetch_add(1, std::memory_order_release);
+    }
+}
+
+namespace psql_mongo_replication
+{
+
+int64_t now_us()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+void latency_histogram::record(std::chrono::microseconds latency)
+{
+    const uint64_t ms = latency.count() > 0? latency.count() / 1000: 0;
+
+    size_t bucket = 0;
+
+    while(bucket + 1 < buckets && ms >= (uint64_t(1) << bucket))
+        ++bucket;
+
+    counts[bucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+uint64_t latency_histogram::quantile(double p) const
+{
+    uint64_t snapshot[buckets];
+    uint64_t total = 0;
+
+    for(size_t i = 0; i < buckets; ++i)
+    {
+        snapshot[i] = counts[i].load(std::memory_order_relaxed);
+        total += snapshot[i];
+    }
+
+    if(total == 0)
+        return 0;
+
+    const uint64_t rank = uint64_t(p * (total - 1)) + 1;
+    uint64_t seen = 0;
+
+    for(size_t i = 0; i < buckets; ++i)
+    {
+        seen += snapshot[i];
+
+        if(seen >= rank)
+            return uint64_t(1) << i;
+    }
+
+    return uint64_t(1) << (buckets - 1);
+}
+
+void throughput_t::add(uint64_t rows_, uint64_t bytes_)
+{
+    rows.fetch_add(rows_, std::memory_order_relaxed);
+    bytes.fetch_add(bytes_, std::memory_order_relaxed);
+}
+
+subscriber_metrics::subscriber_metrics(int id):
+    id(id)
+{
+}
+
+subscriber_metrics* replication_metrics::subscriber(int id)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    for(auto& subscriber: _subscribers)
+    {
+        if(subscriber->id == id)
+            return subscriber.get();
+    }
+
+    _subscribers.emplace_back(new subscriber_metrics(id));
+
+    return _subscribers.back().get();
+}
+
+throughput_t* replication_metrics::relation(const std::string& name)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    std::unique_ptr<throughput_t>& relation = _relations[name];
+
+    if(!relation)
+        relation.reset(new throughput_t());
+
+    return relation.get();
+}
+
+std::vector<const subscriber_metrics*> replication_metrics::subscribers()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    std::vector<const subscriber_metrics*> subscribers;
+
+    for(auto& subscriber: _subscribers)
+        subscribers.push_back(subscriber.get());
+
+    return subscribers;
+}
+
+double replication_metrics::rate(samples_t& samples, const throughput_t& throughput, double seconds, bool bytes)
+{
+    sample_t& previous = samples[&throughput];
+
+    const uint64_t total = (bytes? throughput.bytes: throughput.rows).load(std::memory_order_relaxed);
+    uint64_t& last = bytes? previous.bytes: previous.rows;
+
+    const double rate = seconds > 0? (total - last) / seconds: 0;
+
+    last = total;
+
+    return rate;
+}
+
+void replication_metrics::report(std::ostream& out)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    const auto now = std::chrono::steady_clock::now();
+    const double seconds = std::chrono::duration<double>(now - _reported_at).count();
+
+    _reported_at = now;
+
+    const uint64_t end = wal_end.load(std::memory_order_relaxed);
+
+    out << "metrics: received " << std::hex << received_lsn.load(std::memory_order_relaxed)
+        << ", wal end " << end << std::dec
+        << ", " << rate(_reported, received, seconds, false) << " rows/s"
+        << ", " << rate(_reported, received, seconds, true) << " bytes/s" << std::endl;
+
+    for(auto& subscriber: _subscribers)
+    {
+        const uint64_t applied = subscriber->applied_lsn.load(std::memory_order_relaxed);
+        const int64_t oldest = subscriber->oldest_queued.load(std::memory_order_relaxed);
+
+        out << "metrics: subscriber " << subscriber->id
+            << " applied " << std::hex << applied << std::dec
+            << ", lag " << (end > applied? end - applied: 0) << " bytes"
+            << " / " << (oldest? (now_us() - oldest) / 1000: 0) << " ms"
+            << ", queued " << subscriber->queued.load(std::memory_order_relaxed)
+            << ", batch limit " << subscriber->batch_limit.load(std::memory_order_relaxed)
+            << ", coalesced " << subscriber->coalesced.load(std::memory_order_relaxed)
+            << ", errors " << subscriber->errors.load(std::memory_order_relaxed)
+            << ", unchanged " << subscriber->unchanged.load(std::memory_order_relaxed)
+            << ", " << rate(_reported, subscriber->applied, seconds, false) << " rows/s"
+            << ", " << rate(_reported, subscriber->applied, seconds, true) << " bytes/s"
+            << ", ack p50 " << subscriber->ack_latency.quantile(0.5) << " ms"
+            << ", p99 " << subscriber->ack_latency.quantile(0.99) << " ms" << std::endl;
+    }
+
+    for(auto& relation: _relations)
+    {
+        out << "metrics: relation " << relation.first
+            << " " << rate(_reported, *relation.second, seconds, false) << " rows/s"
+            << ", " << rate(_reported, *relation.second, seconds, true) << " bytes/s" << std::endl;
+    }
+}
+
+void replication_metrics::publish(psql_to_mongo_stats_t* stats)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    const auto now = std::chrono::steady_clock::now();
+    const double seconds = std::chrono::duration<double>(now - _published_at).count();
+
+    _published_at = now;
+
+    const uint64_t end = wal_end.load(std::memory_order_relaxed);
+    const int64_t now_epoch = now_us();
+
+    begin_write(stats->changecount);
+
+    stats->received_lsn = received_lsn.load(std::memory_order_relaxed);
+    stats->wal_end = end;
+    stats->updated_at = now_epoch;
+    stats->received_rows_per_sec = rate(_published, received, seconds, false);
+    stats->subscriber_count = std::min<size_t>(_subscribers.size(), PSQL_TO_MONGO_STATS_MAX_SUBSCRIBERS);
+
+    end_write(stats->changecount);
+
+    for(size_t i = 0; i < stats->subscriber_count; ++i)
+    {
+        const subscriber_metrics& subscriber = *_subscribers[i];
+        psql_to_mongo_subscriber_stats_t& slot = stats->subscribers[i];
+
+        const uint64_t applied = subscriber.applied_lsn.load(std::memory_order_relaxed);
+        const int64_t oldest = subscriber.oldest_queued.load(std::memory_order_relaxed);
+
+        begin_write(slot.changecount);
+
+        slot.subscriber_id = subscriber.id;
+        slot.queued = subscriber.queued.load(std::memory_order_relaxed);
+        slot.applied_lsn = applied;
+        slot.lag_bytes = end > applied? end - applied: 0;
+        slot.lag_seconds = oldest && now_epoch > oldest? (now_epoch - oldest) / 1e6: 0;
+        slot.batch_limit = subscriber.batch_limit.load(std::memory_order_relaxed);
+        slot.batches = subscriber.batches.load(std::memory_order_relaxed);
+        slot.errors = subscriber.errors.load(std::memory_order_relaxed);
+        slot.rows_applied = subscriber.applied.rows.load(std::memory_order_relaxed);
+        slot.rows_per_sec = rate(_published, subscriber.applied, seconds, false);
+        slot.bytes_per_sec = rate(_published, subscriber.applied, seconds, true);
+        slot.ack_p50_ms = subscriber.ack_latency.quantile(0.5);
+        slot.ack_p99_ms = subscriber.ack_latency.quantile(0.99);
+
+        end_write(slot.changecount);
+    }
+}
+
+}
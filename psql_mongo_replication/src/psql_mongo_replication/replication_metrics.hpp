@@ -0,0 +1,100 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <unordered_map>
+
+struct psql_to_mongo_stats_t;
+
+namespace psql_mongo_replication
+{
+    // Every counter has a single writer and is updated with relaxed atomics, readers sample
+    // whenever they like. Totals only grow, rates are the difference of two samples.
+
+    // Latencies in power of two buckets: bucket i counts those under 2^i ms, the last one the rest.
+    struct latency_histogram
+    {
+        static constexpr size_t buckets = 20;
+
+        std::atomic<uint64_t> counts[buckets] = {};
+
+        void record(std::chrono::microseconds latency);
+
+        // Upper bound in ms of the bucket holding the p-th quantile, 0 when nothing was recorded.
+        uint64_t quantile(double p) const;
+    };
+
+    struct throughput_t
+    {
+        std::atomic<uint64_t> rows{0};
+        std::atomic<uint64_t> bytes{0};
+
+        void add(uint64_t rows, uint64_t bytes);
+    };
+
+    struct subscriber_metrics
+    {
+        int id;
+        std::atomic<uint64_t> applied_lsn{0};
+        std::atomic<uint64_t> queued{0};            // changes batched or in flight
+        std::atomic<int64_t> oldest_queued{0};      // send time of the oldest of them, us since the epoch
+        std::atomic<uint64_t> batches{0};
+        std::atomic<uint64_t> batch_limit{0};
+        std::atomic<uint64_t> coalesced{0};         // changes merged into an earlier one of their window
+        std::atomic<uint64_t> errors{0};
+        std::atomic<uint64_t> unchanged{0};         // updates that change no column, not written
+        throughput_t applied;
+        latency_histogram ack_latency;              // server send time to Mongo acknowledgement
+
+        explicit subscriber_metrics(int id);
+    };
+
+    class replication_metrics
+    {
+        private:
+        struct sample_t
+        {
+            uint64_t rows;
+            uint64_t bytes;
+        };
+
+        std::mutex _mutex;      // registration and reports, never the counters
+        std::vector<std::unique_ptr<subscriber_metrics>> _subscribers;
+        std::unordered_map<std::string, std::unique_ptr<throughput_t>> _relations;
+        using samples_t = std::unordered_map<const throughput_t*, sample_t>;
+
+        samples_t _reported;
+        samples_t _published;
+        std::chrono::steady_clock::time_point _reported_at = std::chrono::steady_clock::now();
+        std::chrono::steady_clock::time_point _published_at = std::chrono::steady_clock::now();
+
+        static double rate(samples_t& samples, const throughput_t& throughput, double seconds, bool bytes);
+
+        public:
+        std::atomic<uint64_t> received_lsn{0};
+        std::atomic<uint64_t> wal_end{0};
+        std::atomic<int64_t> send_time{0};          // of the last message, us since the epoch
+        throughput_t received;
+
+        // Stable for the lifetime of the metrics, callers keep the pointer.
+        subscriber_metrics* subscriber(int id);
+        throughput_t* relation(const std::string& name);
+
+        std::vector<const subscriber_metrics*> subscribers();
+
+        // One line per source with the rates since the previous report.
+        void report(std::ostream& out);
+
+        // Copies the counters and the rates since the previous call to the shared segment
+        // psql_to_mongo_stats() reads.
+        void publish(psql_to_mongo_stats_t* stats);
+    };
+
+    int64_t now_us();
+}
@@ -0,0 +1,57 @@
+#include "psql_mongo_replication/sink.hpp"
+#include "stdafx.hpp"
+
+namespace psql_mongo_replication
+{
+
+sink::sink(unsigned int id):
+    _id(id)
+{
+}
+
+sink::~sink()
+{
+}
+
+unsigned int sink::get_id()
+{
+    return _id;
+}
+
+void sink::set_metrics(subscriber_metrics* metrics)
+{
+    _metrics = metrics;
+}
+
+subscriber_metrics* sink::metrics() const
+{
+    return _metrics;
+}
+
+bool sink::failed() const
+{
+    return false;
+}
+
+void sink::set_catch_up(bool)
+{
+}
+
+void sink::defer_indexes()
+{
+}
+
+void sink::build_deferred_indexes()
+{
+}
+
+bool sink::wait_indexes()
+{
+    return true;
+}
+
+void sink::test()
+{
+}
+
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <string>
+#include "psql_mongo_replication/change_batch.hpp"
+#include "psql_mongo_replication/replication_metrics.hpp"
+
+struct _bson_t;
+
+namespace psql_mongo_replication
+{
+    // Where a subscriber's changes go. psql_to_mongo only talks to this interface: Mongo is
+    // one implementation, the null and file sinks let the decode and staging stages be
+    // measured and tested without a live mongod.
+    class sink
+    {
+        protected:
+        unsigned int _id;
+        subscriber_metrics* _metrics = nullptr;
+
+        public:
+        explicit sink(unsigned int id);
+        virtual ~sink();
+
+        unsigned int get_id();
+        void set_metrics(subscriber_metrics* metrics);
+        subscriber_metrics* metrics() const;
+
+        virtual bool connected() = 0;
+        virtual void enqueue(change_t change) = 0;
+        virtual void flush_if_due() = 0;
+        virtual void flush() = 0;
+        virtual bool set_option(const std::string& name, const std::string& value) = 0;
+
+        // LSN of the oldest change not written yet, 0 when nothing is pending.
+        virtual unsigned long long pending_lsn() const = 0;
+
+        // Changes were refused for good; the stream stops, see psql_to_mongo::fail().
+        virtual bool failed() const;
+
+        // Initial sync, `count` rows of a table; may be called from several threads at once.
+        virtual bool load(const std::string& collectionName, _bson_t* const* documents, size_t count) = 0;
+
+        virtual void set_catch_up(bool catch_up);
+        virtual void defer_indexes();
+        virtual void build_deferred_indexes();
+        virtual bool wait_indexes();
+        virtual void test();
+    };
+}
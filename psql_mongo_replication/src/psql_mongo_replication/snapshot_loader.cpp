@@ -0,0 +1,458 @@
+#include "psql_mongo_replication/snapshot_loader.hpp"
+#include "psql_mongo_replication/sink.hpp"
+#include "psql_mongo_replication/json_to_bson.hpp"
+#include "pg_recvlogical/pg_recvlogical.h"
+#include <libpq-fe.h>
+#include <bson.h>
+#include <map>
+#include <algorithm>
+#include <thread>
+#include <cstdlib>
+#include "stdafx.hpp"
+
+namespace
+{
+    // "schema"."table" with both parts quoted for the connection
+    std::string quoted_name(PGconn* conn, const std::string& schema, const std::string& name)
+    {
+        std::string quoted;
+
+        for(const std::string* part: {&schema, &name})
+        {
+            char* identifier = PQescapeIdentifier(conn, part->c_str(), part->size());
+
+            if(identifier == nullptr)
+                return std::string();
+
+            quoted += (quoted.empty()? "": ".") + std::string(identifier);
+
+            PQfreemem(identifier);
+        }
+
+        return quoted;
+    }
+
+    bool exec(PGconn* conn, const std::string& query)
+    {
+        PGresult* result = PQexec(conn, query.c_str());
+
+        const bool ok = PQresultStatus(result) == PGRES_COMMAND_OK;
+
+        if(!ok)
+            std::cout << "snapshot_loader: " << query << ": " << PQerrorMessage(conn) << std::endl;
+
+        PQclear(result);
+
+        return ok;
+    }
+}
+
+namespace psql_mongo_replication
+{
+
+snapshot_loader::snapshot_loader(const pg_recvlogical_connection_settings_t& source, const std::string& snapshot):
+    _snapshot(snapshot)
+{
+    const std::pair<const char*, const char*> settings[] = {
+          {"dbname", source._dbname}
+        , {"host", source._host}
+        , {"port", source._port}
+        , {"user", source._username}
+        , {"password", source._password}
+        , {"application_name", "psql_to_mongo_snapshot"}};
+
+    for(const auto& setting: settings)
+    {
+        if(setting.second && *setting.second)
+        {
+            _keywords.push_back(setting.first);
+            _values.push_back(setting.second);
+        }
+    }
+}
+
+void snapshot_loader::set_readers(unsigned readers)
+{
+    _readers = readers > 0? readers: 1;
+}
+
+void snapshot_loader::set_batch_size(size_t batch_size)
+{
+    _batch_size = batch_size > 0? batch_size: 1;
+}
+
+void snapshot_loader::set_split_size(unsigned long long bytes)
+{
+    _split_bytes = bytes;
+}
+
+// A read only transaction in the exported snapshot.
+PGconn* snapshot_loader::connect()
+{
+    std::vector<const char*> keywords;
+    std::vector<const char*> values;
+
+    for(size_t i = 0; i < _keywords.size(); ++i)
+    {
+        keywords.push_back(_keywords[i].c_str());
+        values.push_back(_values[i].c_str());
+    }
+
+    keywords.push_back(nullptr);
+    values.push_back(nullptr);
+
+    PGconn* conn = PQconnectdbParams(keywords.data(), values.data(), 0);
+
+    if(PQstatus(conn) != CONNECTION_OK)
+    {
+        std::cout << "snapshot_loader: connection failed: " << PQerrorMessage(conn) << std::endl;
+        PQfinish(conn);
+        return nullptr;
+    }
+
+    char* snapshot = PQescapeLiteral(conn, _snapshot.c_str(), _snapshot.size());
+
+    const bool ok = snapshot
+        && exec(conn, "BEGIN ISOLATION LEVEL REPEATABLE READ READ ONLY")
+        && exec(conn, std::string("SET TRANSACTION SNAPSHOT ") + snapshot);
+
+    PQfreemem(snapshot);
+
+    if(!ok)
+    {
+        PQfinish(conn);
+        return nullptr;
+    }
+
+    return conn;
+}
+
+// The tables of the publications the subscribers subscribed to, largest first so the long
+// copies start early; each is split into page ranges when the server can scan a range, or
+// else into key ranges.
+bool snapshot_loader::discover(PGconn* conn, const resolve_f& resolve)
+{
+    PGresult* result = PQexec(conn,
+        "SELECT si.subscriber_id, pt.schemaname, pt.tablename, c.relpages, current_setting('block_size')::bigint"
+        " FROM psql_to_mongo_replication.subscription_info si"
+        " JOIN pg_publication_tables pt ON pt.pubname = si.pubname"
+        " JOIN pg_class c ON c.oid = format('%I.%I', pt.schemaname, pt.tablename)::regclass"
+        " ORDER BY c.relpages DESC, pt.schemaname, pt.tablename");
+
+    if(PQresultStatus(result) != PGRES_TUPLES_OK)
+    {
+        std::cout << "snapshot_loader: listing tables failed: " << PQerrorMessage(conn) << std::endl;
+        PQclear(result);
+        return false;
+    }
+
+    std::map<std::pair<std::string, std::string>, table_t*> tables;
+    unsigned long long block_size = 8192;
+
+    for(int row = 0; row < PQntuples(result); ++row)
+    {
+        const int id = std::atoi(PQgetvalue(result, row, 0));
+        const std::pair<std::string, std::string> key(PQgetvalue(result, row, 1), PQgetvalue(result, row, 2));
+
+        block_size = std::strtoull(PQgetvalue(result, row, 4), nullptr, 10);
+
+        sink* subscriber = resolve(id);
+
+        if(subscriber == nullptr)
+        {
+            std::cout << "snapshot_loader: subscriber " << id << " isn't connected, " << key.second << " skipped for it" << std::endl;
+            continue;
+        }
+
+        table_t*& table = tables[key];
+
+        if(table == nullptr)
+        {
+            _tables.emplace_back(new table_t{key.first, key.second, std::strtoull(PQgetvalue(result, row, 3), nullptr, 10), {}, {}, {}});
+            table = _tables.back().get();
+        }
+
+        table->subscribers.push_back(subscriber);
+    }
+
+    PQclear(result);
+
+    // TID range scans arrived in 14, before that a ctid range would scan the whole table
+    const bool tid_ranges = PQserverVersion(conn) >= 140000;
+    const long long split_pages = _split_bytes > 0 && block_size > 0? std::max<long long>(_split_bytes / block_size, 1): 0;
+
+    for(const auto& table: _tables)
+    {
+        const long long pages = table->pages;
+
+        if(split_pages == 0 || pages <= split_pages)
+        {
+            _tasks.push_back({table.get(), -1, -1});
+            continue;
+        }
+
+        if(tid_ranges)
+        {
+            // relpages is an estimate, the last range is open to whatever was added since
+            for(long long first = 0; first < pages; first += split_pages)
+            {
+                const bool last = first + split_pages >= pages;
+
+                _tasks.push_back({table.get(), first, last? -1: first + split_pages});
+            }
+
+            continue;
+        }
+
+        if(!key_bounds(conn, *table, (pages + split_pages - 1) / split_pages))
+        {
+            _tasks.push_back({table.get(), -1, -1});
+            continue;
+        }
+
+        // the first range is open below the first bound, the last above the last one
+        for(long long first = -1; first < (long long)table->bounds.size(); ++first)
+            _tasks.push_back({table.get(), first, first + 1 < (long long)table->bounds.size()? first + 1: -1});
+    }
+
+    _task_count = _tasks.size();
+
+    std::cout << "snapshot_loader: " << _tables.size() << " table(s) in " << _task_count << " task(s)" << std::endl;
+
+    return true;
+}
+
+// Histogram bounds split the rows of the column into buckets of about the same count, so
+// every n-th one starts a range of about the same size. The comparisons in copy() order
+// as the histogram does: the column's default operator class and collation.
+bool snapshot_loader::key_bounds(PGconn* conn, table_t& table, long long ranges)
+{
+    const char* params[] = {table.schema.c_str(), table.name.c_str()};
+
+    PGresult* result = PQexecParams(conn,
+        "SELECT quote_ident(a.attname), b.bound"
+        " FROM pg_index i"
+        " JOIN pg_attribute a ON a.attrelid = i.indrelid AND a.attnum = i.indkey[0]"
+        " JOIN pg_stats s ON s.schemaname = $1 AND s.tablename = $2 AND s.attname = a.attname AND NOT s.inherited"
+        " CROSS JOIN LATERAL json_array_elements_text(array_to_json(s.histogram_bounds)) WITH ORDINALITY b(bound, n)"
+        " WHERE i.indrelid = format('%I.%I', $1, $2)::regclass AND i.indisprimary"
+        " ORDER BY b.n",
+        2, nullptr, params, nullptr, nullptr, 0);
+
+    if(PQresultStatus(result) != PGRES_TUPLES_OK)
+    {
+        std::cout << "snapshot_loader: key bounds of " << table.schema << "." << table.name << " failed: " << PQerrorMessage(conn) << std::endl;
+        PQclear(result);
+        return false;
+    }
+
+    // the first and last bounds are the smallest and largest value, the open ends cover them
+    const long long count = PQntuples(result);
+    const long long step = std::max<long long>((count - 1) / std::max<long long>(ranges, 1), 1);
+
+    for(long long row = step; row < count - 1; row += step)
+        table.bounds.push_back(PQgetvalue(result, row, 1));
+
+    if(!table.bounds.empty())
+        table.key = PQgetvalue(result, 0, 0);
+    else
+        std::cout << "snapshot_loader: " << table.schema << "." << table.name << " has no primary key histogram, copied whole" << std::endl;
+
+    PQclear(result);
+
+    return !table.bounds.empty();
+}
+
+bool snapshot_loader::run(const resolve_f& resolve)
+{
+    PGconn* conn = connect();
+
+    if(conn == nullptr)
+        return false;
+
+    const bool discovered = discover(conn, resolve);
+
+    PQfinish(conn);
+
+    if(!discovered)
+        return false;
+
+    std::vector<std::thread> readers;
+
+    for(unsigned i = 0; i < std::min<size_t>(_readers, _task_count); ++i)
+        readers.emplace_back(&snapshot_loader::read, this);
+
+    for(std::thread& reader: readers)
+        reader.join();
+
+    const stats_t totals = stats();
+
+    std::cout << "snapshot_loader: copied " << totals.rows << " row(s), " << totals.bytes << " bytes, "
+              << totals.errors << " error(s)" << std::endl;
+
+    return totals.errors == 0;
+}
+
+void snapshot_loader::read()
+{
+    PGconn* conn = connect();
+
+    if(conn == nullptr)
+    {
+        ++_errors;
+        return;
+    }
+
+    for(;;)
+    {
+        task_t task;
+
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+
+            if(_tasks.empty())
+                break;
+
+            task = _tasks.front();
+            _tasks.pop_front();
+        }
+
+        if(!copy(conn, task))
+            ++_errors;
+    }
+
+    exec(conn, "COMMIT");
+
+    PQfinish(conn);
+}
+
+// Rows come one at a time in single row mode as row_to_json text, the same shape the
+// decoder writes, and go out in batches.
+bool snapshot_loader::copy(PGconn* conn, const task_t& task)
+{
+    const table_t& table = *task.table;
+
+    std::string query = "SELECT row_to_json(t)::text FROM ONLY " + quoted_name(conn, table.schema, table.name) + " t";
+    std::string first;
+    std::string last;
+
+    if(table.key.empty())
+    {
+        if(task.first >= 0)
+            first = "ctid >= '(" + std::to_string(task.first) + ",0)'::tid";
+
+        if(task.last >= 0)
+            last = "ctid < '(" + std::to_string(task.last) + ",0)'::tid";
+    }
+    else
+    {
+        // the literals take the column's type
+        for(auto bound: {std::make_pair(task.first, &first), std::make_pair(task.last, &last)})
+        {
+            if(bound.first < 0)
+                continue;
+
+            const std::string& value = table.bounds[bound.first];
+            char* literal = PQescapeLiteral(conn, value.c_str(), value.size());
+
+            if(literal == nullptr)
+            {
+                std::cout << "snapshot_loader: " << PQerrorMessage(conn) << std::endl;
+                return false;
+            }
+
+            *bound.second = "t." + table.key + (bound.second == &first? " >= ": " < ") + literal;
+
+            PQfreemem(literal);
+        }
+    }
+
+    if(!first.empty())
+        query += " WHERE " + first;
+
+    if(!last.empty())
+        query += std::string(first.empty()? " WHERE ": " AND ") + last;
+
+    if(!PQsendQuery(conn, query.c_str()) || !PQsetSingleRowMode(conn))
+    {
+        std::cout << "snapshot_loader: " << query << ": " << PQerrorMessage(conn) << std::endl;
+        return false;
+    }
+
+    rapidjson::Document document;
+    std::vector<bson_t*> documents;
+    size_t count = 0;
+    bool ok = true;
+
+    while(PGresult* result = PQgetResult(conn))
+    {
+        const ExecStatusType status = PQresultStatus(result);
+
+        if(status == PGRES_SINGLE_TUPLE)
+        {
+            const char* row = PQgetvalue(result, 0, 0);
+            const int length = PQgetlength(result, 0, 0);
+
+            document.Parse(row, length);
+
+            if(count == documents.size())
+                documents.push_back(bson_new());
+            else
+                bson_reinit(documents[count]);
+
+            if(!document.HasParseError() && document.IsObject() && json_to_bson::append_object(document, documents[count]))
+            {
+                ++count;
+                _bytes.fetch_add(length, std::memory_order_relaxed);
+            }
+            else
+                ok = false;
+
+            if(count == _batch_size)
+            {
+                write(table, documents.data(), count);
+                count = 0;
+            }
+        }
+        else if(status != PGRES_TUPLES_OK)
+        {
+            std::cout << "snapshot_loader: copy of " << table.schema << "." << table.name << " failed: " << PQerrorMessage(conn) << std::endl;
+            ok = false;
+        }
+
+        PQclear(result);
+    }
+
+    write(table, documents.data(), count);
+
+    for(bson_t* bson: documents)
+        bson_destroy(bson);
+
+    return ok;
+}
+
+void snapshot_loader::write(const table_t& table, bson_t* const* documents, size_t count)
+{
+    if(count == 0)
+        return;
+
+    for(sink* subscriber: table.subscribers)
+    {
+        if(!subscriber->load(table.name, documents, count))
+            ++_errors;
+    }
+
+    _rows.fetch_add(count, std::memory_order_relaxed);
+}
+
+snapshot_loader::stats_t snapshot_loader::stats() const
+{
+    return {
+          _tables.size()
+        , _task_count
+        , _rows.load(std::memory_order_relaxed)
+        , _bytes.load(std::memory_order_relaxed)
+        , _errors.load(std::memory_order_relaxed)};
+}
+
+}
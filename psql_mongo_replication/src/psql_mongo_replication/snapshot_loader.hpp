@@ -0,0 +1,96 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+
+struct _bson_t;
+struct pg_conn;
+struct pg_recvlogical_connection_settings_t;
+
+namespace psql_mongo_replication
+{
+    class sink;
+
+    // Initial sync: copies every subscribed table as of a snapshot exported by the creation
+    // of the slot, so streaming from the slot's consistent point continues exactly where the
+    // copy ends. Readers share the snapshot on connections of their own and take tables, or
+    // ranges of large tables, off one queue; each batch of rows goes to every subscriber of
+    // the table as an unordered bulk insert on a pooled client. Ranges are ctid ranges on
+    // PostgreSQL 14+, before that ranges of the first primary key column between bounds of
+    // its pg_stats histogram; a table without either is copied whole.
+    class snapshot_loader
+    {
+        public:
+        using resolve_f = std::function<sink*(int)>;
+
+        struct stats_t
+        {
+            size_t tables;
+            size_t tasks;
+            uint64_t rows;
+            uint64_t bytes;
+            size_t errors;
+        };
+
+        private:
+        struct table_t
+        {
+            std::string schema;
+            std::string name;
+            unsigned long long pages;
+            std::vector<sink*> subscribers;
+            std::string key;                    // quoted first primary key column, with bounds
+            std::vector<std::string> bounds;    // where its key ranges start, ascending
+        };
+
+        // pages [first, last) of a table, or with a key its rows from bounds[first] up to
+        // bounds[last]; -1 leaves that end open
+        struct task_t
+        {
+            const table_t* table;
+            long long first;
+            long long last;
+        };
+
+        std::vector<std::string> _keywords;
+        std::vector<std::string> _values;
+        std::string _snapshot;
+        unsigned _readers = 4;
+        size_t _batch_size = 1000;
+        unsigned long long _split_bytes = 1ull << 30;
+        std::vector<std::unique_ptr<table_t>> _tables;
+        std::deque<task_t> _tasks;
+        size_t _task_count = 0;
+        std::mutex _mutex;
+        std::atomic<uint64_t> _rows{0};
+        std::atomic<uint64_t> _bytes{0};
+        std::atomic<size_t> _errors{0};
+
+        pg_conn* connect();
+        bool discover(pg_conn* conn, const resolve_f& resolve);
+        bool key_bounds(pg_conn* conn, table_t& table, long long ranges);
+        void read();
+        bool copy(pg_conn* conn, const task_t& task);
+        void write(const table_t& table, _bson_t* const* documents, size_t count);
+
+        public:
+        snapshot_loader(const pg_recvlogical_connection_settings_t& source, const std::string& snapshot);
+
+        void set_readers(unsigned readers);
+        void set_batch_size(size_t batch_size);
+
+        // Tables larger than this are copied in ranges of this size by several readers.
+        void set_split_size(unsigned long long bytes);
+
+        // Blocks until every table is copied; false when any batch failed.
+        bool run(const resolve_f& resolve);
+
+        stats_t stats() const;
+    };
+}
@@ -0,0 +1,474 @@
+#include "psql_mongo_replication/transaction_stage.hpp"
+#include "psql_mongo_replication/change_decoder.hpp"
+#include <mongoc.h>
+#include <cstring>
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "stdafx.hpp"
+
+namespace psql_mongo_replication
+{
+
+memory_budget::memory_budget(size_t limit):
+    _limit(limit)
+{
+}
+
+void memory_budget::set_limit(size_t limit)
+{
+    _limit.store(limit, std::memory_order_relaxed);
+}
+
+bool memory_budget::reserve(size_t bytes)
+{
+    size_t used = _used.load(std::memory_order_relaxed);
+
+    do
+    {
+        if(used + bytes > _limit.load(std::memory_order_relaxed))
+            return false;
+    }
+    while(!_used.compare_exchange_weak(used, used + bytes, std::memory_order_relaxed));
+
+    return true;
+}
+
+void memory_budget::release(size_t bytes)
+{
+    _used.fetch_sub(bytes, std::memory_order_relaxed);
+}
+
+size_t memory_budget::used() const
+{
+    return _used.load(std::memory_order_relaxed);
+}
+
+// Records held in memory. Replayed changes keep their chunk alive, the budget is given
+// back once the last of them was flushed.
+struct transaction_stage::chunk_t
+{
+    memory_budget& budget;
+    std::unique_ptr<uint8_t[]> bytes;
+    size_t capacity;
+    size_t used = 0;
+
+    chunk_t(memory_budget& budget, size_t capacity):
+          budget(budget)
+        , bytes(new uint8_t[capacity])
+        , capacity(capacity)
+    {
+    }
+
+    ~chunk_t()
+    {
+        budget.release(capacity);
+    }
+};
+
+namespace
+{
+    size_t record_length(const change_t& change, const std::vector<int>& subscribers)
+    {
+        return sizeof(uint32_t) + sizeof(uint8_t) + sizeof(uint32_t)
+             + sizeof(uint16_t) + change.collection.size()
+             + sizeof(uint16_t) + subscribers.size() * sizeof(int32_t)
+             + sizeof(uint32_t) + (change.data? change.data->len: 0)
+             + sizeof(uint32_t) + (change.clause? change.clause->len: 0);
+    }
+
+    template<typename T>
+    uint8_t* put(uint8_t* out, T value)
+    {
+        memcpy(out, &value, sizeof(T));
+        return out + sizeof(T);
+    }
+
+    template<typename T>
+    bool get(const uint8_t*& in, const uint8_t* end, T& value)
+    {
+        if(size_t(end - in) < sizeof(T))
+            return false;
+
+        memcpy(&value, in, sizeof(T));
+        in += sizeof(T);
+
+        return true;
+    }
+
+    uint8_t* put_bson(uint8_t* out, const bson_ref& bson)
+    {
+        const uint32_t length = bson? bson->len: 0;
+
+        out = put(out, length);
+
+        if(length)
+            memcpy(out, bson_get_data(bson.get()), length);
+
+        return out + length;
+    }
+}
+
+transaction_stage::transaction_stage(unsigned int xid, unsigned long long lsn, memory_budget& budget, const std::string& directory):
+      _xid(xid)
+    , _lsn(lsn)
+    , _budget(budget)
+    , _directory(directory)
+{
+}
+
+transaction_stage::~transaction_stage()
+{
+    if(_segment_fd != -1)
+        ::close(_segment_fd);
+
+    for(const std::string& segment: _segments)
+        ::unlink(segment.c_str());
+}
+
+bool transaction_stage::write_record(const change_t& change, const std::vector<int>& subscribers, uint8_t* out, size_t length)
+{
+    if(change.collection.size() > UINT16_MAX || subscribers.size() > UINT16_MAX || length > UINT32_MAX)
+        return false;
+
+    out = put<uint32_t>(out, length);
+    out = put<uint8_t>(out, change.action);
+    out = put<uint32_t>(out, change.xid);
+    out = put<uint16_t>(out, change.collection.size());
+    memcpy(out, change.collection.data(), change.collection.size());
+    out += change.collection.size();
+    out = put<uint16_t>(out, subscribers.size());
+
+    for(int id: subscribers)
+        out = put<int32_t>(out, id);
+
+    out = put_bson(out, change.data);
+    put_bson(out, change.clause);
+
+    return true;
+}
+
+bool transaction_stage::add(const change_t& change, const std::vector<int>& subscribers)
+{
+    if(_failed)
+        return false;
+
+    const size_t length = record_length(change, subscribers);
+
+    ++_changes;
+
+    // once spilled everything after goes to disk too, replay keeps the order
+    if(_segments.empty())
+    {
+        chunk_t* chunk = _chunks.empty()? nullptr: _chunks.back().get();
+
+        if(chunk == nullptr || chunk->capacity - chunk->used < length)
+        {
+            const size_t capacity = std::max(chunk_size, length);
+
+            if(_budget.reserve(capacity))
+            {
+                _chunks.push_back(std::make_shared<chunk_t>(_budget, capacity));
+                chunk = _chunks.back().get();
+            }
+            else
+                chunk = nullptr;
+        }
+
+        if(chunk != nullptr)
+        {
+            _failed = !write_record(change, subscribers, chunk->bytes.get() + chunk->used, length);
+            chunk->used += length;
+
+            return !_failed;
+        }
+
+        std::cout << "transaction " << _xid << " is over the memory budget (" << _budget.used()
+                  << " bytes staged), spilling to " << _directory << std::endl;
+    }
+
+    _failed = !spill(change, subscribers, length);
+
+    return !_failed;
+}
+
+bool transaction_stage::spill(const change_t& change, const std::vector<int>& subscribers, size_t length)
+{
+    if(_segment_fd != -1 && _segment_length > 0 && _segment_length + length > segment_size)
+    {
+        if(!flush_write_buffer())
+            return false;
+
+        close_segment();
+    }
+
+    if(_segment_fd == -1 && !open_segment())
+        return false;
+
+    const size_t offset = _write_buffer.size();
+
+    _write_buffer.resize(offset + length);
+
+    if(!write_record(change, subscribers, _write_buffer.data() + offset, length))
+        return false;
+
+    _segment_length += length;
+    _spilled += length;
+
+    return _write_buffer.size() < write_buffer_size || flush_write_buffer();
+}
+
+bool transaction_stage::open_segment()
+{
+    if(::mkdir(_directory.c_str(), 0700) != 0 && errno != EEXIST)
+    {
+        std::cout << "transaction_stage: can't create " << _directory << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    std::string path = _directory + "/xid-" + std::to_string(_xid) + "-" + std::to_string(_segments.size()) + ".seg";
+
+    _segment_fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+
+    if(_segment_fd == -1)
+    {
+        std::cout << "transaction_stage: can't open " << path << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    _segments.push_back(std::move(path));
+    _segment_length = 0;
+    _write_buffer.reserve(write_buffer_size);
+
+    return true;
+}
+
+bool transaction_stage::flush_write_buffer()
+{
+    const uint8_t* data = _write_buffer.data();
+    size_t left = _write_buffer.size();
+
+    while(left > 0)
+    {
+        const ssize_t written = ::write(_segment_fd, data, left);
+
+        if(written < 0 && errno == EINTR)
+            continue;
+
+        if(written < 0)
+        {
+            std::cout << "transaction_stage: can't write " << _segments.back() << ": " << strerror(errno) << std::endl;
+            return false;
+        }
+
+        data += written;
+        left -= written;
+    }
+
+    _write_buffer.clear();
+
+    return true;
+}
+
+void transaction_stage::close_segment()
+{
+    if(_segment_fd == -1)
+        return;
+
+    ::close(_segment_fd);
+    _segment_fd = -1;
+}
+
+bool transaction_stage::replay_records(
+      const uint8_t* begin
+    , size_t length
+    , const std::shared_ptr<const void>& backing
+    , change_decoder& decoder
+    , const consumer_t& consumer)
+{
+    const uint8_t* const end = begin + length;
+    std::vector<int> subscribers;
+
+    for(const uint8_t* record = begin; record < end;)
+    {
+        const uint8_t* in = record;
+        uint32_t record_length = 0;
+        uint8_t action = 0;
+        uint32_t xid = 0;
+        uint16_t collection_length = 0, count = 0;
+        uint32_t data_length = 0, clause_length = 0;
+
+        if(!get(in, end, record_length) || record_length > size_t(end - record))
+            return false;
+
+        const uint8_t* const record_end = record + record_length;
+
+        if(!get(in, record_end, action) || !get(in, record_end, xid) || !get(in, record_end, collection_length) || size_t(record_end - in) < collection_length)
+            return false;
+
+        if(!_aborted.empty() && _aborted.count(xid))
+        {
+            record = record_end;
+            continue;
+        }
+
+        change_t change;
+
+        change.action = (ACTION_ID)action;
+        change.xid = xid;
+        change.lsn = _lsn;
+        change.collection.assign((const char*)in, collection_length);
+        in += collection_length;
+
+        if(!get(in, record_end, count))
+            return false;
+
+        subscribers.resize(count);
+
+        for(int& id: subscribers)
+        {
+            int32_t value = 0;
+
+            if(!get(in, record_end, value))
+                return false;
+
+            id = value;
+        }
+
+        if(!get(in, record_end, data_length) || size_t(record_end - in) < data_length)
+            return false;
+
+        const uint8_t* data = in;
+        in += data_length;
+
+        if(!get(in, record_end, clause_length) || size_t(record_end - in) < clause_length)
+            return false;
+
+        decoder.attach(change, backing, data_length? data: nullptr, data_length, clause_length? in: nullptr, clause_length);
+
+        consumer(change, subscribers);
+
+        record = record_end;
+    }
+
+    return true;
+}
+
+bool transaction_stage::replay(change_decoder& decoder, const consumer_t& consumer)
+{
+    if(_failed)
+    {
+        std::cout << "transaction " << _xid << " could not be staged, " << _changes << " change(s) are lost" << std::endl;
+        return false;
+    }
+
+    if(!_segments.empty())
+        std::cout << "transaction " << _xid << ": replaying " << _changes << " change(s), "
+                  << _spilled << " bytes from " << _segments.size() << " segment(s)" << std::endl;
+
+    // the chunks stay alive as long as the changes pointing into them
+    std::vector<std::shared_ptr<chunk_t>> chunks;
+
+    chunks.swap(_chunks);
+
+    for(std::shared_ptr<chunk_t>& chunk: chunks)
+    {
+        const uint8_t* bytes = chunk->bytes.get();
+        const size_t used = chunk->used;
+
+        if(!replay_records(bytes, used, chunk, decoder, consumer))
+            return false;
+    }
+
+    if(_segment_fd != -1 && !flush_write_buffer())
+        return false;
+
+    close_segment();
+
+    std::vector<std::string> segments;
+
+    segments.swap(_segments);
+
+    bool replayed = true;
+
+    for(const std::string& segment: segments)
+    {
+        if(!replayed)
+        {
+            ::unlink(segment.c_str());
+            continue;
+        }
+
+        const int fd = ::open(segment.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat st;
+
+        if(fd == -1 || ::fstat(fd, &st) != 0)
+        {
+            std::cout << "transaction_stage: can't read " << segment << ": " << strerror(errno) << std::endl;
+
+            if(fd != -1)
+                ::close(fd);
+
+            ::unlink(segment.c_str());
+            replayed = false;
+            continue;
+        }
+
+        const size_t length = st.st_size;
+        void* mapped = length? ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0): nullptr;
+
+        ::close(fd);
+
+        // the mapping keeps the pages, the name is not needed any more
+        ::unlink(segment.c_str());
+
+        if(mapped == MAP_FAILED)
+        {
+            std::cout << "transaction_stage: can't map " << segment << ": " << strerror(errno) << std::endl;
+            replayed = false;
+            continue;
+        }
+
+        if(mapped == nullptr)
+            continue;
+
+        ::madvise(mapped, length, MADV_SEQUENTIAL);
+
+        std::shared_ptr<const void> backing(mapped, [length](const void* p)
+        {
+            ::munmap(const_cast<void*>(p), length);
+        });
+
+        replayed = replay_records((const uint8_t*)mapped, length, backing, decoder, consumer);
+    }
+
+    if(!replayed)
+        std::cout << "transaction " << _xid << ": spilled changes could not be read back" << std::endl;
+
+    return replayed;
+}
+
+void transaction_stage::abort_subtransaction(unsigned int subxid)
+{
+    _aborted.insert(subxid);
+}
+
+unsigned int transaction_stage::xid() const
+{
+    return _xid;
+}
+
+size_t transaction_stage::size() const
+{
+    return _changes;
+}
+
+size_t transaction_stage::spilled() const
+{
+    return _spilled;
+}
+
+}
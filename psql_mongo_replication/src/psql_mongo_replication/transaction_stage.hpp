@@ -0,0 +1,100 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <unordered_set>
+#include "psql_mongo_replication/change_batch.hpp"
+
+namespace psql_mongo_replication
+{
+    class change_decoder;
+
+    // Bytes of staged changes held in memory by the whole process.
+    class memory_budget
+    {
+        private:
+        std::atomic<size_t> _used{0};
+        std::atomic<size_t> _limit;
+
+        public:
+        explicit memory_budget(size_t limit = 256 << 20);
+
+        void set_limit(size_t limit);
+
+        // False when `bytes` more would go over the limit, nothing is reserved then.
+        bool reserve(size_t bytes);
+        void release(size_t bytes);
+
+        size_t used() const;
+    };
+
+    // Changes of one open transaction, applied when its COMMIT arrives. Records are kept in
+    // memory chunks while the budget allows and appended to segment files in `directory`
+    // afterwards, so a transaction of any size costs at most one write buffer of memory.
+    // At commit the segments are mapped and the changes point straight into the mapping.
+    //
+    // A streamed transaction adds its chunks as they arrive; the changes of an aborted
+    // subtransaction stay where they are and are skipped at replay.
+    //
+    // record: u32 length | u8 action | u32 xid | u16 collection length | collection
+    //         | u16 subscriber count | i32 subscribers | u32 data length | data
+    //         | u32 clause length | clause
+    class transaction_stage
+    {
+        public:
+        using consumer_t = std::function<void(change_t& change, const std::vector<int>& subscribers)>;
+
+        private:
+        struct chunk_t;
+
+        static constexpr size_t chunk_size = 256 * 1024;
+        static constexpr size_t segment_size = 64 << 20;
+        static constexpr size_t write_buffer_size = 1 << 20;
+
+        unsigned int _xid;
+        unsigned long long _lsn;
+        memory_budget& _budget;
+        std::string _directory;
+        std::vector<std::shared_ptr<chunk_t>> _chunks;
+        std::vector<std::string> _segments;
+        std::unordered_set<unsigned int> _aborted;
+        std::vector<uint8_t> _write_buffer;
+        int _segment_fd = -1;
+        size_t _segment_length = 0;
+        size_t _changes = 0;
+        size_t _spilled = 0;
+        bool _failed = false;
+
+        bool write_record(const change_t& change, const std::vector<int>& subscribers, uint8_t* out, size_t length);
+        bool spill(const change_t& change, const std::vector<int>& subscribers, size_t length);
+        bool open_segment();
+        bool flush_write_buffer();
+        void close_segment();
+        bool replay_records(const uint8_t* begin, size_t length, const std::shared_ptr<const void>& backing, change_decoder& decoder, const consumer_t& consumer);
+
+        public:
+        // `lsn` is where the transaction begins, the replayed changes are resent from there.
+        transaction_stage(unsigned int xid, unsigned long long lsn, memory_budget& budget, const std::string& directory);
+        ~transaction_stage();
+
+        transaction_stage(const transaction_stage&) = delete;
+        transaction_stage& operator=(const transaction_stage&) = delete;
+
+        bool add(const change_t& change, const std::vector<int>& subscribers);
+
+        // Discards the changes `subxid` made so far, they are not written back out.
+        void abort_subtransaction(unsigned int subxid);
+
+        // Hands every staged change to `consumer` in order. False when the stage could not be
+        // written or read back completely; the changes consumed so far are not taken back.
+        bool replay(change_decoder& decoder, const consumer_t& consumer);
+
+        unsigned int xid() const;
+        size_t size() const;
+        size_t spilled() const;
+    };
+}
@@ -0,0 +1,123 @@
+#include "psql_mongo_replication/update_delta.hpp"
+#include <bson.h>
+#include <cstring>
+
+namespace
+{
+    bool values_equal(const bson_iter_t* a, const bson_iter_t* b)
+    {
+        if(bson_iter_type(a) != bson_iter_type(b))
+            return false;
+
+        switch(bson_iter_type(a))
+        {
+            case BSON_TYPE_NULL:
+                return true;
+            case BSON_TYPE_BOOL:
+                return bson_iter_bool(a) == bson_iter_bool(b);
+            case BSON_TYPE_INT32:
+                return bson_iter_int32(a) == bson_iter_int32(b);
+            case BSON_TYPE_INT64:
+                return bson_iter_int64(a) == bson_iter_int64(b);
+            case BSON_TYPE_DOUBLE:
+                return bson_iter_double(a) == bson_iter_double(b);
+            case BSON_TYPE_UTF8:
+            {
+                uint32_t a_len, b_len;
+                const char* a_str = bson_iter_utf8(a, &a_len);
+                const char* b_str = bson_iter_utf8(b, &b_len);
+
+                return a_len == b_len && std::memcmp(a_str, b_str, a_len) == 0;
+            }
+            case BSON_TYPE_DOCUMENT:
+            case BSON_TYPE_ARRAY:
+            {
+                uint32_t a_len, b_len;
+                const uint8_t *a_data, *b_data;
+
+                if(bson_iter_type(a) == BSON_TYPE_DOCUMENT)
+                {
+                    bson_iter_document(a, &a_len, &a_data);
+                    bson_iter_document(b, &b_len, &b_data);
+                }
+                else
+                {
+                    bson_iter_array(a, &a_len, &a_data);
+                    bson_iter_array(b, &b_len, &b_data);
+                }
+
+                return a_len == b_len && std::memcmp(a_data, b_data, a_len) == 0;
+            }
+            default:
+            {
+                // any other type as the bytes libbson writes for it
+                bson_t a_value = BSON_INITIALIZER;
+                bson_t b_value = BSON_INITIALIZER;
+
+                const bool equal = bson_append_iter(&a_value, "v", 1, a) && bson_append_iter(&b_value, "v", 1, b)
+                    && bson_equal(&a_value, &b_value);
+
+                bson_destroy(&a_value);
+                bson_destroy(&b_value);
+
+                return equal;
+            }
+        }
+    }
+
+    bool unchanged(const bson_iter_t* value, const bson_t* old)
+    {
+        bson_iter_t old_value;
+
+        return old && bson_iter_init_find(&old_value, old, bson_iter_key(value)) && values_equal(value, &old_value);
+    }
+}
+
+namespace psql_mongo_replication
+{
+namespace update_delta
+{
+
+bool make(const bson_t* data, const bson_t* old, bson_t* update)
+{
+    bson_t set = BSON_INITIALIZER;
+    bson_iter_t iter;
+
+    if(!bson_iter_init(&iter, data))
+        return false;
+
+    while(bson_iter_next(&iter))
+    {
+        const char* key = bson_iter_key(&iter);
+
+        if(std::strcmp(key, "_id") == 0 || unchanged(&iter, old))
+            continue;
+
+        bson_append_iter(&set, key, -1, &iter);
+    }
+
+    const bool changed = !bson_empty(&set);
+
+    if(changed)
+        bson_append_document(update, "$set", -1, &set);
+
+    bson_destroy(&set);
+
+    return changed;
+}
+
+bool changes_columns(const bson_t* data, const bson_t* old, const std::vector<std::string>& columns)
+{
+    bson_iter_t value;
+
+    for(const std::string& column: columns)
+    {
+        if(bson_iter_init_find(&value, data, column.c_str()) && !unchanged(&value, old))
+            return true;
+    }
+
+    return false;
+}
+
+}
+}
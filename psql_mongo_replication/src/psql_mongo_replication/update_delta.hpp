@@ -0,0 +1,21 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+struct _bson_t;
+
+namespace psql_mongo_replication
+{
+    namespace update_delta
+    {
+        // Builds {$set: {...}} from the new tuple `data` into `update`.
+        // Columns whose value in `old` (the REPLICA IDENTITY FULL old tuple or the key clause)
+        // is equal are skipped, nulls are set to null as inserts write them, columns absent
+        // from `data` (unchanged TOAST) are left untouched. Returns false when nothing changed.
+        bool make(const _bson_t* data, const _bson_t* old, _bson_t* update);
+
+        // True when `data` changes any of `columns` compared to `old`.
+        bool changes_columns(const _bson_t* data, const _bson_t* old, const std::vector<std::string>& columns);
+    }
+}
@@ -0,0 +1,629 @@
+#include "psql_mongo_replication/write_pipeline.hpp"
+#include "psql_mongo_replication/replication_metrics.hpp"
+#include <mongoc.h>
+#include <algorithm>
+#include "stdafx.hpp"
+
+namespace
+{
+    using psql_mongo_replication::write_job;
+
+    const int duplicate_key = 11000;
+
+    // Server errors a retry can get past: a lost or stepping down primary, an interrupted
+    // or timed out operation, a write conflict. Any other code is the write itself refused.
+    bool transient(int64_t code)
+    {
+        switch(code)
+        {
+            case 6:         // HostUnreachable
+            case 7:         // HostNotFound
+            case 50:        // MaxTimeMSExpired
+            case 89:        // NetworkTimeout
+            case 91:        // ShutdownInProgress
+            case 112:       // WriteConflict
+            case 189:       // PrimarySteppedDown
+            case 262:       // ExceededTimeLimit
+            case 9001:      // SocketException
+            case 10107:     // NotWritablePrimary
+            case 11600:     // InterruptedAtShutdown
+            case 11602:     // InterruptedDueToReplStateChange
+            case 13435:     // NotPrimaryNoSecondaryOk
+            case 13436:     // NotPrimaryOrSecondary
+                return true;
+        }
+
+        return false;
+    }
+
+    // network, server selection and write concern errors are retried
+    bool refused(const bson_error_t& error)
+    {
+        return error.domain == MONGOC_ERROR_SERVER && !transient(error.code);
+    }
+
+    // a recorded write, its documents pointing into the record
+    struct recorded_t
+    {
+        int kind = -1;
+        bson_t filter = BSON_INITIALIZER;
+        bson_t document = BSON_INITIALIZER;
+        bson_t opts = BSON_INITIALIZER;
+
+        explicit recorded_t(const bson_t* operation)
+        {
+            bson_iter_t it;
+
+            if(!bson_iter_init(&it, operation))
+                return;
+
+            while(bson_iter_next(&it))
+            {
+                const char* key = bson_iter_key(&it);
+                uint32_t length = 0;
+                const uint8_t* data = nullptr;
+
+                if(key[0] == 'o')
+                {
+                    kind = bson_iter_int32(&it);
+                    continue;
+                }
+
+                bson_iter_document(&it, &length, &data);
+
+                bson_t* field = key[0] == 'f'? &filter: key[0] == 'd'? &document: &opts;
+
+                bson_init_static(field, data, length);
+            }
+        }
+    };
+
+    // the write of `operation` as mongoc queues it
+    bool append(mongoc_bulk_operation_t* bulk, const bson_t* operation, bson_error_t* error)
+    {
+        recorded_t recorded(operation);
+
+        switch(recorded.kind)
+        {
+            case write_job::OPERATION_INSERT:
+                return mongoc_bulk_operation_insert_with_opts(bulk, &recorded.document, &recorded.opts, error);
+            case write_job::OPERATION_REPLACE_ONE:
+                return mongoc_bulk_operation_replace_one_with_opts(bulk, &recorded.filter, &recorded.document, &recorded.opts, error);
+            case write_job::OPERATION_UPDATE_ONE:
+                return mongoc_bulk_operation_update_one_with_opts(bulk, &recorded.filter, &recorded.document, &recorded.opts, error);
+            case write_job::OPERATION_REMOVE_ONE:
+                return mongoc_bulk_operation_remove_one_with_opts(bulk, &recorded.filter, &recorded.opts, error);
+            case write_job::OPERATION_REMOVE_MANY:
+                return mongoc_bulk_operation_remove_many_with_opts(bulk, &recorded.filter, &recorded.opts, error);
+        }
+
+        bson_set_error(error, 0, 0, "unknown operation %d", recorded.kind);
+
+        return false;
+    }
+
+    int operation_kind(const bson_t* operations, size_t index)
+    {
+        const std::string key = std::to_string(index) + ".o";
+        bson_iter_t it;
+
+        return bson_iter_init(&it, operations) && bson_iter_find_descendant(&it, key.c_str(), &it)? bson_iter_int32(&it): -1;
+    }
+}
+
+namespace psql_mongo_replication
+{
+
+write_job::~write_job()
+{
+    for(bulk_t& bulk: bulks)
+        bson_destroy(bulk.operations);
+}
+
+void write_job::add(const std::string& collection, operation_t operation, const bson_t* filter, const bson_t* document, const bson_t* opts)
+{
+    if(bulks.empty() || bulks.back().name != collection || bulks.back().rekey || operation == OPERATION_REKEY)
+        bulks.push_back({collection, bson_new(), 0, {}, operation == OPERATION_REKEY});
+
+    bulk_t& bulk = bulks.back();
+    const std::string index = std::to_string(bulk.count++);
+    bson_t entry;
+
+    bson_append_document_begin(bulk.operations, index.c_str(), -1, &entry);
+    bson_append_int32(&entry, "o", 1, operation);
+
+    if(filter)
+        bson_append_document(&entry, "f", 1, filter);
+
+    if(document && operation == OPERATION_INSERT && !bson_has_field(document, "_id"))
+    {
+        bson_t keyed;
+        bson_oid_t oid;
+
+        bson_oid_init(&oid, NULL);
+
+        bson_append_document_begin(&entry, "d", 1, &keyed);
+        bson_append_oid(&keyed, "_id", 3, &oid);
+        bson_concat(&keyed, document);
+        bson_append_document_end(&entry, &keyed);
+    }
+    else if(document)
+        bson_append_document(&entry, "d", 1, document);
+
+    if(opts)
+        bson_append_document(&entry, "p", 1, opts);
+
+    bson_append_document_end(bulk.operations, &entry);
+}
+
+write_pipeline::write_pipeline(const mongoc_uri_t* uri, const std::string& database):
+      _pool(mongoc_client_pool_new(uri))
+    , _database(database)
+{
+    mongoc_client_pool_set_appname(_pool, "psql_to_mongo");
+}
+
+// Queued jobs get one more attempt; a job that fails it stays unacknowledged, so its
+// changes are streamed again after a restart.
+write_pipeline::~write_pipeline()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+
+    _changed.notify_all();
+
+    for(std::thread& worker: _workers)
+        worker.join();
+
+    mongoc_client_pool_destroy(_pool);
+}
+
+void write_pipeline::set_depth(unsigned depth)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    _depth = depth > 0? depth: 1;
+}
+
+mongoc_client_t* write_pipeline::acquire_client()
+{
+    return mongoc_client_pool_pop(_pool);
+}
+
+void write_pipeline::release_client(mongoc_client_t* client)
+{
+    mongoc_client_pool_push(_pool, client);
+}
+
+// Keys are (collection, key) of coalesced changes; a collection with unkeyed changes may
+// have any of its documents touched.
+bool write_pipeline::conflicts(const write_set& footprint) const
+{
+    for(const std::string& key: footprint.keys)
+    {
+        if(_keys.count(key))
+            return true;
+    }
+
+    for(const std::string& collection: footprint.collections)
+    {
+        if(_unkeyed.count(collection))
+            return true;
+    }
+
+    for(const std::string& collection: footprint.unkeyed)
+    {
+        if(_collections.count(collection))
+            return true;
+    }
+
+    return false;
+}
+
+void write_pipeline::track(const write_set& footprint, bool add)
+{
+    auto update = [add](std::unordered_multiset<std::string>& tracked, const std::vector<std::string>& values)
+    {
+        for(const std::string& value: values)
+        {
+            if(add)
+                tracked.insert(value);
+            else
+                tracked.erase(tracked.find(value));
+        }
+    };
+
+    update(_keys, footprint.keys);
+    update(_collections, footprint.collections);
+    update(_unkeyed, footprint.unkeyed);
+}
+
+void write_pipeline::submit(std::unique_ptr<write_job> job)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    _changed.wait(lock, [this, &job]()
+    {
+        return _failed || (_in_flight.size() < _depth && !conflicts(job->footprint));
+    });
+
+    // nothing past the refused job is confirmed, the stream resends this one
+    if(_failed)
+        return;
+
+    track(job->footprint, true);
+
+    _queue.push_back(job.get());
+    _in_flight.emplace(_submitted++, std::move(job));
+
+    if(_workers.size() < _depth)
+        _workers.emplace_back(&write_pipeline::work, this);
+
+    _changed.notify_all();
+}
+
+void write_pipeline::wait()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    _changed.wait(lock, [this]() { return _failed || _in_flight.empty(); });
+}
+
+bool write_pipeline::failed()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    return _failed;
+}
+
+bool write_pipeline::oldest(unsigned long long& lsn, long long& send_time)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    if(_in_flight.empty())
+        return false;
+
+    lsn = _in_flight.begin()->second->lsn;
+    send_time = _in_flight.begin()->second->send_time;
+
+    return true;
+}
+
+std::vector<write_pipeline::result_t> write_pipeline::completed()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    std::vector<result_t> completed;
+
+    completed.swap(_completed);
+
+    return completed;
+}
+
+void write_pipeline::work()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    for(;;)
+    {
+        _changed.wait(lock, [this]() { return _stop || !_queue.empty(); });
+
+        if(_queue.empty())
+            return;
+
+        write_job* job = _queue.front();
+        _queue.pop_front();
+
+        std::chrono::milliseconds backoff = retry_backoff_min;
+        bool written = false;
+
+        for(;;)
+        {
+            lock.unlock();
+
+            const auto attempt = std::chrono::steady_clock::now();
+
+            written = execute(*job);
+
+            lock.lock();
+
+            if(written || _stop)
+                break;
+
+            _completed.push_back({0, 0, std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - attempt), std::chrono::microseconds(0), true});
+
+            if(job->permanent)
+            {
+                std::cout << "write of the window at " << std::hex << job->lsn << std::dec << " was refused, not retrying" << std::endl;
+
+                _failed = true;
+                _changed.notify_all();
+                break;
+            }
+
+            std::cout << "write of the window at " << std::hex << job->lsn << std::dec << " failed, attempt " << job->attempts
+                      << ", retrying in " << backoff.count() << " ms" << std::endl;
+
+            _changed.wait_for(lock, backoff, [this]() { return _stop; });
+
+            backoff = std::min(backoff * 2, retry_backoff_max);
+        }
+
+        // refused, or given up on at shutdown: it stays in flight, nothing past it is confirmed
+        if(!written)
+            continue;
+
+        track(job->footprint, false);
+
+        _completed.push_back({
+              job->changes
+            , job->bytes
+            , std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - job->started)
+            , std::chrono::microseconds(job->send_time? now_us() - job->send_time: 0)
+            , false});
+
+        for(auto it = _in_flight.begin(); it != _in_flight.end(); ++it)
+        {
+            if(it->second.get() == job)
+            {
+                _in_flight.erase(it);
+                break;
+            }
+        }
+
+        _changed.notify_all();
+    }
+}
+
+// Bulks run in order and stop at the first that fails; the next attempt starts there.
+bool write_pipeline::execute(write_job& job)
+{
+    mongoc_client_t* client = mongoc_client_pool_pop(_pool);
+    bool written = true;
+
+    while(written && job.written < job.bulks.size())
+    {
+        written = write(client, job, job.bulks[job.written]);
+
+        if(written)
+            ++job.written;
+    }
+
+    mongoc_client_pool_push(_pool, client);
+
+    ++job.attempts;
+
+    return written;
+}
+
+// What is left of a failed bulk: the writes it reported errors for and, when it is
+// ordered, those after the first error that never ran. Without write errors the whole
+// command failed and nothing of it is known to be applied. A duplicate key of a retried
+// insert is the document an earlier attempt wrote. A write error that isn't transient,
+// or a write mongoc refuses, fails every attempt and marks the job permanent.
+bool write_pipeline::write(mongoc_client_t* client, write_job& job, write_job::bulk_t& bulk)
+{
+    if(bulk.rekey)
+        return rekey(client, job, bulk);
+
+    mongoc_collection_t* collection = mongoc_client_get_collection(client, _database.c_str(), bulk.name.c_str());
+    bson_t opts = BSON_INITIALIZER;
+    bson_error_t error;
+
+    if(!job.ordered)
+        bson_append_bool(&opts, "ordered", -1, false);
+
+    mongoc_bulk_operation_t* operation = mongoc_collection_create_bulk_operation_with_opts(collection, &opts);
+
+    if(job.concern)
+        mongoc_bulk_operation_set_write_concern(operation, job.concern);
+
+    std::vector<size_t> attempted;
+    size_t next_retry = 0;
+    bson_iter_t it;
+    bool queued = true;
+
+    bson_iter_init(&it, bulk.operations);
+
+    for(size_t index = 0; queued && bson_iter_next(&it); ++index)
+    {
+        if(!bulk.retry.empty() && (next_retry == bulk.retry.size() || bulk.retry[next_retry] != index))
+            continue;
+
+        uint32_t length = 0;
+        const uint8_t* data = nullptr;
+        bson_t entry;
+
+        bson_iter_document(&it, &length, &data);
+        bson_init_static(&entry, data, length);
+
+        queued = append(operation, &entry, &error);
+
+        attempted.push_back(index);
+        ++next_retry;
+    }
+
+    bson_t reply = BSON_INITIALIZER;
+
+    // a write mongoc refuses fails every attempt, the bulk is left as it was
+    if(!queued)
+    {
+        std::cout << "write to " << bulk.name << " not queued: " << error.message << std::endl;
+
+        job.permanent = true;
+
+        bson_destroy(&opts);
+        mongoc_bulk_operation_destroy(operation);
+        mongoc_collection_destroy(collection);
+
+        return false;
+    }
+
+    const bool written = mongoc_bulk_operation_execute(operation, &reply, &error);
+
+    std::vector<size_t> left;
+
+    if(!written)
+    {
+        bson_iter_t errors;
+        bson_iter_t entry;
+        size_t first = attempted.size();
+
+        if(bson_iter_init_find(&errors, &reply, "writeErrors") && BSON_ITER_HOLDS_ARRAY(&errors) && bson_iter_recurse(&errors, &entry))
+        {
+            while(bson_iter_next(&entry))
+            {
+                bson_iter_t field;
+                int32_t position = -1;
+                int32_t code = 0;
+
+                if(bson_iter_recurse(&entry, &field) && bson_iter_find(&field, "index"))
+                    position = bson_iter_as_int64(&field);
+
+                if(bson_iter_recurse(&entry, &field) && bson_iter_find(&field, "code"))
+                    code = bson_iter_as_int64(&field);
+
+                if(position < 0 || size_t(position) >= attempted.size())
+                    continue;
+
+                first = std::min(first, size_t(position));
+
+                if(code == duplicate_key && job.attempts > 0 && operation_kind(bulk.operations, attempted[position]) == write_job::OPERATION_INSERT)
+                    continue;
+
+                if(!transient(code))
+                    job.permanent = true;
+
+                left.push_back(attempted[position]);
+            }
+
+            if(job.ordered)
+            {
+                for(size_t position = first + 1; position < attempted.size(); ++position)
+                    left.push_back(attempted[position]);
+            }
+
+            std::sort(left.begin(), left.end());
+            left.erase(std::unique(left.begin(), left.end()), left.end());
+        }
+        else
+        {
+            left = attempted;
+            job.permanent = refused(error);
+        }
+
+        char* str = bson_as_canonical_extended_json(&reply, NULL);
+
+        std::cout << "bulk write of " << attempted.size() << " change(s) to " << bulk.name << " failed: " << error.message
+                  << " " << (str? str: "") << ", " << left.size() << " left" << std::endl;
+
+        bson_free(str);
+    }
+
+    bson_destroy(&reply);
+    bson_destroy(&opts);
+    mongoc_bulk_operation_destroy(operation);
+    mongoc_collection_destroy(collection);
+
+    bulk.retry = left;
+
+    return written || left.empty();
+}
+
+// The old document moves to the key of "d", merged under it so the columns "d" lacks
+// (unchanged TOAST) are kept. The new document is written before the old one is removed:
+// an attempt failing in between finds the old one again, one that finds only the new one
+// was applied before. Without either the row never reached Mongo: under upsert "d" is
+// written under the new key, otherwise the window is refused and the stream stops.
+bool write_pipeline::rekey(mongoc_client_t* client, write_job& job, write_job::bulk_t& bulk)
+{
+    bson_iter_t it;
+    uint32_t length = 0;
+    const uint8_t* data = nullptr;
+    bson_t entry;
+
+    if(!bson_iter_init(&it, bulk.operations) || !bson_iter_next(&it))
+        return true;
+
+    bson_iter_document(&it, &length, &data);
+    bson_init_static(&entry, data, length);
+
+    const recorded_t recorded(&entry);
+    mongoc_collection_t* collection = mongoc_client_get_collection(client, _database.c_str(), bulk.name.c_str());
+    bson_t key = BSON_INITIALIZER;
+    bson_t find_opts = BSON_INITIALIZER;
+    bson_t write_opts = BSON_INITIALIZER;
+    bson_t replace_opts = BSON_INITIALIZER;
+    bson_t merged = BSON_INITIALIZER;
+    bson_error_t error;
+    bool written = false;
+
+    if(bson_iter_init_find(&it, &recorded.document, "_id"))
+        bson_append_iter(&key, "_id", 3, &it);
+
+    bson_append_int64(&find_opts, "limit", -1, 1);
+
+    if(job.concern)
+        mongoc_write_concern_append(const_cast<mongoc_write_concern_t*>(job.concern), &write_opts);
+
+    bson_concat(&replace_opts, &write_opts);
+    bson_append_bool(&replace_opts, "upsert", -1, true);
+
+    mongoc_cursor_t* cursor = mongoc_collection_find_with_opts(collection, &recorded.filter, &find_opts, NULL);
+    const bson_t* old = nullptr;
+
+    if(mongoc_cursor_next(cursor, &old))
+    {
+        bson_concat(&merged, &recorded.document);
+
+        for(bson_iter_init(&it, old); bson_iter_next(&it); )
+        {
+            bson_iter_t present;
+
+            if(!bson_iter_init_find(&present, &recorded.document, bson_iter_key(&it)))
+                bson_append_iter(&merged, NULL, 0, &it);
+        }
+
+        written = mongoc_collection_replace_one(collection, &key, &merged, &replace_opts, NULL, &error)
+               && mongoc_collection_delete_one(collection, &recorded.filter, &write_opts, NULL, &error);
+    }
+    else if(!mongoc_cursor_error(cursor, &error))
+    {
+        const int64_t moved = mongoc_collection_count_documents(collection, &key, NULL, NULL, NULL, &error);
+
+        written = moved > 0;
+
+        if(moved == 0 && bson_iter_init_find(&it, &recorded.opts, "upsert") && bson_iter_as_bool(&it))
+            written = mongoc_collection_replace_one(collection, &key, &recorded.document, &replace_opts, NULL, &error);
+        else if(moved == 0)
+        {
+            char* str = bson_as_canonical_extended_json(&recorded.filter, NULL);
+
+            bson_set_error(&error, 0, 0, "document %s not found", str? str: "");
+            bson_free(str);
+
+            job.permanent = true;
+        }
+    }
+
+    if(!written)
+    {
+        std::cout << "re-key of a document of " << bulk.name << " failed: " << error.message << std::endl;
+
+        job.permanent = job.permanent || refused(error);
+    }
+
+    mongoc_cursor_destroy(cursor);
+    bson_destroy(&merged);
+    bson_destroy(&replace_opts);
+    bson_destroy(&write_opts);
+    bson_destroy(&find_opts);
+    bson_destroy(&key);
+    mongoc_collection_destroy(collection);
+
+    return written;
+}
+
+}
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
+#include <unordered_set>
+#include "psql_mongo_replication/change_batch.hpp"
+
+struct _bson_t;
+struct _mongoc_uri_t;
+struct _mongoc_client_t;
+struct _mongoc_client_pool_t;
+struct _mongoc_write_concern_t;
+
+namespace psql_mongo_replication
+{
+    // One flushed window: the writes of its runs of changes to one collection and what they
+    // may touch. The writes are recorded rather than built into mongoc bulks, which run only
+    // once, so a failed window can be written again from the first write not applied.
+    struct write_job
+    {
+        enum operation_t
+        {
+            OPERATION_INSERT,
+            OPERATION_REPLACE_ONE,
+            OPERATION_UPDATE_ONE,
+            OPERATION_REMOVE_ONE,
+            OPERATION_REMOVE_MANY,
+            OPERATION_REKEY,                // filter: the old _id, document: "d" under the new one
+        };
+
+        struct bulk_t
+        {
+            std::string name;
+            _bson_t* operations;            // {"0": {"o": operation, "f": filter, "d": document, "p": opts}, ...}
+            size_t count;
+            std::vector<size_t> retry;      // left after a failed attempt, empty for all of them
+            bool rekey;                     // a single OPERATION_REKEY, written on its own
+        };
+
+        std::vector<bulk_t> bulks;
+        size_t written = 0;                 // bulks acknowledged
+        write_set footprint;
+        unsigned long long lsn = 0;         // oldest change of the window
+        long long send_time = 0;            // ... and when the server sent it
+        size_t changes = 0;
+        size_t bytes = 0;
+        bool ordered = true;
+        const _mongoc_write_concern_t* concern = nullptr;   // the client's when null
+        unsigned attempts = 0;
+        bool permanent = false;             // refused by the server or mongoc, a retry fails again
+        std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+
+        write_job() = default;
+        write_job(const write_job&) = delete;
+        write_job& operator=(const write_job&) = delete;
+        ~write_job();
+
+        // An insert without _id gets one here, so a retried insert hits the document the
+        // failed attempt may have written instead of adding a second one.
+        void add(const std::string& collection, operation_t operation, const _bson_t* filter, const _bson_t* document, const _bson_t* opts);
+    };
+
+    // Executes the jobs of one subscriber on up to `depth` pooled connections at once, so
+    // a slow link carries several windows per round trip. A job waits only for in-flight
+    // jobs writing the same documents. Acknowledged jobs are handed back through
+    // completed(); oldest() stays at the oldest one still in flight, so the confirmed
+    // position never moves past a window that isn't written. A failed job is retried with
+    // backoff from the writes it didn't apply, it stays in flight until it is written. A
+    // write refused for good (a document the server rejects) fails the pipeline instead:
+    // the job stays in flight, later jobs are dropped and failed() tells the stream to stop.
+    class write_pipeline
+    {
+        public:
+        struct result_t
+        {
+            size_t changes;
+            size_t bytes;
+            std::chrono::microseconds latency;          // of the write
+            std::chrono::microseconds commit_latency;   // from the server sending the oldest change
+            bool failed;
+        };
+
+        private:
+        _mongoc_client_pool_t* _pool;
+        std::string _database;
+        unsigned _depth = 4;
+        std::vector<std::thread> _workers;
+        std::deque<write_job*> _queue;
+        std::map<unsigned long long, std::unique_ptr<write_job>> _in_flight;   // queued or executing, by submission order
+        std::unordered_multiset<std::string> _keys;
+        std::unordered_multiset<std::string> _collections;
+        std::unordered_multiset<std::string> _unkeyed;
+        std::vector<result_t> _completed;
+        unsigned long long _submitted = 0;
+        bool _stop = false;
+        bool _failed = false;
+        std::mutex _mutex;
+        std::condition_variable _changed;
+
+        bool conflicts(const write_set& footprint) const;
+        void track(const write_set& footprint, bool add);
+        void work();
+        bool execute(write_job& job);
+        bool write(_mongoc_client_t* client, write_job& job, write_job::bulk_t& bulk);
+        bool rekey(_mongoc_client_t* client, write_job& job, write_job::bulk_t& bulk);
+
+        public:
+        static constexpr std::chrono::milliseconds retry_backoff_min{100};
+        static constexpr std::chrono::milliseconds retry_backoff_max{30000};
+
+        write_pipeline(const _mongoc_uri_t* uri, const std::string& database);
+        ~write_pipeline();
+
+        write_pipeline(const write_pipeline&) = delete;
+        write_pipeline& operator=(const write_pipeline&) = delete;
+
+        void set_depth(unsigned depth);
+
+        // A pooled client for writes outside of jobs.
+        _mongoc_client_t* acquire_client();
+        void release_client(_mongoc_client_t* client);
+
+        // Blocks while the pipeline is full or the job overlaps one in flight; the job is
+        // dropped once the pipeline failed.
+        void submit(std::unique_ptr<write_job> job);
+
+        // Blocks until every submitted job is written or the pipeline failed.
+        void wait();
+
+        // A job was refused for good, nothing after it is written.
+        bool failed();
+
+        // Oldest window not acknowledged yet, false when none is in flight.
+        bool oldest(unsigned long long& lsn, long long& send_time);
+        std::vector<result_t> completed();
+    };
+}
@@ -1,5 +1,5 @@
-#pragma once
-
-#include <iostream>
-#include <string>
+#pragma once
+
+#include <iostream>
+#include <string>
 #include <sstream>
\ No newline at end of file
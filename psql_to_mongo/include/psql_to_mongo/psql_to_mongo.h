@@ -1,5 +1,5 @@
-#include "postgres.h"
-
-void _PG_init();
-
+#include "postgres.h"
+
+void _PG_init();
+
 void _PG_fini(void);
\ No newline at end of file
@@ -0,0 +1,39 @@
+\echo Use "ALTER EXTENSION psql_to_mongo UPDATE TO '0.0.2'" to load this file. \quit
+
+CREATE FUNCTION psql_to_mongo_replication_worker_initial_sync(text, text, text, text, text) RETURNS void
+AS 'MODULE_PATHNAME'
+LANGUAGE C VOLATILE STRICT;
+
+CREATE FUNCTION psql_to_mongo_replication_worker_stop() RETURNS boolean
+AS 'MODULE_PATHNAME'
+LANGUAGE C VOLATILE STRICT;
+
+CREATE FUNCTION psql_to_mongo_set_subscriber_option(integer, text, text) RETURNS boolean
+AS 'MODULE_PATHNAME'
+LANGUAGE C VOLATILE STRICT;
+
+CREATE FUNCTION psql_to_mongo_set_replication_option(text, text) RETURNS boolean
+AS 'MODULE_PATHNAME'
+LANGUAGE C VOLATILE STRICT;
+
+CREATE FUNCTION psql_to_mongo_stats(
+    OUT subscriber_id integer,
+    OUT queued bigint,
+    OUT applied_lsn pg_lsn,
+    OUT lag_bytes bigint,
+    OUT lag_seconds float8,
+    OUT batch_limit bigint,
+    OUT batches bigint,
+    OUT errors bigint,
+    OUT rows_applied bigint,
+    OUT rows_per_sec float8,
+    OUT bytes_per_sec float8,
+    OUT ack_p50_ms bigint,
+    OUT ack_p99_ms bigint,
+    OUT received_lsn pg_lsn,
+    OUT wal_end pg_lsn,
+    OUT updated_at timestamptz) RETURNS SETOF record
+AS 'MODULE_PATHNAME'
+LANGUAGE C VOLATILE STRICT;
+
+CREATE VIEW psql_to_mongo_stat AS SELECT * FROM psql_to_mongo_stats();
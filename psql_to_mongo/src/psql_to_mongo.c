@@ -1,412 +1,1320 @@
-//#include "psql_to_mongo/psql_to_mongo.h"
-#include "psql_mongo_replication/psql_to_mongo_c_to_cpp_call_api.h"
-#include "postgres.h"
-#include "pg_recvlogical/pg_recvlogical.h"
-#include "fmgr.h"
-#include "utils/builtins.h"
-#include "executor/spi.h"
-#include "stdint.h"
-
-PG_MODULE_MAGIC;
-
-enum { offset_for_function_args = 2};
-
-typedef enum
-{
-    subscriber_id_column = 1,
-    db_name_column,
-    host_column,
-    port_column,
-    username_column,
-    pswd_column,
-} subscribers_column_id;
-
-typedef enum
-{
-    subscribers_info_id_column = 2,
-    publication_column
-} subscribers_info_column_id;
-
-static int psql_to_mongo_get_mongo_db_count()
-{
-    int ret = SPI_exec("select * from psql_to_mongo_replication.subscribers;", 0);
-    if(ret < 0)
-    {
-        return ret;
-    }
-
-    return SPI_processed;
-}
-
-#define copyDataFromArg(data, id)\
-{\
-    VarChar *source = PG_GETARG_VARCHAR_PP(id - offset_for_function_args);\
-\
-    size_t len = VARSIZE_ANY_EXHDR(source);\
-	char* s_data = VARDATA_ANY(source);\
-\
-    memcpy(data, s_data, len);\
-    data[len] = '\0';\
-}
-
-static int psql_to_mongo_fill_subscribe_info_from_spi(
-      HeapTuple tuple
-    , TupleDesc tupdesc
-    , char **dbname
-    , char **port
-    , char **host
-    , char **password
-    , char **username
-    , int* id
-    )
-{
-    _Bool is_null = 0;
-
-    Datum val = SPI_getbinval(tuple, tupdesc, subscriber_id_column, &is_null);
-
-    if (!is_null)
-        *id = DatumGetInt64(val);
-
-    *dbname = SPI_getvalue(tuple, tupdesc, db_name_column);
-    *port = SPI_getvalue(tuple, tupdesc, port_column);
-    *host = SPI_getvalue(tuple, tupdesc, host_column);
-    *password = SPI_getvalue(tuple, tupdesc, pswd_column);
-    *username = SPI_getvalue(tuple, tupdesc, username_column);
-}
-
-static int psql_to_mongo_connect_subscribers()
-{
-    int ret = SPI_exec("select * from psql_to_mongo_replication.subscribers;", 0);
-
-    elog(INFO, "psql_to_mongo_fill_subscribers_info %d\n", SPI_processed);
-
-    if(ret < 0)
-    {
-        return ret;
-    }
-
-    TupleDesc tupdesc = SPI_tuptable->tupdesc;
-    SPITupleTable *tuptable = SPI_tuptable;
-
-    int proc = SPI_processed;
-
-    for (int i = 0; i < proc; i++)
-    {
-        HeapTuple tuple = tuptable->vals[i];
-
-        const char* dbname = NULL; 
-        const char* port = NULL;
-        const char* host = NULL;
-        const char* password = NULL;
-        const char* username = NULL;
-
-        int id = 0;
-
-        psql_to_mongo_fill_subscribe_info_from_spi(
-            tuple, tupdesc, &dbname, &port, &host, &password, &username, &id);
-
-        elog(INFO, "subscribers[%d] %s->%s:%s {%s %s}", i, dbname, host, port, password, username);
-
-        psql_mongo_replication_cpp_connect_mongo_db(dbname, host, port, username, password, id);
-    }
-
-    return SPI_processed;
-}
-
-static void psql_to_mongo_check_if_subscription_exist_or_create()
-{
-    int ret = SPI_exec("CREATE TABLE IF NOT EXISTS psql_to_mongo_replication.subscription_info(subscriber_id integer PRIMARY KEY, pubname varchar(20));", 0);
-
-    if(ret < 0)
-    {
-        elog(ERROR, "psql_to_mongo_check_if_table_exist_or_create: SPI_exec...error %s", SPI_result_code_string(ret));
-    }
-}
-
-static void init_extention()
-{
-    int ret = SPI_exec("CREATE SCHEMA IF NOT EXISTS psql_to_mongo_replication;", 0);
-
-    if(ret < 0)
-    {
-        elog(ERROR, "_PG_init: SPI_exec returned %s", SPI_result_code_string(ret));
-        return;
-    }
-
-    ret = SPI_exec("CREATE TABLE IF NOT EXISTS psql_to_mongo_replication.subscribers(\
-          subscriber_id integer PRIMARY KEY\
-        , db_name varchar(10)\
-        , host varchar(20)\
-        , port varchar(10)\
-        , username varchar(20)\
-        , pswd varchar(20));", 0);
-
-    if (ret < 0)
-    {
-        elog(ERROR, "_PG_init: SPI_execute returned %s", SPI_result_code_string(ret));
-	    return;
-    }
-
-    ret = SPI_execute("SELECT to_regclass('psql_to_mongo_replication.subscribers');", true, 0);
-    if (ret < 0)
-    {
-        elog(ERROR, "_PG_init: SPI_execute returned %s", SPI_result_code_string(ret));
-	    return;
-    }
-  
-    psql_to_mongo_check_if_subscription_exist_or_create();
-
-    psql_to_mongo_connect_subscribers(); 
-} 
-
-void _PG_init()
-{
-    elog(INFO, "psql_to_mongo extention init...OK");
-    SPI_connect();
-
-    init_extention();
-
-    SPI_finish();
-}
-
-void _PG_fini(void)
-{
-    elog(INFO, "psql_to_mongo extention deinit...OK");
-}
-
-PG_FUNCTION_INFO_V1(psql_to_mongo_add_mongo_db);
-
-Datum
-psql_to_mongo_add_mongo_db(PG_FUNCTION_ARGS)
-{
-    SPI_connect();
-
-    int mongo_last_db_id = psql_to_mongo_get_mongo_db_count();
-
-    if(mongo_last_db_id < 0)
-    {
-        elog(ERROR, "psql_to_mongo_add_mongo_db: SPI_exec...error %s", SPI_result_code_string(mongo_last_db_id));
-        PG_RETURN_VOID();
-    }
-
-    char dbname[NAMEDATALEN];
-    copyDataFromArg(dbname, db_name_column);
-
-    char port[NAMEDATALEN];
-    copyDataFromArg(port, port_column);
-
-    char host[NAMEDATALEN];
-    copyDataFromArg(host, host_column);
-
-    char password[NAMEDATALEN];
-    copyDataFromArg(password, pswd_column);
-
-    char username[NAMEDATALEN];
-    copyDataFromArg(username, username_column);
-
-    char s[200];
-    sprintf(s, "INSERT INTO psql_to_mongo_replication.subscribers VALUES (%d, '%s', '%s', '%s', '%s', '%s');", 
-                mongo_last_db_id, dbname, host, port, username, password);
-
-    elog(INFO, "psql_to_mongo_add_mongo_db: SPI_exec: %s", s);
-
-    int ret = SPI_exec(s, 0);
-
-    if(ret < 0)
-    {
-        elog(ERROR, "psql_to_mongo_add_mongo_db: SPI_exec...error %s", SPI_result_code_string(ret));
-    }
-
-    SPI_finish();
-
-    psql_mongo_replication_cpp_connect_mongo_db(dbname, host, port, username, password, mongo_last_db_id);
-
-    //psql_mongo_replication_cpp_connect_mongo_db("db_name", "127.0.0.1", "27017", "a", "123", 0);
-
-    PG_RETURN_INT32(mongo_last_db_id);
-}
-
-PG_FUNCTION_INFO_V1(psql_to_mongo_connect_to_mongo_db);
-
-Datum
-psql_to_mongo_connect_to_mongo_db(PG_FUNCTION_ARGS)
-{
-    elog(INFO, "psql_to_mongo_connect_to_mongo_db: %d\n", PG_GETARG_INT32(0));
-
-    int id = PG_GETARG_INT32(0);
-    char query[200]; 
-
-    sprintf(query, "select * from psql_to_mongo_replication.subscribers where \
-        psql_to_mongo_replication.subscribers.subscriber_id = %d;", id);
-
-    SPI_connect();
-
-    int ret = SPI_exec(query, 0);
-
-    const char *dbname = NULL;
-    const char *port = NULL;
-    const char *host = NULL;
-    const char *password = NULL;
-    const char *username = NULL;
-
-    TupleDesc tupdesc = SPI_tuptable->tupdesc;
-    SPITupleTable *tuptable = SPI_tuptable;
-    HeapTuple tuple = tuptable->vals[0];
-
-    psql_to_mongo_fill_subscribe_info_from_spi(
-        tuple, tupdesc, &dbname, &port, &host, &password, &username, &id);
-
-    elog(INFO, "subscribers[%d] %s->%s:%s {%s:%s}", id, dbname, host, port, username, password);
-
-    psql_mongo_replication_cpp_connect_mongo_db(dbname, host, port, username, password, id);
-    
-    SPI_finish();
-
-    PG_RETURN_VOID();
-}
-
-PG_FUNCTION_INFO_V1(psql_to_mongo_reconnect_to_mongo_db);
-
-Datum 
-psql_to_mongo_reconnect_to_mongo_db(PG_FUNCTION_ARGS)
-{
-    elog(INFO, "psql_to_mongo_reconnect_to_mongo_db: %d\n", PG_GETARG_INT32(0));
-
-    int id = PG_GETARG_INT32(0);
-
-    //psql_mongo_replication_cpp_reconnect_mongo_db(id);
-
-    PG_RETURN_VOID();
-}
-
-PG_FUNCTION_INFO_V1(psql_to_mongo_remove_from_mongo_db);
-
-Datum
-psql_to_mongo_remove_from_mongo_db(PG_FUNCTION_ARGS)
-{
-    elog(INFO, "psql_to_mongo_remove_from_mongo_db: %d\n", PG_GETARG_INT32(0));
-
-    PG_RETURN_VOID();
-}
-
-static int psql_to_mongo_is_exist_pg_publication(const char* pubname)
-{
-    char query[100]; 
-    sprintf(query, "select * from pg_publication_tables where pubname = '%s';", pubname);
-    elog(INFO, "psql_to_mongo_is_exist_pg_publication: query [%s]", query);
-
-    int ret = SPI_exec(query, 0);
-
-    if(ret < 0)
-    {
-        elog(ERROR, "psql_to_mongo_is_exist_pg_publication: SPI_exec...error %s", SPI_result_code_string(ret));
-        return ret;
-    }
-
-    return SPI_processed;
-}
-
-static void psql_to_mongo_add_subscription(int mongo_last_db_id, const char* pubname)
-{
-    char query[100]; 
-    sprintf(query, "INSERT into psql_to_mongo_replication.subscription_info VALUES (%d,'%s');", mongo_last_db_id, pubname);
-
-    elog(INFO, "psql_to_mongo_add_subscription: query [%s]", query);
-
-    int ret = SPI_exec(query, 0);
-    if(ret < 0)
-    {
-        elog(ERROR, "psql_to_mongo_add_subscription: SPI_exec...error %s", SPI_result_code_string(ret));
-    }
-}
-
-PG_FUNCTION_INFO_V1(psql_to_mongo_subscribe);
-
-Datum
-psql_to_mongo_subscribe(PG_FUNCTION_ARGS)
-{
-    elog(INFO, "psql_to_mongo_subscribe: ");
- 
-    if(PG_NARGS() != 2)
-    {   
-        elog(ERROR, "psql_to_mongo_subscribe: PG_NARGS to few %d", PG_NARGS());
-        PG_RETURN_VOID();
-    }
-
-    SPI_connect();
-
-    int32 mongo_db_id = PG_GETARG_INT32(0);
-/*
-  pubname  | schemaname | tablename 
------------+------------+-----------
- mypub     | public     | users
- alltables | public     | books
-*/
-    text *str = PG_GETARG_TEXT_PP(1);
-
-    char pubname[NAMEDATALEN];
-    copyDataFromArg(pubname, publication_column);
-
-    elog(INFO, "mongo_db_id: %d, pub name: [%s]\n", mongo_db_id, pubname);
-
-    if(psql_to_mongo_is_exist_pg_publication(pubname))
-    {
-        psql_to_mongo_add_subscription(mongo_db_id, pubname);
-    }
-
-    SPI_finish();
-
-    PG_RETURN_VOID();
-}
-
-PG_FUNCTION_INFO_V1(psql_to_mongo_unsubscribe);
-
-Datum
-psql_to_mongo_unsubscribe(PG_FUNCTION_ARGS)
-{
-    elog(INFO, "psql_to_mongo_unsubscribe: %d\n", PG_GETARG_INT32(0));
-
-    PG_RETURN_VOID();
-}
-
-PG_FUNCTION_INFO_V1(psql_to_mongo_replication_worker_start);
-
-Datum
-psql_to_mongo_replication_worker_start(PG_FUNCTION_ARGS)
-{
-    elog(INFO, "psql_to_mongo_replication_worker_start: \n");
-
-    if(PG_NARGS() != 5)
-    {
-        elog(ERROR, "psql_to_mongo_replication_worker_start: PG_NARGS to few %d", PG_NARGS());
-        PG_RETURN_VOID();
-    }
-
-    char dbname[NAMEDATALEN];
-    copyDataFromArg(dbname, db_name_column);
-
-    char port[NAMEDATALEN];
-    copyDataFromArg(port, port_column);
-
-    char host[NAMEDATALEN];
-    copyDataFromArg(host, host_column);
-
-    char username[NAMEDATALEN];
-    copyDataFromArg(username, username_column);
-
-    char password[NAMEDATALEN];
-    copyDataFromArg(password, pswd_column);
-
-    elog(INFO, "psql_mongo_replication_cpp_start_replication: '%s', '%s', '%s', '%s', '%s'\n", dbname, host, port, username, password);
-
-    psql_mongo_replication_cpp_start_replication(
-          dbname
-        , host
-        , port
-        , username
-        , password);
-
-    elog(INFO, "psql_mongo_replication_cpp_started_replication: SUCCESS\n");
-
-    PG_RETURN_VOID();
-}
\ No newline at end of file
+//#include "psql_to_mongo/psql_to_mongo.h"
+#include "psql_mongo_replication/psql_to_mongo_c_to_cpp_call_api.h"
+#include "psql_mongo_replication/psql_to_mongo_stats.h"
+#include "postgres.h"
+#include "pg_recvlogical/pg_recvlogical.h"
+#include "fmgr.h"
+#include "utils/builtins.h"
+#include "executor/spi.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "nodes/makefuncs.h"
+#include "pgstat.h"
+#include "port/atomics.h"
+#include "access/xact.h"
+#include "access/xlog.h"
+#include "access/xlogreader.h"
+#include "postmaster/bgworker.h"
+#include "postmaster/postmaster.h"
+#include "replication/logical.h"
+#include "replication/logicalfuncs.h"
+#include "replication/slot.h"
+#include "storage/ipc.h"
+#include "storage/latch.h"
+#include "storage/procarray.h"
+#include "storage/s_lock.h"
+#include "utils/guc.h"
+#include "utils/snapmgr.h"
+#include "utils/pg_lsn.h"
+#include "utils/timestamp.h"
+#include "utils/tuplestore.h"
+#include "stdint.h"
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+PG_MODULE_MAGIC;
+
+enum { offset_for_function_args = 2};
+
+typedef enum
+{
+    subscriber_id_column = 1,
+    db_name_column,
+    host_column,
+    port_column,
+    username_column,
+    pswd_column,
+} subscribers_column_id;
+
+typedef enum
+{
+    subscribers_info_id_column = 2,
+    publication_column
+} subscribers_info_column_id;
+
+static int psql_to_mongo_get_mongo_db_count()
+{
+    int ret = SPI_exec("select * from psql_to_mongo_replication.subscribers;", 0);
+    if(ret < 0)
+    {
+        return ret;
+    }
+
+    return SPI_processed;
+}
+
+#define copyDataFromArg(data, id)\
+{\
+    VarChar *source = PG_GETARG_VARCHAR_PP(id - offset_for_function_args);\
+\
+    size_t len = VARSIZE_ANY_EXHDR(source);\
+	char* s_data = VARDATA_ANY(source);\
+\
+    memcpy(data, s_data, len);\
+    data[len] = '\0';\
+}
+
+static int psql_to_mongo_fill_subscribe_info_from_spi(
+      HeapTuple tuple
+    , TupleDesc tupdesc
+    , char **dbname
+    , char **port
+    , char **host
+    , char **password
+    , char **username
+    , int* id
+    )
+{
+    _Bool is_null = 0;
+
+    Datum val = SPI_getbinval(tuple, tupdesc, subscriber_id_column, &is_null);
+
+    if (!is_null)
+        *id = DatumGetInt64(val);
+
+    *dbname = SPI_getvalue(tuple, tupdesc, db_name_column);
+    *port = SPI_getvalue(tuple, tupdesc, port_column);
+    *host = SPI_getvalue(tuple, tupdesc, host_column);
+    *password = SPI_getvalue(tuple, tupdesc, pswd_column);
+    *username = SPI_getvalue(tuple, tupdesc, username_column);
+}
+
+static int psql_to_mongo_connect_subscribers()
+{
+    int ret = SPI_exec("select * from psql_to_mongo_replication.subscribers;", 0);
+
+    elog(INFO, "psql_to_mongo_fill_subscribers_info %d\n", SPI_processed);
+
+    if(ret < 0)
+    {
+        return ret;
+    }
+
+    TupleDesc tupdesc = SPI_tuptable->tupdesc;
+    SPITupleTable *tuptable = SPI_tuptable;
+
+    int proc = SPI_processed;
+
+    for (int i = 0; i < proc; i++)
+    {
+        HeapTuple tuple = tuptable->vals[i];
+
+        const char* dbname = NULL; 
+        const char* port = NULL;
+        const char* host = NULL;
+        const char* password = NULL;
+        const char* username = NULL;
+
+        int id = 0;
+
+        psql_to_mongo_fill_subscribe_info_from_spi(
+            tuple, tupdesc, &dbname, &port, &host, &password, &username, &id);
+
+        elog(INFO, "subscribers[%d] %s->%s:%s {%s %s}", i, dbname, host, port, password, username);
+
+        psql_mongo_replication_cpp_connect_mongo_db(dbname, host, port, username, password, id);
+    }
+
+    return SPI_processed;
+}
+
+/*
+ * Replica identity (or primary key) columns of every table published to a subscriber,
+ * pushed to the replication side as key_columns.<table> options.
+ */
+static void psql_to_mongo_push_key_columns(int subscriber_id)
+{
+    char *query = psprintf(
+        "SELECT s.subscriber_id, t.tablename, string_agg(a.attname::text, ',' ORDER BY k.n) "
+        "FROM psql_to_mongo_replication.subscription_info s "
+        "JOIN pg_publication_tables t ON t.pubname = s.pubname "
+        "JOIN pg_index i ON i.indrelid = format('%%I.%%I', t.schemaname, t.tablename)::regclass "
+        "AND (i.indisreplident OR (i.indisprimary AND NOT EXISTS "
+            "(SELECT 1 FROM pg_index r WHERE r.indrelid = i.indrelid AND r.indisreplident))) "
+        "CROSS JOIN LATERAL unnest(i.indkey::int2[]) WITH ORDINALITY AS k(attnum, n) "
+        "JOIN pg_attribute a ON a.attrelid = i.indrelid AND a.attnum = k.attnum "
+        "%s GROUP BY s.subscriber_id, t.tablename;",
+        subscriber_id < 0 ? "" : psprintf("WHERE s.subscriber_id = %d", subscriber_id));
+
+    int ret = SPI_exec(query, 0);
+
+    if(ret < 0)
+    {
+        elog(ERROR, "psql_to_mongo_push_key_columns: SPI_exec...error %s", SPI_result_code_string(ret));
+        return;
+    }
+
+    TupleDesc tupdesc = SPI_tuptable->tupdesc;
+    SPITupleTable *tuptable = SPI_tuptable;
+
+    for (uint64 i = 0; i < SPI_processed; i++)
+    {
+        HeapTuple tuple = tuptable->vals[i];
+        _Bool is_null = 0;
+
+        int id = DatumGetInt32(SPI_getbinval(tuple, tupdesc, 1, &is_null));
+        char *name = psprintf("key_columns.%s", SPI_getvalue(tuple, tupdesc, 2));
+        char *columns = SPI_getvalue(tuple, tupdesc, 3);
+
+        elog(INFO, "subscribers[%d] %s = %s", id, name, columns);
+
+        psql_mongo_replication_cpp_set_subscriber_option(id, name, columns);
+    }
+}
+
+static void psql_to_mongo_apply_subscriber_options()
+{
+    int ret = SPI_exec("select subscriber_id, name, value from psql_to_mongo_replication.subscriber_options;", 0);
+
+    if(ret < 0)
+    {
+        elog(ERROR, "psql_to_mongo_apply_subscriber_options: SPI_exec...error %s", SPI_result_code_string(ret));
+        return;
+    }
+
+    TupleDesc tupdesc = SPI_tuptable->tupdesc;
+    SPITupleTable *tuptable = SPI_tuptable;
+
+    for (uint64 i = 0; i < SPI_processed; i++)
+    {
+        HeapTuple tuple = tuptable->vals[i];
+        _Bool is_null = 0;
+
+        int id = DatumGetInt32(SPI_getbinval(tuple, tupdesc, 1, &is_null));
+
+        psql_mongo_replication_cpp_set_subscriber_option(
+            id, SPI_getvalue(tuple, tupdesc, 2), SPI_getvalue(tuple, tupdesc, 3));
+    }
+}
+
+static void psql_to_mongo_apply_replication_options()
+{
+    int ret = SPI_exec("select name, value from psql_to_mongo_replication.replication_options;", 0);
+
+    if(ret < 0)
+    {
+        elog(ERROR, "psql_to_mongo_apply_replication_options: SPI_exec...error %s", SPI_result_code_string(ret));
+        return;
+    }
+
+    TupleDesc tupdesc = SPI_tuptable->tupdesc;
+    SPITupleTable *tuptable = SPI_tuptable;
+
+    for (uint64 i = 0; i < SPI_processed; i++)
+    {
+        HeapTuple tuple = tuptable->vals[i];
+
+        psql_mongo_replication_cpp_set_replication_option(
+            SPI_getvalue(tuple, tupdesc, 1), SPI_getvalue(tuple, tupdesc, 2));
+    }
+}
+
+static void psql_to_mongo_check_if_subscription_exist_or_create()
+{
+    int ret = SPI_exec("CREATE TABLE IF NOT EXISTS psql_to_mongo_replication.subscription_info(subscriber_id integer PRIMARY KEY, pubname varchar(20));", 0);
+
+    if(ret < 0)
+    {
+        elog(ERROR, "psql_to_mongo_check_if_table_exist_or_create: SPI_exec...error %s", SPI_result_code_string(ret));
+    }
+}
+
+static void init_extention()
+{
+    int ret = SPI_exec("CREATE SCHEMA IF NOT EXISTS psql_to_mongo_replication;", 0);
+
+    if(ret < 0)
+    {
+        elog(ERROR, "_PG_init: SPI_exec returned %s", SPI_result_code_string(ret));
+        return;
+    }
+
+    ret = SPI_exec("CREATE TABLE IF NOT EXISTS psql_to_mongo_replication.subscribers(\
+          subscriber_id integer PRIMARY KEY\
+        , db_name varchar(10)\
+        , host varchar(20)\
+        , port varchar(10)\
+        , username varchar(20)\
+        , pswd varchar(20));", 0);
+
+    if (ret < 0)
+    {
+        elog(ERROR, "_PG_init: SPI_execute returned %s", SPI_result_code_string(ret));
+	    return;
+    }
+
+    ret = SPI_execute("SELECT to_regclass('psql_to_mongo_replication.subscribers');", true, 0);
+    if (ret < 0)
+    {
+        elog(ERROR, "_PG_init: SPI_execute returned %s", SPI_result_code_string(ret));
+	    return;
+    }
+  
+    psql_to_mongo_check_if_subscription_exist_or_create();
+
+    ret = SPI_exec("CREATE TABLE IF NOT EXISTS psql_to_mongo_replication.subscriber_options(\
+          subscriber_id integer\
+        , name varchar(64)\
+        , value text\
+        , PRIMARY KEY (subscriber_id, name));", 0);
+
+    if (ret < 0)
+    {
+        elog(ERROR, "_PG_init: SPI_execute returned %s", SPI_result_code_string(ret));
+	    return;
+    }
+
+    ret = SPI_exec("CREATE TABLE IF NOT EXISTS psql_to_mongo_replication.replication_options(\
+          name varchar(64) PRIMARY KEY\
+        , value text);", 0);
+
+    if (ret < 0)
+    {
+        elog(ERROR, "_PG_init: SPI_execute returned %s", SPI_result_code_string(ret));
+	    return;
+    }
+
+    psql_to_mongo_apply_replication_options();
+
+    psql_to_mongo_connect_subscribers(); 
+
+    psql_to_mongo_push_key_columns(-1);
+
+    psql_to_mongo_apply_subscriber_options();
+} 
+
+static void psql_to_mongo_define_settings();
+static void psql_to_mongo_worker_register();
+
+void _PG_init()
+{
+    psql_to_mongo_define_settings();
+
+    /* the worker sets itself up once it has a database connection */
+    if(IsBackgroundWorker)
+        return;
+
+    if(process_shared_preload_libraries_in_progress)
+    {
+        psql_to_mongo_worker_register();
+        return;
+    }
+
+    elog(INFO, "psql_to_mongo extention init...OK");
+    SPI_connect();
+
+    init_extention();
+
+    SPI_finish();
+}
+
+void _PG_fini(void)
+{
+    elog(INFO, "psql_to_mongo extention deinit...OK");
+}
+
+PG_FUNCTION_INFO_V1(psql_to_mongo_add_mongo_db);
+
+Datum
+psql_to_mongo_add_mongo_db(PG_FUNCTION_ARGS)
+{
+    SPI_connect();
+
+    int mongo_last_db_id = psql_to_mongo_get_mongo_db_count();
+
+    if(mongo_last_db_id < 0)
+    {
+        elog(ERROR, "psql_to_mongo_add_mongo_db: SPI_exec...error %s", SPI_result_code_string(mongo_last_db_id));
+        PG_RETURN_VOID();
+    }
+
+    char dbname[NAMEDATALEN];
+    copyDataFromArg(dbname, db_name_column);
+
+    char port[NAMEDATALEN];
+    copyDataFromArg(port, port_column);
+
+    char host[NAMEDATALEN];
+    copyDataFromArg(host, host_column);
+
+    char password[NAMEDATALEN];
+    copyDataFromArg(password, pswd_column);
+
+    char username[NAMEDATALEN];
+    copyDataFromArg(username, username_column);
+
+    char s[200];
+    sprintf(s, "INSERT INTO psql_to_mongo_replication.subscribers VALUES (%d, '%s', '%s', '%s', '%s', '%s');", 
+                mongo_last_db_id, dbname, host, port, username, password);
+
+    elog(INFO, "psql_to_mongo_add_mongo_db: SPI_exec: %s", s);
+
+    int ret = SPI_exec(s, 0);
+
+    if(ret < 0)
+    {
+        elog(ERROR, "psql_to_mongo_add_mongo_db: SPI_exec...error %s", SPI_result_code_string(ret));
+    }
+
+    SPI_finish();
+
+    psql_mongo_replication_cpp_connect_mongo_db(dbname, host, port, username, password, mongo_last_db_id);
+
+    //psql_mongo_replication_cpp_connect_mongo_db("db_name", "127.0.0.1", "27017", "a", "123", 0);
+
+    PG_RETURN_INT32(mongo_last_db_id);
+}
+
+PG_FUNCTION_INFO_V1(psql_to_mongo_connect_to_mongo_db);
+
+Datum
+psql_to_mongo_connect_to_mongo_db(PG_FUNCTION_ARGS)
+{
+    elog(INFO, "psql_to_mongo_connect_to_mongo_db: %d\n", PG_GETARG_INT32(0));
+
+    int id = PG_GETARG_INT32(0);
+    char query[200]; 
+
+    sprintf(query, "select * from psql_to_mongo_replication.subscribers where \
+        psql_to_mongo_replication.subscribers.subscriber_id = %d;", id);
+
+    SPI_connect();
+
+    int ret = SPI_exec(query, 0);
+
+    const char *dbname = NULL;
+    const char *port = NULL;
+    const char *host = NULL;
+    const char *password = NULL;
+    const char *username = NULL;
+
+    TupleDesc tupdesc = SPI_tuptable->tupdesc;
+    SPITupleTable *tuptable = SPI_tuptable;
+    HeapTuple tuple = tuptable->vals[0];
+
+    psql_to_mongo_fill_subscribe_info_from_spi(
+        tuple, tupdesc, &dbname, &port, &host, &password, &username, &id);
+
+    elog(INFO, "subscribers[%d] %s->%s:%s {%s:%s}", id, dbname, host, port, username, password);
+
+    psql_mongo_replication_cpp_connect_mongo_db(dbname, host, port, username, password, id);
+    
+    SPI_finish();
+
+    PG_RETURN_VOID();
+}
+
+PG_FUNCTION_INFO_V1(psql_to_mongo_reconnect_to_mongo_db);
+
+Datum 
+psql_to_mongo_reconnect_to_mongo_db(PG_FUNCTION_ARGS)
+{
+    elog(INFO, "psql_to_mongo_reconnect_to_mongo_db: %d\n", PG_GETARG_INT32(0));
+
+    int id = PG_GETARG_INT32(0);
+
+    //psql_mongo_replication_cpp_reconnect_mongo_db(id);
+
+    PG_RETURN_VOID();
+}
+
+PG_FUNCTION_INFO_V1(psql_to_mongo_remove_from_mongo_db);
+
+Datum
+psql_to_mongo_remove_from_mongo_db(PG_FUNCTION_ARGS)
+{
+    elog(INFO, "psql_to_mongo_remove_from_mongo_db: %d\n", PG_GETARG_INT32(0));
+
+    PG_RETURN_VOID();
+}
+
+static int psql_to_mongo_is_exist_pg_publication(const char* pubname)
+{
+    char query[100]; 
+    sprintf(query, "select * from pg_publication_tables where pubname = '%s';", pubname);
+    elog(INFO, "psql_to_mongo_is_exist_pg_publication: query [%s]", query);
+
+    int ret = SPI_exec(query, 0);
+
+    if(ret < 0)
+    {
+        elog(ERROR, "psql_to_mongo_is_exist_pg_publication: SPI_exec...error %s", SPI_result_code_string(ret));
+        return ret;
+    }
+
+    return SPI_processed;
+}
+
+static void psql_to_mongo_add_subscription(int mongo_last_db_id, const char* pubname)
+{
+    char query[100]; 
+    sprintf(query, "INSERT into psql_to_mongo_replication.subscription_info VALUES (%d,'%s');", mongo_last_db_id, pubname);
+
+    elog(INFO, "psql_to_mongo_add_subscription: query [%s]", query);
+
+    int ret = SPI_exec(query, 0);
+    if(ret < 0)
+    {
+        elog(ERROR, "psql_to_mongo_add_subscription: SPI_exec...error %s", SPI_result_code_string(ret));
+    }
+}
+
+PG_FUNCTION_INFO_V1(psql_to_mongo_subscribe);
+
+Datum
+psql_to_mongo_subscribe(PG_FUNCTION_ARGS)
+{
+    elog(INFO, "psql_to_mongo_subscribe: ");
+ 
+    if(PG_NARGS() != 2)
+    {   
+        elog(ERROR, "psql_to_mongo_subscribe: PG_NARGS to few %d", PG_NARGS());
+        PG_RETURN_VOID();
+    }
+
+    SPI_connect();
+
+    int32 mongo_db_id = PG_GETARG_INT32(0);
+/*
+  pubname  | schemaname | tablename 
+-----------+------------+-----------
+ mypub     | public     | users
+ alltables | public     | books
+*/
+    text *str = PG_GETARG_TEXT_PP(1);
+
+    char pubname[NAMEDATALEN];
+    copyDataFromArg(pubname, publication_column);
+
+    elog(INFO, "mongo_db_id: %d, pub name: [%s]\n", mongo_db_id, pubname);
+
+    if(psql_to_mongo_is_exist_pg_publication(pubname))
+    {
+        psql_to_mongo_add_subscription(mongo_db_id, pubname);
+
+        psql_to_mongo_push_key_columns(mongo_db_id);
+    }
+
+    SPI_finish();
+
+    PG_RETURN_VOID();
+}
+
+PG_FUNCTION_INFO_V1(psql_to_mongo_unsubscribe);
+
+Datum
+psql_to_mongo_unsubscribe(PG_FUNCTION_ARGS)
+{
+    elog(INFO, "psql_to_mongo_unsubscribe: %d\n", PG_GETARG_INT32(0));
+
+    PG_RETURN_VOID();
+}
+
+/*
+ * The replication worker and the backends share POSIX shared memory segments named after
+ * the cluster port: its control block and the counters psql_to_mongo_stats() reads. Main
+ * shared memory would need shared_preload_libraries, the extension works without it.
+ */
+static void* psql_to_mongo_shm_attach(const char* prefix, size_t size, bool writable)
+{
+    char name[NAMEDATALEN];
+    snprintf(name, sizeof(name), "/%s.%d", prefix, PostPortNumber);
+
+    int fd = shm_open(name, writable? O_RDWR | O_CREAT: O_RDONLY, 0600);
+
+    if(fd < 0)
+    {
+        if(writable)
+            elog(WARNING, "psql_to_mongo_shm_attach: shm_open %s...error %m", name);
+
+        return NULL;
+    }
+
+    /* a new segment reads as zeros, an existing one keeps its size */
+    if(writable && ftruncate(fd, size) != 0)
+    {
+        elog(WARNING, "psql_to_mongo_shm_attach: ftruncate %s...error %m", name);
+        close(fd);
+        return NULL;
+    }
+
+    void* segment = mmap(NULL, size, writable? PROT_READ | PROT_WRITE: PROT_READ, MAP_SHARED, fd, 0);
+
+    close(fd);
+
+    if(segment == MAP_FAILED)
+    {
+        elog(WARNING, "psql_to_mongo_shm_attach: mmap %s...error %m", name);
+        return NULL;
+    }
+
+    return segment;
+}
+
+static const struct psql_to_mongo_stats_t* psql_to_mongo_stats_attach()
+{
+    static const struct psql_to_mongo_stats_t* stats = NULL;
+
+    if(stats == NULL)
+        stats = psql_to_mongo_shm_attach("psql_to_mongo_stats", sizeof(struct psql_to_mongo_stats_t), false);
+
+    return stats;
+}
+
+/*
+ * Seqlock read of a slot the worker may be writing: retry while the count is odd or moved.
+ */
+static bool psql_to_mongo_stats_copy(void* copy, const volatile void* source, size_t size, const psql_to_mongo_changecount_t* changecount)
+{
+    for(int attempt = 0; attempt < 1000; ++attempt)
+    {
+        uint32_t before = atomic_load_explicit(changecount, memory_order_acquire);
+
+        memcpy(copy, (const void*) source, size);
+        atomic_thread_fence(memory_order_acquire);
+
+        if((before & 1) == 0 && before == atomic_load_explicit(changecount, memory_order_relaxed))
+            return true;
+
+        pg_spin_delay();
+    }
+
+    return false;
+}
+
+/*
+ * One replication worker per cluster, it streams the slot until it is told to stop. A
+ * backend starting it leaves the source connection here; the worker publishes its pid.
+ * The password is not kept here, this segment outlives the worker: it is passed in the
+ * registration's bgw_extra, which ends with the worker. So does the pid of a worker that
+ * died without its exit callback; it counts only with the postmaster start time it was
+ * published under and while it is a backend of this cluster.
+ */
+typedef struct
+{
+    pg_atomic_uint32 starting;
+    volatile pid_t pid;
+    volatile TimestampTz postmaster_start;
+    bool initial_sync;          /* copy the tables before streaming, once */
+    char dbname[NAMEDATALEN];
+    char host[NAMEDATALEN];
+    char port[NAMEDATALEN];
+    char username[NAMEDATALEN];
+} psql_to_mongo_worker_control_t;
+
+enum
+{
+    worker_restart_seconds = 10,
+    psql_to_mongo_local_idle_ms = 50,       /* as the stream's idle interval */
+    psql_to_mongo_local_confirm_ms = 1000
+};
+
+static char* psql_to_mongo_worker_database = NULL;
+static char* psql_to_mongo_worker_host = NULL;
+static char* psql_to_mongo_worker_port = NULL;
+static char* psql_to_mongo_worker_username = NULL;
+static bool psql_to_mongo_in_process = false;
+
+static volatile sig_atomic_t psql_to_mongo_worker_got_sigterm = false;
+static volatile sig_atomic_t psql_to_mongo_worker_got_sighup = false;
+
+PGDLLEXPORT void psql_to_mongo_worker_main(Datum main_arg);
+
+static psql_to_mongo_worker_control_t* psql_to_mongo_worker_control()
+{
+    static psql_to_mongo_worker_control_t* control = NULL;
+
+    if(control == NULL)
+        control = psql_to_mongo_shm_attach("psql_to_mongo_control", sizeof(psql_to_mongo_worker_control_t), true);
+
+    return control;
+}
+
+static pid_t psql_to_mongo_worker_pid(const psql_to_mongo_worker_control_t* control)
+{
+    pid_t pid = control->pid;
+
+    if(pid == 0 || control->postmaster_start != PgStartTime)
+        return 0;
+
+    return BackendPidGetProc(pid) != NULL? pid: 0;
+}
+
+static void psql_to_mongo_worker_signal(int signal)
+{
+    psql_to_mongo_worker_control_t* control = psql_to_mongo_worker_control();
+    pid_t pid = control? psql_to_mongo_worker_pid(control): 0;
+
+    if(pid != 0)
+        kill(pid, signal);
+}
+
+static void psql_to_mongo_worker_fill(BackgroundWorker* worker, bool dynamic)
+{
+    memset(worker, 0, sizeof(*worker));
+
+    worker->bgw_flags = BGWORKER_SHMEM_ACCESS | BGWORKER_BACKEND_DATABASE_CONNECTION;
+    worker->bgw_start_time = BgWorkerStart_RecoveryFinished;
+    worker->bgw_restart_time = worker_restart_seconds;
+    worker->bgw_main_arg = BoolGetDatum(dynamic);
+    snprintf(worker->bgw_name, BGW_MAXLEN, "psql_to_mongo replication worker");
+    snprintf(worker->bgw_type, BGW_MAXLEN, "psql_to_mongo replication worker");
+    snprintf(worker->bgw_library_name, BGW_MAXLEN, "psql_to_mongo");
+    snprintf(worker->bgw_function_name, BGW_MAXLEN, "psql_to_mongo_worker_main");
+}
+
+static void psql_to_mongo_worker_sigterm(SIGNAL_ARGS)
+{
+    int save_errno = errno;
+
+    psql_to_mongo_worker_got_sigterm = true;
+    psql_mongo_replication_cpp_stop_replication();
+    SetLatch(MyLatch);
+
+    errno = save_errno;
+}
+
+static void psql_to_mongo_worker_sighup(SIGNAL_ARGS)
+{
+    int save_errno = errno;
+
+    psql_to_mongo_worker_got_sighup = true;
+    SetLatch(MyLatch);
+
+    errno = save_errno;
+}
+
+static void psql_to_mongo_worker_exit(int code, Datum arg)
+{
+    psql_to_mongo_worker_control_t* control = psql_to_mongo_worker_control();
+
+    if(control && control->pid == MyProcPid)
+        control->pid = 0;
+}
+
+/* The options the setters persisted since the worker started, or its last reload. */
+static void psql_to_mongo_worker_reload()
+{
+    SetCurrentStatementStartTimestamp();
+    StartTransactionCommand();
+    SPI_connect();
+    PushActiveSnapshot(GetTransactionSnapshot());
+
+    psql_to_mongo_apply_replication_options();
+
+    psql_to_mongo_push_key_columns(-1);
+
+    psql_to_mongo_apply_subscriber_options();
+
+    SPI_finish();
+    PopActiveSnapshot();
+    CommitTransactionCommand();
+}
+
+/*
+ * Zeroes what a previous worker published, through the seqlock of each slot as the library
+ * writes it: a backend may be copying a slot meanwhile. A count a worker left odd when it
+ * died is already odd, the write ends it.
+ */
+static void psql_to_mongo_stats_zero(psql_to_mongo_changecount_t* changecount, void* fields, size_t size)
+{
+    if((atomic_load_explicit(changecount, memory_order_relaxed) & 1) == 0)
+    {
+        atomic_fetch_add_explicit(changecount, 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+    }
+
+    memset(fields, 0, size);
+
+    atomic_fetch_add_explicit(changecount, 1, memory_order_release);
+}
+
+static void psql_to_mongo_stats_reset(struct psql_to_mongo_stats_t* stats)
+{
+    const size_t header = offsetof(struct psql_to_mongo_stats_t, subscriber_count);
+    const size_t slot = offsetof(struct psql_to_mongo_subscriber_stats_t, subscriber_id);
+
+    psql_to_mongo_stats_zero(&stats->changecount, (char*) stats + header, offsetof(struct psql_to_mongo_stats_t, subscribers) - header);
+
+    for(int i = 0; i < PSQL_TO_MONGO_STATS_MAX_SUBSCRIBERS; ++i)
+        psql_to_mongo_stats_zero(&stats->subscribers[i].changecount, (char*) &stats->subscribers[i] + slot, sizeof(stats->subscribers[i]) - slot);
+}
+
+/* Runs on the stream loop between messages, the worker's only thread calling into postgres. */
+static void psql_to_mongo_worker_on_idle()
+{
+    if(psql_to_mongo_worker_got_sighup)
+    {
+        psql_to_mongo_worker_got_sighup = false;
+
+        ProcessConfigFile(PGC_SIGHUP);
+
+        elog(LOG, "psql_to_mongo_worker: reloading options");
+
+        psql_to_mongo_worker_reload();
+    }
+
+    ResetLatch(MyLatch);
+}
+
+#if PG_VERSION_NUM < 130000
+
+/*
+ * In-process decoding: the worker reads WAL and runs the output plugin on the slot itself,
+ * the way pg_logical_slot_get_changes() does, and hands each message to the replication
+ * library as it is written. No loopback connection, COPY framing or walsender in between.
+ */
+static int psql_to_mongo_local_read_page(XLogReaderState* state, XLogRecPtr target_page,
+    int req_len, XLogRecPtr target_rec, char* cur_page)
+{
+    /* while the WAL we need isn't flushed yet the stream is idle: flush due batches */
+    while(!psql_to_mongo_worker_got_sigterm && !psql_mongo_replication_cpp_failed() && GetFlushRecPtr() < target_page + req_len)
+    {
+        psql_mongo_replication_cpp_on_local_idle(GetFlushRecPtr());
+
+        psql_to_mongo_worker_on_idle();
+
+        WaitLatch(MyLatch, WL_LATCH_SET | WL_TIMEOUT | WL_EXIT_ON_PM_DEATH,
+            psql_to_mongo_local_idle_ms, PG_WAIT_EXTENSION);
+    }
+
+    if(psql_to_mongo_worker_got_sigterm || psql_mongo_replication_cpp_failed())
+        return -1;
+
+    return logical_read_local_xlog_page(state, target_page, req_len, target_rec, cur_page);
+}
+
+static void psql_to_mongo_local_prepare_write(LogicalDecodingContext* ctx, XLogRecPtr lsn, TransactionId xid, bool last_write)
+{
+    resetStringInfo(ctx->out);
+}
+
+static void psql_to_mongo_local_write(LogicalDecodingContext* ctx, XLogRecPtr lsn, TransactionId xid, bool last_write)
+{
+    /* the send time of a local message is when it was decoded */
+    long long now = GetCurrentTimestamp()
+        + (long long) (POSTGRES_EPOCH_JDATE - UNIX_EPOCH_JDATE) * SECS_PER_DAY * USECS_PER_SEC;
+
+    psql_mongo_replication_cpp_on_local_changes(ctx->out->data, ctx->out->len, lsn, GetFlushRecPtr(), now);
+}
+
+static List* psql_to_mongo_local_options(const char* options)
+{
+    List* list = NIL;
+
+    if(options == NULL)
+        return list;
+
+    char* copy = pstrdup(options);
+    char* save = NULL;
+
+    for(char* option = strtok_r(copy, ",", &save); option != NULL; option = strtok_r(NULL, ",", &save))
+    {
+        char* value = strchr(option, '=');
+
+        if(value)
+            *value++ = '\0';
+
+        list = lappend(list, makeDefElem(pstrdup(option), value? (Node*) makeString(pstrdup(value)): NULL, -1));
+    }
+
+    return list;
+}
+
+static void psql_to_mongo_decode_local()
+{
+    const char* slot = NULL;
+    const char* options = NULL;
+
+    psql_mongo_replication_cpp_start_local(&slot, &options);
+
+    CheckLogicalDecodingRequirements();
+
+    ReplicationSlotAcquire(slot, true);
+
+    LogicalDecodingContext* ctx = CreateDecodingContext(InvalidXLogRecPtr, psql_to_mongo_local_options(options), false,
+        psql_to_mongo_local_read_page, psql_to_mongo_local_prepare_write, psql_to_mongo_local_write, NULL);
+
+    elog(LOG, "psql_to_mongo_worker: decoding slot %s in-process from %X/%X", slot,
+        (uint32) (MyReplicationSlot->data.confirmed_flush >> 32), (uint32) MyReplicationSlot->data.confirmed_flush);
+
+    XLogRecPtr start = MyReplicationSlot->data.restart_lsn;
+    XLogRecPtr confirmed = MyReplicationSlot->data.confirmed_flush;
+    TimestampTz confirmed_at = GetCurrentTimestamp();
+
+    /* after a failed apply the worker exits and is restarted from the confirmed position */
+    while(!psql_to_mongo_worker_got_sigterm && !psql_mongo_replication_cpp_failed())
+    {
+        char* error = NULL;
+        XLogRecord* record = XLogReadRecord(ctx->reader, start, &error);
+
+        start = InvalidXLogRecPtr;
+
+        if(error)
+            elog(ERROR, "psql_to_mongo_worker: %s", error);
+
+        if(record != NULL)
+            LogicalDecodingProcessRecord(ctx, ctx->reader);
+
+        /* the slot only moves to what every subscriber has written */
+        XLogRecPtr applied = psql_mongo_replication_cpp_applied_lsn();
+
+        if(applied > confirmed && TimestampDifferenceExceeds(confirmed_at, GetCurrentTimestamp(), psql_to_mongo_local_confirm_ms))
+        {
+            LogicalConfirmReceivedLocation(applied);
+
+            confirmed = applied;
+            confirmed_at = GetCurrentTimestamp();
+        }
+
+        CHECK_FOR_INTERRUPTS();
+    }
+
+    XLogRecPtr applied = psql_mongo_replication_cpp_applied_lsn();
+
+    if(applied > confirmed)
+        LogicalConfirmReceivedLocation(applied);
+
+    FreeDecodingContext(ctx);
+
+    ReplicationSlotRelease();
+}
+
+#endif
+
+void psql_to_mongo_worker_main(Datum main_arg)
+{
+    pqsignal(SIGTERM, psql_to_mongo_worker_sigterm);
+    pqsignal(SIGHUP, psql_to_mongo_worker_sighup);
+    BackgroundWorkerUnblockSignals();
+
+    psql_to_mongo_worker_control_t* control = psql_to_mongo_worker_control();
+
+    if(control == NULL)
+        elog(ERROR, "psql_to_mongo_worker: no control segment");
+
+    /* started by psql_to_mongo_replication_worker_start() or from postgresql.conf */
+    if(!DatumGetBool(main_arg))
+    {
+        strlcpy(control->dbname, psql_to_mongo_worker_database, NAMEDATALEN);
+        strlcpy(control->host, psql_to_mongo_worker_host? psql_to_mongo_worker_host: "", NAMEDATALEN);
+        strlcpy(control->port, psql_to_mongo_worker_port? psql_to_mongo_worker_port: "", NAMEDATALEN);
+        strlcpy(control->username, psql_to_mongo_worker_username? psql_to_mongo_worker_username: "", NAMEDATALEN);
+        control->initial_sync = false;
+    }
+
+    /* empty for the worker started from postgresql.conf, libpq reads .pgpass */
+    char password[BGW_EXTRALEN];
+
+    strlcpy(password, MyBgworkerEntry->bgw_extra, BGW_EXTRALEN);
+
+    control->postmaster_start = PgStartTime;
+    control->pid = MyProcPid;
+    on_proc_exit(psql_to_mongo_worker_exit, 0);
+
+    BackgroundWorkerInitializeConnection(control->dbname, NULL, 0);
+
+    elog(LOG, "psql_to_mongo_worker: replicating %s", control->dbname);
+
+    SetCurrentStatementStartTimestamp();
+    StartTransactionCommand();
+    SPI_connect();
+    PushActiveSnapshot(GetTransactionSnapshot());
+
+    init_extention();
+
+    SPI_finish();
+    PopActiveSnapshot();
+    CommitTransactionCommand();
+
+    struct psql_to_mongo_stats_t* stats =
+        psql_to_mongo_shm_attach("psql_to_mongo_stats", sizeof(struct psql_to_mongo_stats_t), true);
+
+    if(stats)
+        psql_to_mongo_stats_reset(stats);
+
+    psql_mongo_replication_cpp_set_stats(stats);
+    psql_mongo_replication_cpp_set_on_idle(psql_to_mongo_worker_on_idle);
+
+    /* a restart after this streams from the slot the sync created */
+    if(control->initial_sync)
+    {
+        control->initial_sync = false;
+
+        if(!psql_mongo_replication_cpp_initial_sync(
+              control->dbname
+            , control->host[0]? control->host: NULL
+            , control->port[0]? control->port: NULL
+            , control->username[0]? control->username: NULL
+            , password[0]? password: NULL))
+        {
+            elog(WARNING, "psql_to_mongo_worker: initial sync failed, see the log above");
+            proc_exit(0);
+        }
+
+        psql_mongo_replication_cpp_set_stats(NULL);
+
+        proc_exit(psql_to_mongo_worker_got_sigterm? 0: 1);
+    }
+
+#if PG_VERSION_NUM < 130000
+    if(psql_to_mongo_in_process)
+    {
+        psql_to_mongo_decode_local();
+
+        psql_mongo_replication_cpp_set_stats(NULL);
+
+        proc_exit(psql_to_mongo_worker_got_sigterm? 0: 1);
+    }
+#endif
+
+    /* empty settings fall back to libpq's defaults, as in pg_recvlogical */
+    psql_mongo_replication_cpp_run_replication(
+          control->dbname
+        , control->host[0]? control->host: NULL
+        , control->port[0]? control->port: NULL
+        , control->username[0]? control->username: NULL
+        , password[0]? password: NULL);
+
+    psql_mongo_replication_cpp_set_stats(NULL);
+
+    /* exit code 1 has the postmaster restart a stream that broke off */
+    proc_exit(psql_to_mongo_worker_got_sigterm? 0: 1);
+}
+
+#if PG_VERSION_NUM >= 130000
+/* In-process decoding is written against the PostgreSQL 12 API; turning it on is refused. */
+static bool psql_to_mongo_check_in_process(bool* newval, void** extra, GucSource source)
+{
+    if(!*newval)
+        return true;
+
+    GUC_check_errmsg("psql_to_mongo.in_process is not supported on PostgreSQL %d", PG_VERSION_NUM / 10000);
+    GUC_check_errdetail("In-process decoding is written against the PostgreSQL 12 decoding API.");
+    GUC_check_errhint("Leave it off, the worker streams the slot over a replication connection.");
+
+    return false;
+}
+#else
+#define psql_to_mongo_check_in_process NULL
+#endif
+
+/*
+ * Preloaded, the worker can start with the server: psql_to_mongo.database names the source,
+ * the other settings default to libpq's. The password comes from .pgpass.
+ */
+static void psql_to_mongo_define_settings()
+{
+    DefineCustomStringVariable("psql_to_mongo.database", "Database the replication worker streams from.",
+        NULL, &psql_to_mongo_worker_database, NULL, PGC_POSTMASTER, 0, NULL, NULL, NULL);
+    DefineCustomStringVariable("psql_to_mongo.host", "Host of the replication connection.",
+        NULL, &psql_to_mongo_worker_host, NULL, PGC_POSTMASTER, 0, NULL, NULL, NULL);
+    DefineCustomStringVariable("psql_to_mongo.port", "Port of the replication connection.",
+        NULL, &psql_to_mongo_worker_port, NULL, PGC_POSTMASTER, 0, NULL, NULL, NULL);
+    DefineCustomStringVariable("psql_to_mongo.username", "User of the replication connection.",
+        NULL, &psql_to_mongo_worker_username, NULL, PGC_POSTMASTER, 0, NULL, NULL, NULL);
+    DefineCustomBoolVariable("psql_to_mongo.in_process", "Decode the slot inside the worker instead of streaming it over a replication connection.",
+        NULL, &psql_to_mongo_in_process, false, PGC_SIGHUP, 0, psql_to_mongo_check_in_process, NULL, NULL);
+}
+
+static void psql_to_mongo_worker_register()
+{
+    if(psql_to_mongo_worker_database == NULL || psql_to_mongo_worker_database[0] == '\0')
+        return;
+
+    BackgroundWorker worker;
+
+    psql_to_mongo_worker_fill(&worker, false);
+
+    RegisterBackgroundWorker(&worker);
+}
+
+static void psql_to_mongo_worker_launch(FunctionCallInfo fcinfo, bool initial_sync)
+{
+    elog(INFO, "psql_to_mongo_replication_worker_start: \n");
+
+    if(PG_NARGS() != 5)
+    {
+        elog(ERROR, "psql_to_mongo_replication_worker_start: PG_NARGS to few %d", PG_NARGS());
+        return;
+    }
+
+    psql_to_mongo_worker_control_t* control = psql_to_mongo_worker_control();
+
+    if(control == NULL)
+        elog(ERROR, "psql_to_mongo_replication_worker_start: no control segment");
+
+    pid_t pid = psql_to_mongo_worker_pid(control);
+
+    if(pid != 0)
+    {
+        elog(NOTICE, "psql_to_mongo_replication_worker_start: already running, pid %d", (int) pid);
+        return;
+    }
+
+    if(pg_atomic_exchange_u32(&control->starting, 1) != 0)
+    {
+        elog(NOTICE, "psql_to_mongo_replication_worker_start: another backend is starting it");
+        return;
+    }
+
+    BackgroundWorker worker;
+    BackgroundWorkerHandle* handle;
+    bool registered = false;
+    BgwHandleStatus status = BGWH_STOPPED;
+
+    /* an error, or a cancel while waiting for the worker, must not leave it set for good */
+    PG_TRY();
+    {
+        control->initial_sync = initial_sync;
+
+        copyDataFromArg(control->dbname, db_name_column);
+        copyDataFromArg(control->port, port_column);
+        copyDataFromArg(control->host, host_column);
+        copyDataFromArg(control->username, username_column);
+
+        elog(INFO, "psql_to_mongo_replication_worker_start: '%s', '%s', '%s', '%s'\n",
+            control->dbname, control->host, control->port, control->username);
+
+        char password[NAMEDATALEN];
+
+        psql_to_mongo_worker_fill(&worker, true);
+        worker.bgw_notify_pid = MyProcPid;
+
+        copyDataFromArg(password, pswd_column);
+        strlcpy(worker.bgw_extra, password, BGW_EXTRALEN);
+        explicit_bzero(password, sizeof(password));
+
+        registered = RegisterDynamicBackgroundWorker(&worker, &handle);
+
+        if(registered)
+            status = WaitForBackgroundWorkerStartup(handle, &pid);
+    }
+    PG_CATCH();
+    {
+        pg_atomic_write_u32(&control->starting, 0);
+        PG_RE_THROW();
+    }
+    PG_END_TRY();
+
+    pg_atomic_write_u32(&control->starting, 0);
+
+    if(!registered)
+    {
+        ereport(ERROR,
+            (errcode(ERRCODE_INSUFFICIENT_RESOURCES),
+             errmsg("psql_to_mongo_replication_worker_start: could not register background worker"),
+             errhint("You may need to increase max_worker_processes.")));
+    }
+
+    if(status != BGWH_STARTED)
+        elog(ERROR, "psql_to_mongo_replication_worker_start: background worker didn't start");
+
+    elog(INFO, "psql_to_mongo_replication_worker_start: started, pid %d\n", (int) pid);
+}
+
+PG_FUNCTION_INFO_V1(psql_to_mongo_replication_worker_start);
+
+Datum
+psql_to_mongo_replication_worker_start(PG_FUNCTION_ARGS)
+{
+    psql_to_mongo_worker_launch(fcinfo, false);
+
+    PG_RETURN_VOID();
+}
+
+PG_FUNCTION_INFO_V1(psql_to_mongo_replication_worker_initial_sync);
+
+Datum
+psql_to_mongo_replication_worker_initial_sync(PG_FUNCTION_ARGS)
+{
+    psql_to_mongo_worker_launch(fcinfo, true);
+
+    PG_RETURN_VOID();
+}
+
+PG_FUNCTION_INFO_V1(psql_to_mongo_replication_worker_stop);
+
+Datum
+psql_to_mongo_replication_worker_stop(PG_FUNCTION_ARGS)
+{
+    psql_to_mongo_worker_control_t* control = psql_to_mongo_worker_control();
+    pid_t pid = control? psql_to_mongo_worker_pid(control): 0;
+
+    if(pid == 0)
+        PG_RETURN_BOOL(false);
+
+    elog(INFO, "psql_to_mongo_replication_worker_stop: pid %d\n", (int) pid);
+
+    PG_RETURN_BOOL(kill(pid, SIGTERM) == 0);
+}
+
+PG_FUNCTION_INFO_V1(psql_to_mongo_set_subscriber_option);
+
+Datum
+psql_to_mongo_set_subscriber_option(PG_FUNCTION_ARGS)
+{
+    int32 id = PG_GETARG_INT32(0);
+    char *name = text_to_cstring(PG_GETARG_TEXT_PP(1));
+    char *value = text_to_cstring(PG_GETARG_TEXT_PP(2));
+
+    elog(INFO, "psql_to_mongo_set_subscriber_option: %d %s = %s\n", id, name, value);
+
+    SPI_connect();
+
+    char *query = psprintf("INSERT INTO psql_to_mongo_replication.subscriber_options VALUES (%d, %s, %s) \
+        ON CONFLICT (subscriber_id, name) DO UPDATE SET value = EXCLUDED.value;",
+        id, quote_literal_cstr(name), quote_literal_cstr(value));
+
+    int ret = SPI_exec(query, 0);
+
+    if(ret < 0)
+    {
+        elog(ERROR, "psql_to_mongo_set_subscriber_option: SPI_exec...error %s", SPI_result_code_string(ret));
+    }
+
+    SPI_finish();
+
+    psql_to_mongo_worker_signal(SIGHUP);
+
+    PG_RETURN_BOOL(psql_mongo_replication_cpp_set_subscriber_option(id, name, value));
+}
+
+PG_FUNCTION_INFO_V1(psql_to_mongo_set_replication_option);
+
+Datum
+psql_to_mongo_set_replication_option(PG_FUNCTION_ARGS)
+{
+    char *name = text_to_cstring(PG_GETARG_TEXT_PP(0));
+    char *value = text_to_cstring(PG_GETARG_TEXT_PP(1));
+
+    elog(INFO, "psql_to_mongo_set_replication_option: %s = %s\n", name, value);
+
+    SPI_connect();
+
+    char *query = psprintf("INSERT INTO psql_to_mongo_replication.replication_options VALUES (%s, %s) \
+        ON CONFLICT (name) DO UPDATE SET value = EXCLUDED.value;",
+        quote_literal_cstr(name), quote_literal_cstr(value));
+
+    int ret = SPI_exec(query, 0);
+
+    if(ret < 0)
+    {
+        elog(ERROR, "psql_to_mongo_set_replication_option: SPI_exec...error %s", SPI_result_code_string(ret));
+    }
+
+    SPI_finish();
+
+    psql_to_mongo_worker_signal(SIGHUP);
+
+    PG_RETURN_BOOL(psql_mongo_replication_cpp_set_replication_option(name, value));
+}
+
+PG_FUNCTION_INFO_V1(psql_to_mongo_stats);
+
+Datum
+psql_to_mongo_stats(PG_FUNCTION_ARGS)
+{
+    enum { stats_columns = 16 };
+
+    ReturnSetInfo* rsinfo = (ReturnSetInfo*) fcinfo->resultinfo;
+    TupleDesc tupdesc;
+
+    if(rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo) || !(rsinfo->allowedModes & SFRM_Materialize))
+    {
+        ereport(ERROR,
+            (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+             errmsg("psql_to_mongo_stats: set-valued function called in context that cannot accept a set")));
+    }
+
+    if(get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+        elog(ERROR, "psql_to_mongo_stats: return type must be a row type");
+
+    MemoryContext oldcontext = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+
+    tupdesc = CreateTupleDescCopy(tupdesc);
+    Tuplestorestate* tupstore = tuplestore_begin_heap(true, false, work_mem);
+
+    rsinfo->returnMode = SFRM_Materialize;
+    rsinfo->setResult = tupstore;
+    rsinfo->setDesc = tupdesc;
+
+    MemoryContextSwitchTo(oldcontext);
+
+    const struct psql_to_mongo_stats_t* stats = psql_to_mongo_stats_attach();
+
+    if(stats == NULL)
+    {
+        elog(NOTICE, "psql_to_mongo_stats: replication worker isn't running");
+        return (Datum) 0;
+    }
+
+    /* everything but the subscriber slots, each of them has its own count */
+    struct psql_to_mongo_stats_t header;
+
+    if(!psql_to_mongo_stats_copy(&header, stats, offsetof(struct psql_to_mongo_stats_t, subscribers), &stats->changecount))
+    {
+        elog(WARNING, "psql_to_mongo_stats: stats are being rewritten, try again");
+        return (Datum) 0;
+    }
+
+    uint32_t count = Min(header.subscriber_count, PSQL_TO_MONGO_STATS_MAX_SUBSCRIBERS);
+
+    for(uint32_t i = 0; i < count; ++i)
+    {
+        struct psql_to_mongo_subscriber_stats_t slot;
+
+        if(!psql_to_mongo_stats_copy(&slot, &stats->subscribers[i], sizeof(slot), &stats->subscribers[i].changecount))
+            continue;
+
+        Datum values[stats_columns];
+        bool nulls[stats_columns];
+        int column = 0;
+
+        memset(nulls, 0, sizeof(nulls));
+
+        values[column++] = Int32GetDatum(slot.subscriber_id);
+        values[column++] = Int64GetDatum(slot.queued);
+        values[column++] = LSNGetDatum(slot.applied_lsn);
+        values[column++] = Int64GetDatum(slot.lag_bytes);
+        values[column++] = Float8GetDatum(slot.lag_seconds);
+        values[column++] = Int64GetDatum(slot.batch_limit);
+        values[column++] = Int64GetDatum(slot.batches);
+        values[column++] = Int64GetDatum(slot.errors);
+        values[column++] = Int64GetDatum(slot.rows_applied);
+        values[column++] = Float8GetDatum(slot.rows_per_sec);
+        values[column++] = Float8GetDatum(slot.bytes_per_sec);
+        values[column++] = Int64GetDatum(slot.ack_p50_ms);
+        values[column++] = Int64GetDatum(slot.ack_p99_ms);
+        values[column++] = LSNGetDatum(header.received_lsn);
+        values[column++] = LSNGetDatum(header.wal_end);
+        values[column++] = TimestampTzGetDatum((TimestampTz) (header.updated_at
+            - (TimestampTz) (POSTGRES_EPOCH_JDATE - UNIX_EPOCH_JDATE) * SECS_PER_DAY * USECS_PER_SEC));
+
+        tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+    }
+
+    return (Datum) 0;
+}